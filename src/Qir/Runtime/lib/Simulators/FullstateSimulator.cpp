@@ -529,6 +529,23 @@ namespace Quantum
             return (std::abs(actualProbability - probabilityOfZero) < precision);
         }
 
+        bool GetReducedDensityMatrix(long numTargets, QubitIdType targets[], std::complex<double> matrix[]) override
+        {
+            typedef void (*TReducedDensityMatrix)(unsigned, unsigned, unsigned*, double*, double*);
+            static TReducedDensityMatrix reducedDensityMatrix =
+                reinterpret_cast<TReducedDensityMatrix>(this->GetProc("ReducedDensityMatrix"));
+
+            std::vector<unsigned> ids = GetQubitIds(numTargets, targets);
+            const size_t size         = size_t{1} << (2 * numTargets);
+            std::vector<double> re(size), im(size);
+            reducedDensityMatrix(this->simulatorId, (unsigned)numTargets, ids.data(), re.data(), im.data());
+            for (size_t i = 0; i < size; ++i)
+            {
+                matrix[i] = std::complex<double>(re[i], im[i]);
+            }
+            return true;
+        }
+
       private:
         std::ostream& GetOutStream(const void* location, std::ofstream& outFileStream);
         void DumpMachineImpl(std::ostream& outStream);
@@ -83,6 +83,15 @@ namespace Quantum
                                        const char* failureMessage) = 0; // TODO: The `failureMessage` is not used,
                                                                         // consider removing. The `bool` is returned.
 
+        // Writes the reduced density matrix of the target qubits, with the rest of the system traced out, into `matrix`:
+        // 2^numTargets x 2^numTargets entries in row-major order, whose row and column indices have `targets[i]` as bit
+        // i. Returns `false` if the simulator doesn't support it.
+        virtual bool GetReducedDensityMatrix(long /*numTargets*/, QubitIdType /*targets*/[],
+                                             std::complex<double> /*matrix*/[])
+        {
+            return false;
+        }
+
       private:
         IDiagnostics& operator=(const IDiagnostics&) = delete;
         IDiagnostics(const IDiagnostics&)            = delete;
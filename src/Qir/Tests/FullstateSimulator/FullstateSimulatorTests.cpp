@@ -184,6 +184,45 @@ TEST_CASE("Fullstate simulator: assert probability", "[fullstate_simulator]")
     sim->ReleaseQubit(qs[1]);
 }
 
+TEST_CASE("Fullstate simulator: reduced density matrix", "[fullstate_simulator]")
+{
+    std::unique_ptr<IRuntimeDriver> sim = CreateFullstateSimulator();
+    IQuantumGateSet* iqa                = dynamic_cast<IQuantumGateSet*>(sim.get());
+    IDiagnostics* idig                  = dynamic_cast<IDiagnostics*>(sim.get());
+
+    QubitIdType qs[3];
+    for (int i = 0; i < 3; i++)
+    {
+        qs[i] = sim->AllocateQubit();
+    }
+    iqa->H(qs[0]);
+    iqa->ControlledX(1, &qs[0], qs[1]);
+    iqa->X(qs[2]);
+
+    // half of a Bell pair is maximally mixed
+    std::complex<double> rho[16];
+    REQUIRE(idig->GetReducedDensityMatrix(1, &qs[0], rho));
+    REQUIRE(0.5 == Approx(rho[0].real()).epsilon(0.0001));
+    REQUIRE(0.5 == Approx(rho[3].real()).epsilon(0.0001));
+    REQUIRE(std::abs(rho[1]) < 1e-10);
+
+    // the pair and |1> are pure
+    REQUIRE(idig->GetReducedDensityMatrix(2, qs, rho));
+    for (int i = 0; i < 16; i++)
+    {
+        const double expected = (i == 0 || i == 3 || i == 12 || i == 15) ? 0.5 : 0.0;
+        REQUIRE(std::abs(rho[i] - expected) < 1e-10);
+    }
+    REQUIRE(idig->GetReducedDensityMatrix(1, &qs[2], rho));
+    REQUIRE(std::abs(rho[3] - 1.0) < 1e-10);
+
+    for (int i = 0; i < 3; i++)
+    {
+        MZ(iqa, qs[i]);
+        sim->ReleaseQubit(qs[i]);
+    }
+}
+
 TEST_CASE("Fullstate simulator: toffoli", "[fullstate_simulator]")
 {
     std::unique_ptr<IRuntimeDriver> sim = CreateFullstateSimulator();
@@ -49,7 +49,7 @@ void kernel(V& psi, unsigned id0, M const& matrix, std::size_t ctrlmask)
 
 #ifndef _MSC_VER
 	if (ctrlmask == 0){
-		#pragma omp parallel for collapse(LOOP_COLLAPSE1) schedule(static) proc_bind(spread)
+		#pragma omp for collapse(LOOP_COLLAPSE1) schedule(static)
 		for (std::size_t i0 = 0; i0 < n; i0 += 2 * dsorted[0]){
 			for (std::size_t i1 = 0; i1 < dsorted[0]; ++i1){
 				kernel_core(psi, i0 + i1, dsorted[0], mm, mmt);
@@ -57,7 +57,7 @@ void kernel(V& psi, unsigned id0, M const& matrix, std::size_t ctrlmask)
 		}
 	}
 	else{
-		#pragma omp parallel for collapse(LOOP_COLLAPSE1) schedule(static)
+		#pragma omp for collapse(LOOP_COLLAPSE1) schedule(static)
 		for (std::size_t i0 = 0; i0 < n; i0 += 2 * dsorted[0]){
 			for (std::size_t i1 = 0; i1 < dsorted[0]; ++i1){
 				if (((i0 + i1)&ctrlmask) == ctrlmask)
@@ -70,12 +70,12 @@ void kernel(V& psi, unsigned id0, M const& matrix, std::size_t ctrlmask)
 	std::intptr_t dmask = dsorted[0];
 
 	if (ctrlmask == 0){
-		#pragma omp parallel for schedule(static)
+		#pragma omp for schedule(static)
 		for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(n); ++i)
 			if ((i & dmask) == zero)
 				kernel_core(psi, i, dsorted[0], mm, mmt);
 	} else {
-		#pragma omp parallel for schedule(static)
+		#pragma omp for schedule(static)
 		for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(n); ++i)
 			if ((i & ctrlmask) == ctrlmask && (i & dmask) == zero)
 				kernel_core(psi, i, dsorted[0], mm, mmt);
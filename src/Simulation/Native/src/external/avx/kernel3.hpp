@@ -102,7 +102,7 @@ void kernel(V& psi, unsigned id2, unsigned id1, unsigned id0, M const& matrix, s
 
 #ifndef _MSC_VER
 	if (ctrlmask == 0){
-		#pragma omp parallel for collapse(LOOP_COLLAPSE3) schedule(static) proc_bind(spread)
+		#pragma omp for collapse(LOOP_COLLAPSE3) schedule(static)
 		for (std::size_t i0 = 0; i0 < n; i0 += 2 * dsorted[0]){
 			for (std::size_t i1 = 0; i1 < dsorted[0]; i1 += 2 * dsorted[1]){
 				for (std::size_t i2 = 0; i2 < dsorted[1]; i2 += 2 * dsorted[2]){
@@ -114,7 +114,7 @@ void kernel(V& psi, unsigned id2, unsigned id1, unsigned id0, M const& matrix, s
 		}
 	}
 	else{
-		#pragma omp parallel for collapse(LOOP_COLLAPSE3) schedule(static)
+		#pragma omp for collapse(LOOP_COLLAPSE3) schedule(static)
 		for (std::size_t i0 = 0; i0 < n; i0 += 2 * dsorted[0]){
 			for (std::size_t i1 = 0; i1 < dsorted[0]; i1 += 2 * dsorted[1]){
 				for (std::size_t i2 = 0; i2 < dsorted[1]; i2 += 2 * dsorted[2]){
@@ -131,12 +131,12 @@ void kernel(V& psi, unsigned id2, unsigned id1, unsigned id0, M const& matrix, s
 	std::intptr_t dmask = dsorted[0] + dsorted[1] + dsorted[2];
 
 	if (ctrlmask == 0){
-		#pragma omp parallel for schedule(static)
+		#pragma omp for schedule(static)
 		for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(n); ++i)
 			if ((i & dmask) == zero)
 				kernel_core(psi, i, dsorted[2], dsorted[1], dsorted[0], mm, mmt);
 	} else {
-		#pragma omp parallel for schedule(static)
+		#pragma omp for schedule(static)
 		for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(n); ++i)
 			if ((i & ctrlmask) == ctrlmask && (i & dmask) == zero)
 				kernel_core(psi, i, dsorted[2], dsorted[1], dsorted[0], mm, mmt);
@@ -60,21 +60,52 @@ class Fused
         return maxFusedDepth;
     }
 
-    template <class T, class A>
-    void flush(std::vector<T, A>& wfn) const
+    // number of qubits the matrix of the last fuse() acts on, 0 if nothing was fused
+    std::size_t fusedSpan() const {
+        return fusedQubits.size();
+    }
+
+    // positions the matrix of the last fuse() acts on
+    const Fusion::IndexVector& fusedPositions() const {
+        return fusedQubits;
+    }
+
+    // bytes held by the matrix of the last fuse(), with the alignment slack of its rows
+    std::size_t matrixBytes() const {
+      std::size_t bytes = fusedMatrix.capacity() * sizeof(Fusion::Matrix::value_type);
+      for (auto const& row : fusedMatrix)
+        bytes += row.capacity() * sizeof(Fusion::Matrix::value_type::value_type) + 64;
+      return bytes;
+    }
+
+    // Multiplies the queued gates into one matrix (kept in fusedMatrix, fusedQubits and fusedCtrlMask) and clears the
+    // queue. Returns false if nothing was queued.
+    bool fuse() const
     {
+      fusedQubits.clear();
       if (fusedgates.size() == 0)
-        return;
-      
-      Fusion::Matrix m;
-      Fusion::IndexVector qs, cs;
+        return false;
 
-      fusedgates.perform_fusion(m, qs, cs);
+      Fusion::IndexVector cs;
+      fusedgates.perform_fusion(fusedMatrix, fusedQubits, cs);
 
-      std::size_t cmask = 0;
+      fusedCtrlMask = 0;
       for (auto c : cs)
-        cmask |= (1ull << c);
-      
+        fusedCtrlMask |= (1ull << c);
+
+      fusedgates = Fusion();
+      return true;
+    }
+
+    // Applies the matrix of the last fuse(). The kernels contain orphaned work-sharing loops, so inside a parallel
+    // region this has to be called by all threads of the team; outside of one it runs on the calling thread.
+    template <class T, class A>
+    void apply_fused(std::vector<T, A>& wfn) const
+    {
+      Fusion::Matrix const& m = fusedMatrix;
+      Fusion::IndexVector const& qs = fusedQubits;
+      std::size_t cmask = fusedCtrlMask;
+
       switch (qs.size())
       {
         case 1:
@@ -99,8 +130,20 @@ class Fused
             ::kernel(wfn, qs[6], qs[5], qs[4], qs[3], qs[2], qs[1], qs[0], m, cmask);
             break;
       }
+    }
 
-      fusedgates = Fusion();
+    template <class T, class A>
+    void flush(std::vector<T, A>& wfn) const
+    {
+      if (!fuse())
+        return;
+
+#ifndef _MSC_VER
+#pragma omp parallel proc_bind(spread)
+#else
+#pragma omp parallel
+#endif
+      apply_fused(wfn);
     }
     
     template <class M>
@@ -120,6 +163,12 @@ class Fused
         fusedgates.insert(convertMatrix(mat), qs, cs);
     }
 
+    // queues a dense matrix acting on the positions qs (qs[i] is bit i of its row and column indices)
+    void apply_matrix(Fusion::Matrix mat, std::vector<unsigned> const& qs, std::vector<unsigned> const& cs) const
+    {
+        fusedgates.insert(std::move(mat), qs, cs);
+    }
+
     template <class T, class A, class M>
     void apply(std::vector<T, A>& wfn, M const& mat, unsigned q) const
     {
@@ -153,6 +202,8 @@ class Fused
                     if (nMaxThrds > 8) nMaxThrds = 8;                       // Small problem, never use too many
                     else if (nMaxThrds > 3) nMaxThrds = 3;                  // Small problem on a small machine
                 }
+                unsigned budget = Microsoft::Quantum::openmp::thread_budget();
+                if (budget > 0 && nMaxThrds > (int)budget) nMaxThrds = budget; // Share of a concurrent engine
                 omp_set_num_threads(nMaxThrds);
             }
 #endif
@@ -175,6 +226,8 @@ class Fused
             char* envFS = NULL;
             maxFusedSpan = 4;                               // General sweet spot
             if (wfnCapacity < 1u << 20) maxFusedSpan = 2;   // Don't pre-fuse small problems
+            if (Microsoft::Quantum::MappedStorage::instance().is_mapped(wfn.data()))
+                maxFusedSpan = 7;                           // Every sweep pages the whole file, fuse as wide as we can
 #ifdef _MSC_VER
             err = _dupenv_s(&envFS, &len, "QDK_SIM_FUSESPAN");
             if (envFS != NULL && len > 0) {
@@ -195,6 +248,11 @@ class Fused
   private:
     mutable Fusion fusedgates;
 
+    // result of the last fuse()
+    mutable Fusion::Matrix      fusedMatrix;
+    mutable Fusion::IndexVector fusedQubits;
+    mutable std::size_t         fusedCtrlMask = 0;
+
     //: New runtime optimizatin settings
     mutable size_t wfnCapacity;
     mutable int    maxFusedSpan;
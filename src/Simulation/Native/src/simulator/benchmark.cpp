@@ -0,0 +1,481 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+// Benchmarks of the native simulator through its C API:
+//  - kernel/k<arity>/<controlled|uncontrolled>: one fused kernel sweep (ApplyMatrix on 1 to 7 qubits),
+//  - fusion/single_qubit_layers, measurement/all_qubits: gate fusion and clustering, measurements,
+//  - circuit/<qft|ladder|adder|random>: whole circuits through the gate cache,
+// each for every instruction set, thread count and state size asked for. The results go to a JSON file (one result per
+// line). Given a baseline written by an earlier run on the same host, every result that got slower by more than the
+// tolerance is reported and the exit code is 1.
+//
+// simulator_benchmark [--qubits 16,20,24] [--threads 1,8] [--isa generic,avx,avx2,avx512] [--repetitions 5]
+//                     [--filter text] [--output benchmark.json] [--baseline file-or-directory] [--tolerance 0.15]
+//                     [--quick]
+// A baseline directory holds one file per host, named <host>.json.
+
+#include "simulator/capi.hpp"
+#include "util/cpuid.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <omp.h>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <stdlib.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+const double pi = 3.14159265358979323846;
+
+struct Options
+{
+    std::vector<unsigned> qubits = {16, 20, 24};
+    std::vector<int> threads;
+    std::vector<std::string> isas;
+    unsigned repetitions = 5;
+    double min_seconds = 0.05; // of every repetition
+    std::string filter;
+    std::string output = "benchmark.json";
+    std::string baseline;
+    double tolerance = 0.15;
+};
+
+struct Result
+{
+    std::string id;
+    std::string name;
+    std::string isa;
+    int threads;
+    unsigned qubits;
+    double seconds;     // median over the repetitions, per run
+    double min_seconds; // fastest repetition, per run
+    double bytes;       // bytes of the state swept per run, 0 if not meaningful
+};
+
+void set_environment(const char* name, std::string const& value)
+{
+#ifdef _WIN32
+    _putenv_s(name, value.c_str());
+#else
+    setenv(name, value.c_str(), 1);
+#endif
+}
+
+std::string host_name()
+{
+#ifdef _WIN32
+    const char* name = getenv("COMPUTERNAME");
+    return name != nullptr ? name : "unknown";
+#else
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) return "unknown";
+    return name;
+#endif
+}
+
+std::vector<std::string> supported_isas()
+{
+    using namespace Microsoft::Quantum;
+    std::vector<std::string> isas = {"generic"};
+    if (haveAVX()) isas.push_back("avx");
+    if (haveFMA() && haveAVX2()) isas.push_back("avx2");
+    if (haveAVX512()) isas.push_back("avx512");
+    return isas;
+}
+
+template <class T>
+std::vector<T> parse_list(std::string const& text, std::function<T(std::string const&)> convert)
+{
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        if (!item.empty()) values.push_back(convert(item));
+    return values;
+}
+
+// Times `run` and returns the median and the minimum over the repetitions of the time per run. Every repetition runs it
+// often enough to take at least `min_seconds`.
+std::pair<double, double> time_runs(Options const& options, std::function<void()> const& run)
+{
+    using clock = std::chrono::steady_clock;
+    auto elapsed = [&run](unsigned n) {
+        auto start = clock::now();
+        for (unsigned i = 0; i < n; ++i)
+            run();
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    const double once = std::max(elapsed(1), 1e-9);
+    const unsigned n = static_cast<unsigned>(std::min(1e5, std::max(1., std::ceil(options.min_seconds / once))));
+    std::vector<double> samples;
+    for (unsigned r = 0; r < options.repetitions; ++r)
+        samples.push_back(elapsed(n) / n);
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples.front()};
+}
+
+// flushes the gate cache
+void synchronize(unsigned sid)
+{
+    std::size_t length;
+    StateData(sid, &length);
+}
+
+unsigned prepare(unsigned n)
+{
+    unsigned sid = init();
+    seed(sid, 42);
+    for (unsigned q = 0; q < n; ++q)
+    {
+        allocateQubit(sid, q);
+        R(sid, 3, 0.1 + 0.2 * q, q);
+    }
+    synchronize(sid);
+    return sid;
+}
+
+void CX(unsigned sid, unsigned c, unsigned q)
+{
+    MCX(sid, 1, &c, q);
+}
+
+void CCX(unsigned sid, unsigned c1, unsigned c2, unsigned q)
+{
+    unsigned cs[] = {c1, c2};
+    MCX(sid, 2, cs, q);
+}
+
+void qft(unsigned sid, unsigned n)
+{
+    for (unsigned j = n; j-- > 0;)
+    {
+        H(sid, j);
+        for (unsigned k = 0; k < j; ++k)
+            MCR(sid, 2, pi / (1u << (j - k)), 1, &k, j);
+    }
+}
+
+void ladder(unsigned sid, unsigned n)
+{
+    for (unsigned layer = 0; layer < 10; ++layer)
+        for (unsigned q = 0; q + 1 < n; ++q)
+            CX(sid, q, q + 1);
+}
+
+// Cuccaro ripple-carry adder b += a on interleaved registers: qubit 0 is the carry, b_i = 1 + 2 i and a_i = 2 + 2 i.
+void adder(unsigned sid, unsigned n)
+{
+    const unsigned m = (n - 1) / 2;
+    if (m == 0) return;
+    auto maj = [sid](unsigned c, unsigned b, unsigned a) {
+        CX(sid, a, b);
+        CX(sid, a, c);
+        CCX(sid, c, b, a);
+    };
+    auto uma = [sid](unsigned c, unsigned b, unsigned a) {
+        CCX(sid, c, b, a);
+        CX(sid, a, c);
+        CX(sid, c, b);
+    };
+    for (unsigned i = 0; i < m; ++i)
+        maj(i == 0 ? 0 : 2 * i, 1 + 2 * i, 2 + 2 * i);
+    for (unsigned i = m; i-- > 0;)
+        uma(i == 0 ? 0 : 2 * i, 1 + 2 * i, 2 + 2 * i);
+}
+
+void random_circuit(unsigned sid, unsigned n)
+{
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<unsigned> qubit(0, n - 1), kind(0, 4);
+    std::uniform_real_distribution<double> angle(0., 2 * pi);
+    for (unsigned g = 0; g < 20 * n; ++g)
+    {
+        const unsigned q = qubit(gen);
+        switch (kind(gen))
+        {
+        case 0:
+            H(sid, q);
+            break;
+        case 1:
+            T(sid, q);
+            break;
+        case 2:
+            S(sid, q);
+            break;
+        case 3:
+            R(sid, 3, angle(gen), q);
+            break;
+        default:
+            const unsigned c = (q + 1 + qubit(gen) % (n - 1)) % n;
+            CX(sid, c, q);
+        }
+    }
+}
+
+class Suite
+{
+  public:
+    explicit Suite(Options const& options)
+        : options_(options)
+    {
+    }
+
+    void run_all()
+    {
+        for (auto const& isa : options_.isas)
+        {
+            set_environment("QDK_SIM_ISA", isa);
+            for (int t : options_.threads)
+            {
+                omp_set_num_threads(t);
+                for (unsigned n : options_.qubits)
+                    run_size(isa, t, n);
+            }
+        }
+    }
+
+    std::vector<Result> const& results() const
+    {
+        return results_;
+    }
+
+  private:
+    void run_size(std::string const& isa, int threads, unsigned n)
+    {
+        const double state_bytes = std::ldexp(16., static_cast<int>(n));
+
+        for (unsigned k = 1; k <= 7 && k < n; ++k)
+        {
+            for (bool controlled : {false, true})
+            {
+                std::string name = "kernel/k" + std::to_string(k) + (controlled ? "/controlled" : "/uncontrolled");
+                if (!selected(name)) continue;
+
+                // the targets spread over the state, the control is the last qubit
+                std::vector<unsigned> qs;
+                for (unsigned i = 0; i < k; ++i)
+                    qs.push_back(i * (n - 1) / k);
+                unsigned c = n - 1;
+                const std::size_t dim = std::size_t(1) << k;
+                std::vector<double> re(dim * dim), im(dim * dim, 0.);
+                // a permutation matrix keeps the state normalized however often it is applied
+                for (std::size_t i = 0; i < dim; ++i)
+                    re[i * dim + (i + 1) % dim] = 1.;
+
+                unsigned sid = prepare(n);
+                auto timing = time_runs(options_, [&]() {
+                    ApplyMatrix(sid, k, qs.data(), re.data(), im.data(), controlled ? 1 : 0, &c);
+                });
+                destroy(sid);
+                add(name, isa, threads, n, timing, 2 * state_bytes);
+            }
+        }
+
+        run_circuit("fusion/single_qubit_layers", isa, threads, n, [](unsigned sid, unsigned n) {
+            for (unsigned layer = 0; layer < 20; ++layer)
+                for (unsigned q = 0; q < n; ++q)
+                    R(sid, 3, 0.01 * (layer + 1), q);
+        });
+        run_circuit("measurement/all_qubits", isa, threads, n, [](unsigned sid, unsigned n) {
+            for (unsigned q = 0; q < n; ++q)
+                H(sid, q);
+            for (unsigned q = 0; q < n; ++q)
+                M(sid, q);
+        });
+        run_circuit("circuit/qft", isa, threads, n, qft);
+        run_circuit("circuit/ladder", isa, threads, n, ladder);
+        run_circuit("circuit/adder", isa, threads, n, adder);
+        run_circuit("circuit/random", isa, threads, n, random_circuit);
+    }
+
+    void run_circuit(
+        std::string const& name,
+        std::string const& isa,
+        int threads,
+        unsigned n,
+        std::function<void(unsigned, unsigned)> const& circuit)
+    {
+        if (!selected(name)) return;
+        unsigned sid = prepare(n);
+        auto timing = time_runs(options_, [&]() {
+            circuit(sid, n);
+            synchronize(sid);
+        });
+        destroy(sid);
+        add(name, isa, threads, n, timing, 0.);
+    }
+
+    bool selected(std::string const& name) const
+    {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    void add(
+        std::string const& name,
+        std::string const& isa,
+        int threads,
+        unsigned n,
+        std::pair<double, double> timing,
+        double bytes)
+    {
+        Result r{name + "/" + isa + "/t" + std::to_string(threads) + "/q" + std::to_string(n),
+                 name,
+                 isa,
+                 threads,
+                 n,
+                 timing.first,
+                 timing.second,
+                 bytes};
+        std::cerr << r.id << ": " << r.seconds * 1e3 << " ms";
+        if (bytes > 0) std::cerr << ", " << bytes / r.seconds * 1e-9 << " GB/s";
+        std::cerr << "\n";
+        results_.push_back(r);
+    }
+
+    Options const& options_;
+    std::vector<Result> results_;
+};
+
+void write_json(std::string const& path, std::string const& host, std::vector<Result> const& results)
+{
+    std::ofstream out(path);
+    out.precision(9);
+    out << "{\"host\":\"" << host << "\",\"hardware_threads\":" << std::thread::hardware_concurrency()
+        << ",\"timestamp\":" << std::time(nullptr) << ",\"results\":[";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        Result const& r = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "{\"id\":\"" << r.id << "\",\"name\":\"" << r.name << "\",\"isa\":\"" << r.isa
+            << "\",\"threads\":" << r.threads << ",\"qubits\":" << r.qubits << ",\"seconds\":" << r.seconds
+            << ",\"min_seconds\":" << r.min_seconds << ",\"bytes\":" << r.bytes << "}";
+    }
+    out << "\n]}\n";
+}
+
+// Reads the seconds per result id of a file written by write_json.
+std::map<std::string, double> read_baseline(std::string const& path)
+{
+    std::map<std::string, double> seconds;
+    std::ifstream in(path);
+    std::string line;
+    const std::regex pattern("\"id\":\"([^\"]+)\".*\"seconds\":([-+0-9.eE]+)");
+    std::smatch match;
+    while (std::getline(in, line))
+        if (std::regex_search(line, match, pattern)) seconds[match[1]] = std::stod(match[2]);
+    return seconds;
+}
+
+// Returns the number of results that are slower than their baseline by more than the tolerance.
+unsigned compare(std::map<std::string, double> const& baseline, std::vector<Result> const& results, double tolerance)
+{
+    unsigned regressions = 0, compared = 0;
+    for (Result const& r : results)
+    {
+        auto it = baseline.find(r.id);
+        if (it == baseline.end() || it->second <= 0.) continue;
+        ++compared;
+        const double change = r.seconds / it->second - 1.;
+        if (change > tolerance)
+        {
+            ++regressions;
+            std::cout << "REGRESSION " << r.id << ": " << it->second * 1e3 << " ms -> " << r.seconds * 1e3 << " ms (+"
+                      << change * 100. << "%)\n";
+        }
+    }
+    std::cout << compared << " results compared with the baseline, " << regressions << " regressions\n";
+    return regressions;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    options.threads = {1, static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))};
+    options.isas = supported_isas();
+
+    auto to_unsigned = [](std::string const& s) { return static_cast<unsigned>(std::stoul(s)); };
+    auto to_int = [](std::string const& s) { return std::stoi(s); };
+    auto to_string = [](std::string const& s) { return s; };
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                std::cerr << "missing value for " << arg << "\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--qubits")
+            options.qubits = parse_list<unsigned>(value(), to_unsigned);
+        else if (arg == "--threads")
+            options.threads = parse_list<int>(value(), to_int);
+        else if (arg == "--isa")
+            options.isas = parse_list<std::string>(value(), to_string);
+        else if (arg == "--repetitions")
+            options.repetitions = std::max(1u, to_unsigned(value()));
+        else if (arg == "--filter")
+            options.filter = value();
+        else if (arg == "--output")
+            options.output = value();
+        else if (arg == "--baseline")
+            options.baseline = value();
+        else if (arg == "--tolerance")
+            options.tolerance = std::stod(value());
+        else if (arg == "--quick")
+        {
+            // a smoke test of the suite rather than a measurement
+            options.qubits = {10};
+            options.threads = {1};
+            options.isas = {supported_isas().back()};
+            options.repetitions = 1;
+            options.min_seconds = 0.;
+        }
+        else
+        {
+            std::cerr << "unknown option " << arg << "\n";
+            return 2;
+        }
+    }
+    options.threads.erase(std::unique(options.threads.begin(), options.threads.end()), options.threads.end());
+
+    // the benchmark sets the thread count itself, and measures the state vector rather than the stabilizer tableau
+    set_environment("OMP_NUM_THREADS", std::to_string(options.threads.front()));
+    set_environment("QDK_SIM_STABILIZER", "0");
+
+    Suite suite(options);
+    suite.run_all();
+
+    const std::string host = host_name();
+    write_json(options.output, host, suite.results());
+
+    if (options.baseline.empty()) return 0;
+    std::string path = options.baseline;
+    if (std::filesystem::is_directory(path)) path = (std::filesystem::path(path) / (host + ".json")).string();
+    if (!std::filesystem::exists(path))
+    {
+        std::cout << "no baseline " << path << "\n";
+        return 0;
+    }
+    return compare(read_baseline(path), suite.results(), options.tolerance) > 0 ? 1 : 0;
+}
@@ -4,6 +4,7 @@
 #include "simulator/capi.hpp"
 #include "simulator/factory.hpp"
 #include "simulator/simulator.hpp"
+#include "util/memorybudget.hpp"
 using namespace Microsoft::Quantum::Simulator;
 
 extern "C"
@@ -15,6 +16,15 @@ extern "C"
         return Microsoft::Quantum::Simulator::create();
     }
 
+    MICROSOFT_QUANTUM_DECL unsigned InitSharded(
+        _In_ const char* session,
+        _In_ unsigned rank,
+        _In_ unsigned processes,
+        _In_ unsigned maxlocal)
+    {
+        return Microsoft::Quantum::Simulator::createSharded(session, rank, processes, maxlocal);
+    }
+
     MICROSOFT_QUANTUM_DECL void destroy(_In_ unsigned id)
     {
         Microsoft::Quantum::Simulator::destroy(id);
@@ -25,6 +35,89 @@ extern "C"
         Microsoft::Quantum::Simulator::get(id)->seed(s);
     }
 
+    MICROSOFT_QUANTUM_DECL void SetStateStorage(_In_ const char* directory, _In_ std::size_t min_bytes)
+    {
+        Microsoft::Quantum::MappedStorage::instance().configure(directory == nullptr ? "" : directory, min_bytes);
+    }
+
+    MICROSOFT_QUANTUM_DECL void StartTrace(_In_ const char* path)
+    {
+        Microsoft::Quantum::TraceRecorder::instance().start(path == nullptr ? "" : path);
+    }
+
+    MICROSOFT_QUANTUM_DECL bool StopTrace()
+    {
+        return Microsoft::Quantum::TraceRecorder::instance().stop();
+    }
+
+    MICROSOFT_QUANTUM_DECL void SetAsyncFlush(_In_ unsigned id, _In_ bool enable)
+    {
+        Microsoft::Quantum::Simulator::get(id)->SetAsyncFlush(enable);
+    }
+
+    MICROSOFT_QUANTUM_DECL void SetStabilizerMode(_In_ unsigned id, _In_ bool enable)
+    {
+        Microsoft::Quantum::Simulator::get(id)->SetStabilizerMode(enable);
+    }
+
+    MICROSOFT_QUANTUM_DECL void GetPerfCounters(_In_ unsigned id, _In_ void (*callback)(const char*, double))
+    {
+        Microsoft::Quantum::Simulator::get(id)->GetPerfCounters(callback);
+    }
+
+    MICROSOFT_QUANTUM_DECL void ResetPerfCounters(_In_ unsigned id)
+    {
+        Microsoft::Quantum::Simulator::get(id)->ResetPerfCounters();
+    }
+
+    // state snapshots
+    MICROSOFT_QUANTUM_DECL unsigned Snapshot(_In_ unsigned id)
+    {
+        return Microsoft::Quantum::Simulator::clone(id);
+    }
+
+    MICROSOFT_QUANTUM_DECL void Restore(_In_ unsigned id, _In_ unsigned snapshot)
+    {
+        auto const psi = Microsoft::Quantum::Simulator::get(snapshot);
+        Microsoft::Quantum::Simulator::get(id)->restore(*psi);
+    }
+
+    // state comparisons
+    MICROSOFT_QUANTUM_DECL void Overlap(_In_ unsigned id1, _In_ unsigned id2, _Out_ double* re, _Out_ double* im)
+    {
+        auto const other = Microsoft::Quantum::Simulator::get(id2);
+        const std::complex<double> overlap = Microsoft::Quantum::Simulator::get(id1)->Overlap(*other);
+        *re = overlap.real();
+        *im = overlap.imag();
+    }
+
+    MICROSOFT_QUANTUM_DECL void ReducedDensityMatrix(
+        _In_ unsigned id,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _Out_writes_(1 << (2 * n)) double* re,
+        _Out_writes_(1 << (2 * n)) double* im)
+    {
+        std::vector<unsigned> qs(q, q + n);
+        const std::vector<std::complex<double>> rho = Microsoft::Quantum::Simulator::get(id)->ReducedDensityMatrix(qs);
+        for (std::size_t i = 0; i < rho.size(); ++i)
+        {
+            re[i] = rho[i].real();
+            im[i] = rho[i].imag();
+        }
+    }
+
+    MICROSOFT_QUANTUM_DECL double TraceDistance(
+        _In_ unsigned id1,
+        _In_ unsigned id2,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q)
+    {
+        auto const other = Microsoft::Quantum::Simulator::get(id2);
+        std::vector<unsigned> qs(q, q + n);
+        return Microsoft::Quantum::Simulator::get(id1)->TraceDistance(*other, qs);
+    }
+
     // non-quantum
     MICROSOFT_QUANTUM_DECL std::size_t random_choice(_In_ unsigned id, _In_ std::size_t n, _In_reads_(n) double* p)
     {
@@ -64,6 +157,21 @@ extern "C"
         return Microsoft::Quantum::Simulator::get(sid)->InjectState(qubits, amplitudes);
     }
 
+    MICROSOFT_QUANTUM_DECL bool SaveState(_In_ unsigned sid, _In_ const char* path)
+    {
+        return Microsoft::Quantum::Simulator::get(sid)->SaveState(path);
+    }
+
+    MICROSOFT_QUANTUM_DECL bool InjectStateFromFile(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_ const char* path)
+    {
+        std::vector<unsigned> qubits(q, q + n);
+        return Microsoft::Quantum::Simulator::get(sid)->InjectState(qubits, path);
+    }
+
     MICROSOFT_QUANTUM_DECL void allocateQubit(_In_ unsigned id, _In_ unsigned q)
     {
         Microsoft::Quantum::Simulator::get(id)->allocateQubit(q);
@@ -76,6 +184,38 @@ extern "C"
         return Microsoft::Quantum::Simulator::get(id)->release(q);
     }
 
+    MICROSOFT_QUANTUM_DECL bool ReleaseQubits(_In_ unsigned id, _In_ unsigned n, _In_reads_(n) unsigned* q)
+    {
+        std::vector<unsigned> qubits(q, q + n);
+        return Microsoft::Quantum::Simulator::get(id)->release(qubits);
+    }
+
+    MICROSOFT_QUANTUM_DECL void SetShrinkThreshold(_In_ unsigned id, _In_ unsigned slack)
+    {
+        Microsoft::Quantum::Simulator::get(id)->SetShrinkThreshold(slack);
+    }
+
+    MICROSOFT_QUANTUM_DECL void SetMemoryBudget(_In_ unsigned id, _In_ std::size_t bytes)
+    {
+        Microsoft::Quantum::Simulator::get(id)->SetMemoryBudget(bytes);
+    }
+
+    MICROSOFT_QUANTUM_DECL void SetProcessMemoryBudget(_In_ std::size_t bytes)
+    {
+        Microsoft::Quantum::MemoryBudget::instance().set_limit(bytes);
+    }
+
+    MICROSOFT_QUANTUM_DECL void MemoryFootprint(_In_ unsigned id, _Out_ std::size_t* current, _Out_ std::size_t* peak)
+    {
+        Microsoft::Quantum::Simulator::get(id)->MemoryFootprint(*current, *peak);
+    }
+
+    MICROSOFT_QUANTUM_DECL void ProcessMemoryFootprint(_Out_ std::size_t* current, _Out_ std::size_t* peak)
+    {
+        *current = Microsoft::Quantum::MemoryBudget::instance().current();
+        *peak = Microsoft::Quantum::MemoryBudget::instance().peak();
+    }
+
     MICROSOFT_QUANTUM_DECL unsigned num_qubits(_In_ unsigned id)
     {
         return Microsoft::Quantum::Simulator::get(id)->num_qubits();
@@ -161,6 +301,56 @@ extern "C"
         Microsoft::Quantum::Simulator::get(id)->CExp(bv, phi, cv, qv);
     }
 
+    MICROSOFT_QUANTUM_DECL void ApplyMatrix(
+        _In_ unsigned id,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_reads_(1 << (2 * n)) double* re,
+        _In_reads_(1 << (2 * n)) double* im,
+        _In_ unsigned nc,
+        _In_reads_(nc) unsigned* c)
+    {
+        const size_t N = (static_cast<size_t>(1) << (2 * n));
+        std::vector<ComplexType> matrix;
+        matrix.reserve(N);
+        for (size_t i = 0; i < N; i++)
+            matrix.push_back({re[i], im[i]});
+        std::vector<unsigned> qv(q, q + n);
+        std::vector<unsigned> cv(c, c + nc);
+        Microsoft::Quantum::Simulator::get(id)->ApplyControlledMatrix(cv, qv, matrix);
+    }
+
+    MICROSOFT_QUANTUM_DECL void ApplyDiagonal(
+        _In_ unsigned id,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_reads_(1 << n) double* re,
+        _In_reads_(1 << n) double* im,
+        _In_ unsigned nc,
+        _In_reads_(nc) unsigned* c)
+    {
+        const size_t N = (static_cast<size_t>(1) << n);
+        std::vector<ComplexType> diagonal;
+        diagonal.reserve(N);
+        for (size_t i = 0; i < N; i++)
+            diagonal.push_back({re[i], im[i]});
+        std::vector<unsigned> qv(q, q + n);
+        std::vector<unsigned> cv(c, c + nc);
+        Microsoft::Quantum::Simulator::get(id)->ApplyControlledDiagonal(cv, qv, diagonal);
+    }
+
+    MICROSOFT_QUANTUM_DECL void QFT(_In_ unsigned id, _In_ unsigned n, _In_reads_(n) unsigned* q)
+    {
+        std::vector<unsigned> qv(q, q + n);
+        Microsoft::Quantum::Simulator::get(id)->QFT(qv, false);
+    }
+
+    MICROSOFT_QUANTUM_DECL void AdjQFT(_In_ unsigned id, _In_ unsigned n, _In_reads_(n) unsigned* q)
+    {
+        std::vector<unsigned> qv(q, q + n);
+        Microsoft::Quantum::Simulator::get(id)->QFT(qv, true);
+    }
+
     // measurements
     MICROSOFT_QUANTUM_DECL unsigned M(_In_ unsigned id, _In_ unsigned q)
     {
@@ -201,6 +391,27 @@ extern "C"
         Microsoft::Quantum::Simulator::get(id)->permuteBasis(qs, table_size, permutation_table, true);
     }
 
+    MICROSOFT_QUANTUM_DECL void PermuteBasisByFunction(
+        _In_ unsigned id,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_ TPermutationFunction permutation,
+        _In_ void* context)
+    {
+        const std::vector<unsigned> qs(q, q + n);
+        Microsoft::Quantum::Simulator::get(id)->permuteBasis(qs, permutation, context, false);
+    }
+    MICROSOFT_QUANTUM_DECL void AdjPermuteBasisByFunction(
+        _In_ unsigned id,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_ TPermutationFunction permutation,
+        _In_ void* context)
+    {
+        const std::vector<unsigned> qs(q, q + n);
+        Microsoft::Quantum::Simulator::get(id)->permuteBasis(qs, permutation, context, true);
+    }
+
     // dump wavefunction to given callback until callback returns false
     MICROSOFT_QUANTUM_DECL void Dump(_In_ unsigned id, _In_ bool (*callback)(const char*, double, double))
     {
@@ -240,4 +451,27 @@ extern "C"
     {
         Microsoft::Quantum::Simulator::get(id)->dumpIds(callback);
     }
+
+    MICROSOFT_QUANTUM_DECL const double* StateData(_In_ unsigned id, _Out_ std::size_t* length)
+    {
+        auto const& psi = Microsoft::Quantum::Simulator::get(id);
+        Microsoft::Quantum::recursive_lock_type l(psi->getmutex());
+        *length = static_cast<std::size_t>(1) << psi->num_qubits();
+#ifndef USE_SINGLE_PRECISION
+        return reinterpret_cast<const double*>(psi->data());
+#else
+        return nullptr;
+#endif
+    }
+
+    MICROSOFT_QUANTUM_DECL std::size_t DumpToBuffer(
+        _In_ unsigned id,
+        _In_ std::size_t n,
+        _Out_writes_(n) double* re,
+        _Out_writes_(n) double* im,
+        _Out_writes_opt_(n) std::size_t* indices,
+        _In_ double threshold)
+    {
+        return Microsoft::Quantum::Simulator::get(id)->dump(n, re, im, indices, threshold);
+    }
 }
@@ -5,6 +5,7 @@
 
 #include "config.hpp"
 #include <complex>
+#include <cstddef>
 
 // SAL only defined in windows.
 #ifndef _In_
@@ -12,6 +13,12 @@
 #define _In_
 // NOLINTNEXTLINE
 #define _In_reads_(n)
+// NOLINTNEXTLINE
+#define _Out_
+// NOLINTNEXTLINE
+#define _Out_writes_(n)
+// NOLINTNEXTLINE
+#define _Out_writes_opt_(n)
 #endif
 
 extern "C"
@@ -21,6 +28,77 @@ extern "C"
     MICROSOFT_QUANTUM_DECL unsigned init(); // NOLINT
     MICROSOFT_QUANTUM_DECL void destroy(_In_ unsigned sid); // NOLINT
     MICROSOFT_QUANTUM_DECL void seed(_In_ unsigned sid, _In_ unsigned s); // NOLINT
+
+    // Sharded state vector: one of `processes` (a power of two) processes on this node that hold one state together,
+    // each with up to `maxlocal` qubits of it, and exchange amplitudes through POSIX shared memory named after
+    // `session`. All processes call InitSharded with their `rank` and then make the same calls in the same order, which
+    // give the same results on all of them. DumpToBuffer gathers the state; StateData, the state files and the dumps
+    // to callbacks are not supported. Only supported on POSIX systems.
+    MICROSOFT_QUANTUM_DECL unsigned InitSharded(
+        _In_ const char* session,
+        _In_ unsigned rank,
+        _In_ unsigned processes,
+        _In_ unsigned maxlocal);
+
+    // Out-of-core storage (process-wide): state vectors of at least `min_bytes` are placed into memory-mapped files,
+    // created and immediately unlinked in `directory`, instead of DRAM. Passing an empty directory turns it off for
+    // new allocations. Only supported on POSIX systems.
+    MICROSOFT_QUANTUM_DECL void SetStateStorage(_In_ const char* directory, _In_ std::size_t min_bytes);
+
+    // Timeline tracing (process-wide): StartTrace records flushes, clusters, fused kernels, measurements, allocations and
+    // releases of all simulators, keeping the last 65536 events of every thread. StopTrace writes them to `path` as a
+    // Chrome trace-event JSON file (for chrome://tracing or Perfetto) and returns false if that failed or no trace was
+    // being recorded. Both should be called while no simulator is running.
+    MICROSOFT_QUANTUM_DECL void StartTrace(_In_ const char* path);
+    MICROSOFT_QUANTUM_DECL bool StopTrace();
+
+    // Asynchronous gate application: when enabled, a full gate cache of simulator `sid` is handed to a background
+    // thread and the call that filled it returns right away. Measurements, probabilities, dumps and all other calls
+    // that depend on the state wait for it. Disabling it applies all pending gates.
+    MICROSOFT_QUANTUM_DECL void SetAsyncFlush(_In_ unsigned sid, _In_ bool enable);
+
+    // Stabilizer mode (off by default): Clifford gates and measurements run on a stabilizer tableau, which simulates far
+    // more qubits, until the first other operation builds the state vector. That state vector, and so dumps and
+    // overlaps, are only defined up to a global phase. Turning the mode on takes effect while simulator `sid` holds no
+    // qubits (right away if it holds none, else at the next reset). The environment variable QDK_SIM_STABILIZER=1 turns
+    // it on for all new simulators.
+    MICROSOFT_QUANTUM_DECL void SetStabilizerMode(_In_ unsigned sid, _In_ bool enable);
+
+    // Performance counters of simulator `sid` since its creation or the last ResetPerfCounters. The callback receives
+    // every counter by name: gates_queued, clusters, fused_span_1 ... fused_span_7 (number of fused matrices by the
+    // number of qubits they act on), flushes_state_access and flushes_gate_cache_full (flushes of the gate cache by
+    // trigger), and <family>_calls, <family>_seconds (wall time) and <family>_bytes (bytes of the state swept) for the
+    // kernel families fused, measurement, reduction, dump and other. Operations done in stabilizer mode aren't counted.
+    MICROSOFT_QUANTUM_DECL void GetPerfCounters(_In_ unsigned sid, _In_ void (*callback)(const char*, double));
+    MICROSOFT_QUANTUM_DECL void ResetPerfCounters(_In_ unsigned sid);
+
+    // state snapshots
+    // Snapshot returns the id of a new, independent simulator with a copy of the state (including qubit ids and the
+    // state of the random number generator) of simulator `sid`; it can be used as a fork of `sid` or passed to Restore
+    // to roll `sid` back to this point. Snapshots must be released with destroy.
+    MICROSOFT_QUANTUM_DECL unsigned Snapshot(_In_ unsigned sid);
+    MICROSOFT_QUANTUM_DECL void Restore(_In_ unsigned sid, _In_ unsigned snapshot);
+
+    // state comparisons
+    // Overlap computes <psi|phi> of the states of simulators `sid1` and `sid2`, which must have the same qubit ids; the
+    // amplitudes are matched by qubit id. A state that was kept in stabilizer mode is only defined up to a global phase,
+    // which makes only the magnitude of the overlap meaningful then. TraceDistance is the trace distance of the reduced
+    // states of the n listed qubits (at most 8) of the two simulators.
+    MICROSOFT_QUANTUM_DECL void Overlap(_In_ unsigned sid1, _In_ unsigned sid2, _Out_ double* re, _Out_ double* im);
+    // ReducedDensityMatrix writes the reduced density matrix of the n listed qubits (at most 12) of simulator `sid`, with
+    // the qubits entangled with the rest traced out. It is a 2^n x 2^n matrix in row-major order, whose row and column
+    // indices have q[i] as bit i.
+    MICROSOFT_QUANTUM_DECL void ReducedDensityMatrix(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _Out_writes_(1 << (2 * n)) double* re,
+        _Out_writes_(1 << (2 * n)) double* im);
+    MICROSOFT_QUANTUM_DECL double TraceDistance(
+        _In_ unsigned sid1,
+        _In_ unsigned sid2,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q);
     MICROSOFT_QUANTUM_DECL void Dump(_In_ unsigned sid, _In_ bool (*callback)(const char*, double, double));
     MICROSOFT_QUANTUM_DECL bool DumpQubits(
         _In_ unsigned sid,
@@ -52,6 +130,22 @@ extern "C"
 
     MICROSOFT_QUANTUM_DECL void DumpIds(_In_ unsigned sid, _In_ void (*callback)(unsigned));
 
+    // Bulk access to the state, indexed the same way as for DumpToLocation.
+    // StateData flushes the pending gates and returns a read-only pointer to the 2^num_qubits amplitudes as interleaved
+    // (re, im) pairs and their number in `length`. The pointer is valid until the next call on the simulator. Returns
+    // null in single precision builds.
+    MICROSOFT_QUANTUM_DECL const double* StateData(_In_ unsigned sid, _Out_ std::size_t* length);
+    // DumpToBuffer copies, in parallel, the amplitudes with a squared magnitude above `threshold` (use a negative
+    // threshold to copy all of them) into `re` and `im` of capacity `n` and, if `indices` isn't null, their basis state
+    // indices. Returns the number of selected amplitudes, which is larger than `n` if the buffers were too small.
+    MICROSOFT_QUANTUM_DECL std::size_t DumpToBuffer(
+        _In_ unsigned sid,
+        _In_ std::size_t n,
+        _Out_writes_(n) double* re,
+        _Out_writes_(n) double* im,
+        _Out_writes_opt_(n) std::size_t* indices,
+        _In_ double threshold);
+
     MICROSOFT_QUANTUM_DECL std::size_t random_choice(_In_ unsigned sid, _In_ std::size_t n, _In_reads_(n) double* p); // NOLINT
 
     MICROSOFT_QUANTUM_DECL double JointEnsembleProbability(
@@ -68,9 +162,34 @@ extern "C"
         _In_ double* im  // 2^n imaginary parts of the amplitudes
     );
 
+    // Binary state files (see statefile.hpp for the format). SaveState writes the state of all qubits; the file records
+    // the qubit ids in the order of their positions. InjectStateFromFile is InjectState with the 2^n amplitudes read from
+    // such a file, which must hold a state of exactly n qubits, taken in the order listed in `q`.
+    MICROSOFT_QUANTUM_DECL bool SaveState(_In_ unsigned sid, _In_ const char* path);
+    MICROSOFT_QUANTUM_DECL bool InjectStateFromFile(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q, // The listed qubits must be unentangled and in state |0>
+        _In_ const char* path);
+
     // allocate and release
     MICROSOFT_QUANTUM_DECL void allocateQubit(_In_ unsigned sid, _In_ unsigned qid); // NOLINT
     MICROSOFT_QUANTUM_DECL bool release(_In_ unsigned sid, _In_ unsigned q); // NOLINT
+    // Releases n qubits, removing them from the state in a single pass. Returns true if all of them were in |0>.
+    MICROSOFT_QUANTUM_DECL bool ReleaseQubits(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n) unsigned* q);
+    // Memory of the state is given back to the system once the buffer could hold `slack` more qubits than are left
+    // after releasing qubits; 0 never gives it back. The default is 2.
+    MICROSOFT_QUANTUM_DECL void SetShrinkThreshold(_In_ unsigned sid, _In_ unsigned slack);
+
+    // Memory budgets in bytes (0: no limit), for the state vector of simulator `sid` (with its fused gate matrices and
+    // gate cache) and for all simulators of the process. An allocation of qubits, or another operation, that would need
+    // more fails with an exception derived from std::bad_alloc before anything is allocated or copied, leaving the state
+    // as it was. The footprints include the alignment slack of the allocations; the peaks include the transient copies
+    // when a state buffer is reallocated.
+    MICROSOFT_QUANTUM_DECL void SetMemoryBudget(_In_ unsigned sid, _In_ std::size_t bytes);
+    MICROSOFT_QUANTUM_DECL void SetProcessMemoryBudget(_In_ std::size_t bytes);
+    MICROSOFT_QUANTUM_DECL void MemoryFootprint(_In_ unsigned sid, _Out_ std::size_t* current, _Out_ std::size_t* peak);
+    MICROSOFT_QUANTUM_DECL void ProcessMemoryFootprint(_Out_ std::size_t* current, _Out_ std::size_t* peak);
     MICROSOFT_QUANTUM_DECL unsigned num_qubits(_In_ unsigned sid); // NOLINT
 
     // single-qubit gates
@@ -122,6 +241,32 @@ extern "C"
         _In_reads_(nc) unsigned* cs,
         _In_reads_(n) unsigned* q);
 
+    // Arbitrary unitaries on n qubits, controlled on nc qubits (nc may be 0). Bit i of the matrix indices refers to q[i].
+    // ApplyMatrix takes a dense 2^n x 2^n matrix in row-major order, for n <= 7; a single-qubit matrix is fused with
+    // the surrounding gates, a larger one is applied by a single sweep of the fused gate kernels. ApplyDiagonal takes
+    // the 2^n entries of a diagonal matrix.
+    MICROSOFT_QUANTUM_DECL void ApplyMatrix(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_reads_(1 << (2 * n)) double* re, // real parts of the 4^n matrix entries
+        _In_reads_(1 << (2 * n)) double* im, // imaginary parts of the 4^n matrix entries
+        _In_ unsigned nc,
+        _In_reads_(nc) unsigned* c);
+    MICROSOFT_QUANTUM_DECL void ApplyDiagonal(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_reads_(1 << n) double* re, // real parts of the 2^n diagonal entries
+        _In_reads_(1 << n) double* im, // imaginary parts of the 2^n diagonal entries
+        _In_ unsigned nc,
+        _In_reads_(nc) unsigned* c);
+
+    // Quantum Fourier transform |x> -> 2^(-n/2) sum_y e^(2 pi i x y / 2^n) |y> on the little-endian register q (q[0] is
+    // the least significant qubit), including the reversal of the qubit order. AdjQFT applies the inverse transform.
+    MICROSOFT_QUANTUM_DECL void QFT(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n) unsigned* q);
+    MICROSOFT_QUANTUM_DECL void AdjQFT(_In_ unsigned sid, _In_ unsigned n, _In_reads_(n) unsigned* q);
+
     // measurements
     MICROSOFT_QUANTUM_DECL unsigned M(_In_ unsigned sid, _In_ unsigned q);
     MICROSOFT_QUANTUM_DECL unsigned Measure(
@@ -144,4 +289,22 @@ extern "C"
         _In_ std::size_t table_size, // NOLINT
         _In_reads_(table_size) std::size_t* permutation_table); // NOLINT
 
+    // Same as PermuteBasis, but the permutation is computed on the fly instead of being read from a table, which needs
+    // O(2^n) bits of extra memory rather than a table of 2^n entries. The function maps a basis state of the listed
+    // qubits to its image, gets `context` passed through, and is called concurrently from several threads. Throws if
+    // the function isn't a bijection on {0, ..., 2^n - 1}, in which case the state is left unchanged.
+    typedef std::size_t (*TPermutationFunction)(std::size_t basis_state, void* context); // NOLINT
+    MICROSOFT_QUANTUM_DECL void PermuteBasisByFunction(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_ TPermutationFunction permutation,
+        _In_ void* context);
+    MICROSOFT_QUANTUM_DECL void AdjPermuteBasisByFunction(
+        _In_ unsigned sid,
+        _In_ unsigned n,
+        _In_reads_(n) unsigned* q,
+        _In_ TPermutationFunction permutation,
+        _In_ void* context);
+
 }
@@ -6,7 +6,15 @@
 #include <cassert>
 #include <cmath>
 #include <complex>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
 // some convenience functions
@@ -410,6 +418,1051 @@ void test_permute_basis_adjoint()
     destroy(sim_id);
 }
 
+void test_snapshot()
+{
+    auto sim_id = init();
+    seed(sim_id, 42);
+
+    unsigned qs[] = {0, 1};
+    int zz[] = {2};
+    allocateQubit(sim_id, 0);
+    allocateQubit(sim_id, 1);
+
+    // create a Bell pair and fork it
+    H(sim_id, 0);
+    CX(sim_id, 0, 1);
+    auto snap_id = Snapshot(sim_id);
+    assert(num_qubits(snap_id) == 2);
+
+    // collapsing the original state doesn't affect the snapshot
+    M(sim_id, 0);
+    assert(std::abs(JointEnsembleProbability(sim_id, 1, zz, &qs[0]) - 0.5) > 0.4);
+    assert(std::abs(JointEnsembleProbability(snap_id, 1, zz, &qs[0]) - 0.5) < 1e-10);
+
+    // after restoring both simulators have the same state and random number sequence
+    Restore(sim_id, snap_id);
+    assert(std::abs(JointEnsembleProbability(sim_id, 1, zz, &qs[0]) - 0.5) < 1e-10);
+    for (int i = 0; i < 10; ++i)
+    {
+        H(sim_id, 0);
+        H(snap_id, 0);
+        assert(M(sim_id, 0) == M(snap_id, 0));
+    }
+    assert(M(sim_id, 1) == M(snap_id, 1));
+
+    // restoring a pair of simulators from either side at the same time doesn't deadlock
+    std::thread forward([=]() {
+        for (int i = 0; i < 200; ++i)
+            Restore(sim_id, snap_id);
+    });
+    for (int i = 0; i < 200; ++i)
+        Restore(snap_id, sim_id);
+    forward.join();
+
+    destroy(snap_id);
+    destroy(sim_id);
+}
+
+// |x> -> |(a * x + b) mod m> for odd a and a power of two m, which has cycles of several lengths
+std::size_t affine_permutation(std::size_t x, void* context)
+{
+    auto abm = static_cast<std::size_t*>(context);
+    return (abm[0] * x + abm[1]) % abm[2];
+}
+
+void test_permute_basis_by_function()
+{
+    auto sim_id = init();
+    std::size_t ab[] = {5, 3, 16};
+    constexpr auto nqubits = 4u;
+    constexpr auto nstates = 1ul << nqubits;
+    std::size_t table[nstates];
+    for (std::size_t i = 0; i < nstates; ++i)
+        table[i] = affine_permutation(i, ab);
+
+    unsigned qbit_ids[] = {1, 3, 4, 0};
+    for (unsigned i = 0; i < nqubits + 1; ++i)
+        allocateQubit(sim_id, i);
+
+    // create some quantum state
+    H(sim_id, 1);
+    CX(sim_id, 1, 2);
+    Ry(sim_id, 1.1, 3);
+    Ry(sim_id, 2.2, 4);
+    Ry(sim_id, 0.4, 0);
+
+    // the permutation computed on the fly must agree with the table, also for the adjoint
+    for (bool adjoint : {false, true})
+    {
+        auto expected = Snapshot(sim_id);
+        if (adjoint)
+        {
+            AdjPermuteBasis(expected, nqubits, qbit_ids, nstates, table);
+            AdjPermuteBasisByFunction(sim_id, nqubits, qbit_ids, affine_permutation, ab);
+        }
+        else
+        {
+            PermuteBasis(expected, nqubits, qbit_ids, nstates, table);
+            PermuteBasisByFunction(sim_id, nqubits, qbit_ids, affine_permutation, ab);
+        }
+
+        double re1[32], im1[32], re2[32], im2[32];
+        assert(DumpToBuffer(sim_id, 32, re1, im1, nullptr, -1.) == 32);
+        assert(DumpToBuffer(expected, 32, re2, im2, nullptr, -1.) == 32);
+        for (unsigned i = 0; i < 32; ++i)
+            assert(std::abs(re1[i] - re2[i]) < 1e-10 && std::abs(im1[i] - im2[i]) < 1e-10);
+        destroy(expected);
+    }
+
+    // not a bijection
+    std::size_t not_a_permutation[] = {2, 3, 16};
+    bool thrown = false;
+    try
+    {
+        PermuteBasisByFunction(sim_id, nqubits, qbit_ids, affine_permutation, not_a_permutation);
+    }
+    catch (std::runtime_error const&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    Ry(sim_id, -0.4, 0);
+    Ry(sim_id, -2.2, 4);
+    Ry(sim_id, -1.1, 3);
+    CX(sim_id, 1, 2);
+    H(sim_id, 1);
+    for (unsigned i = 0; i < nqubits + 1; ++i)
+        assert(M(sim_id, i) == false);
+
+    for (unsigned i = 0; i < nqubits + 1; ++i)
+        release(sim_id, i);
+    destroy(sim_id);
+
+    // a register large enough for the cycles to be found by several threads, with a single cycle (x + 1) that all of
+    // them share, and mappings that aren't bijections: duplicates, and images out of range
+    constexpr auto nlarge = 14u;
+    constexpr std::size_t nlarge_states = 1ul << nlarge;
+    auto large = init();
+    std::vector<unsigned> large_ids(nlarge);
+    for (unsigned i = 0; i < nlarge; ++i)
+    {
+        large_ids[i] = i;
+        allocateQubit(large, i);
+        Ry(large, 0.1 * (i + 1), i);
+    }
+    auto same_state = [](unsigned sid, unsigned other) {
+        std::vector<double> re1(nlarge_states), im1(nlarge_states), re2(nlarge_states), im2(nlarge_states);
+        assert(DumpToBuffer(sid, nlarge_states, re1.data(), im1.data(), nullptr, -1.) == nlarge_states);
+        assert(DumpToBuffer(other, nlarge_states, re2.data(), im2.data(), nullptr, -1.) == nlarge_states);
+        for (std::size_t i = 0; i < nlarge_states; ++i)
+            if (std::abs(re1[i] - re2[i]) > 1e-10 || std::abs(im1[i] - im2[i]) > 1e-10) return false;
+        return true;
+    };
+    std::vector<std::size_t> large_table(nlarge_states);
+    std::vector<std::array<std::size_t, 3>> bijections = {
+        {1, 1, nlarge_states}, {5, 3, nlarge_states}, {1, 0, nlarge_states}};
+    for (auto& abm : bijections)
+    {
+        for (std::size_t i = 0; i < nlarge_states; ++i)
+            large_table[i] = affine_permutation(i, abm.data());
+        auto expected = Snapshot(large);
+        PermuteBasis(expected, nlarge, large_ids.data(), nlarge_states, large_table.data());
+        PermuteBasisByFunction(large, nlarge, large_ids.data(), affine_permutation, abm.data());
+        assert(same_state(large, expected));
+        destroy(expected);
+    }
+    std::vector<std::array<std::size_t, 3>> not_bijections = {{2, 3, nlarge_states}, {1, 1, nlarge_states + 1}};
+    for (auto& abm : not_bijections)
+    {
+        auto unchanged = Snapshot(large);
+        thrown = false;
+        try
+        {
+            PermuteBasisByFunction(large, nlarge, large_ids.data(), affine_permutation, abm.data());
+        }
+        catch (std::runtime_error const&)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(same_state(large, unchanged));
+        destroy(unchanged);
+    }
+    destroy(large);
+}
+
+void test_apply_matrix()
+{
+    auto sim_id = init();
+    for (unsigned i = 0; i < 4; ++i)
+        allocateQubit(sim_id, i);
+    H(sim_id, 0);
+    H(sim_id, 3);
+
+    // CNOT with control q[1] = 3 and target q[0] = 2 (bit i of the indices refers to q[i]), controlled on qubit 0
+    unsigned qs[] = {2, 3};
+    unsigned cs[] = {0};
+    double re[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0};
+    double im[16] = {};
+    ApplyMatrix(sim_id, 2, qs, re, im, 1, cs);
+
+    // a single-qubit matrix, which is queued with the gates: Y on qubit 1 controlled on qubit 3
+    unsigned yq[] = {1};
+    unsigned yc[] = {3};
+    double yre[4] = {0, 0, 0, 0};
+    double yim[4] = {0, -1, 1, 0};
+    ApplyMatrix(sim_id, 1, yq, yre, yim, 1, yc);
+
+    // diagonals: CZ on qubits 3 and 0, and S on qubit 3 controlled on qubit 0
+    unsigned dqs[] = {3, 0};
+    double dre[4] = {1, 1, 1, -1};
+    double dim[4] = {0, 0, 0, 0};
+    ApplyDiagonal(sim_id, 2, dqs, dre, dim, 0, nullptr);
+    double sre[2] = {1, 0};
+    double sim[2] = {0, 1};
+    ApplyDiagonal(sim_id, 1, &dqs[0], sre, sim, 1, &dqs[1]);
+
+    // uncompute with named gates
+    MCAdjS(sim_id, 1, &dqs[1], 3);
+    MCZ(sim_id, 1, &dqs[1], 3);
+    unsigned ccs[] = {0, 3};
+    MCX(sim_id, 2, ccs, 2);
+    MCY(sim_id, 1, yc, 1);
+    H(sim_id, 3);
+    H(sim_id, 0);
+    for (unsigned i = 0; i < 4; ++i)
+        assert(M(sim_id, i) == false);
+
+    for (unsigned i = 0; i < 4; ++i)
+        release(sim_id, i);
+    destroy(sim_id);
+}
+
+void test_qft()
+{
+    auto sim_id = init();
+    for (unsigned i = 0; i < 4; ++i)
+        allocateQubit(sim_id, i);
+    const double pi = std::acos(-1.);
+
+    // |x = 5> on the register {2, 0, 3}, qubit 1 in |1>
+    unsigned qs[] = {2, 0, 3};
+    X(sim_id, 2);
+    X(sim_id, 3);
+    X(sim_id, 1);
+
+    // on 3 out of 4 qubits (transforms the columns separately) and on all 4 qubits (transforms the whole state)
+    for (unsigned n : {3u, 4u})
+    {
+        unsigned reg[] = {2, 0, 3, 1};
+        unsigned x = (n == 3) ? 5 : 13;
+        if (n == 3)
+            QFT(sim_id, 3, qs);
+        else
+            QFT(sim_id, 4, reg);
+
+        double re[16], im[16];
+        assert(DumpToBuffer(sim_id, 16, re, im, nullptr, -1.) == 16);
+        for (std::size_t i = 0; i < 16; ++i)
+        {
+            // the value of the register in basis state i
+            unsigned y = 0;
+            for (unsigned l = 0; l < n; ++l)
+                y |= ((i >> reg[l]) & 1) << l;
+            std::complex<double> expected = 0.;
+            if (n == 4 || (i & 2))
+                expected = std::polar(1. / std::sqrt(double(1u << n)), 2. * pi * x * y / double(1u << n));
+            assert(std::abs(std::complex<double>(re[i], im[i]) - expected) < 1e-10);
+        }
+
+        if (n == 3)
+            AdjQFT(sim_id, 3, qs);
+        else
+            AdjQFT(sim_id, 4, reg);
+    }
+
+    X(sim_id, 1);
+    X(sim_id, 3);
+    X(sim_id, 2);
+    for (unsigned i = 0; i < 4; ++i)
+        assert(M(sim_id, i) == false);
+
+    for (unsigned i = 0; i < 4; ++i)
+        release(sim_id, i);
+    destroy(sim_id);
+
+    // a register too large for a column at a time, transformed in blocks of qubits
+    sim_id = init();
+    const unsigned n = 18, k = 17;
+    std::vector<unsigned> reg(k);
+    for (unsigned l = 0; l < k; ++l)
+        reg[l] = (5 * l + 3) % n;
+    const unsigned x = 0x1b2e5;
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(sim_id, i);
+    for (unsigned l = 0; l < k; ++l)
+        if ((x >> l) & 1) X(sim_id, reg[l]);
+    QFT(sim_id, k, reg.data());
+
+    const std::size_t size = std::size_t(1) << n;
+    std::vector<double> re(size), im(size);
+    assert(DumpToBuffer(sim_id, size, re.data(), im.data(), nullptr, -1.) == size);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        std::size_t y = 0;
+        for (unsigned l = 0; l < k; ++l)
+            y |= ((i >> reg[l]) & 1) << l;
+        std::complex<double> expected = 0.;
+        const double phase = 2. * pi * double((x * y) % (1u << k)) / double(1u << k);
+        if (((i >> 16) & 1) == 0) // the qubit outside of the register stays |0>
+            expected = std::polar(1. / std::sqrt(double(1u << k)), phase);
+        assert(std::abs(std::complex<double>(re[i], im[i]) - expected) < 1e-10);
+    }
+
+    AdjQFT(sim_id, k, reg.data());
+    for (unsigned l = 0; l < k; ++l)
+        assert(M(sim_id, reg[l]) == (((x >> l) & 1) != 0));
+    destroy(sim_id);
+}
+
+void test_dump_to_buffer()
+{
+    auto sim_id = init();
+    for (unsigned i = 0; i < 3; ++i)
+        allocateQubit(sim_id, i);
+
+    X(sim_id, 0);
+    H(sim_id, 1);
+    const double amp = 1. / std::sqrt(2.);
+
+    // direct access to all amplitudes
+    std::size_t length = 0;
+    const double* data = StateData(sim_id, &length);
+    assert(length == 8);
+    assert(std::abs(data[2 * 1] - amp) < 1e-10 && std::abs(data[2 * 3] - amp) < 1e-10);
+
+    // copy of all amplitudes
+    double re[8], im[8];
+    std::size_t indices[8];
+    assert(DumpToBuffer(sim_id, 8, re, im, nullptr, -1.) == 8);
+    assert(std::abs(re[1] - amp) < 1e-10 && std::abs(re[2]) < 1e-10 && std::abs(im[3]) < 1e-10);
+
+    // filtered copy of the nonzero amplitudes
+    assert(DumpToBuffer(sim_id, 8, re, im, indices, 1e-10) == 2);
+    assert(indices[0] == 1 && indices[1] == 3);
+    assert(std::abs(re[0] - amp) < 1e-10 && std::abs(re[1] - amp) < 1e-10);
+
+    // the count is reported even if the buffers are too small
+    assert(DumpToBuffer(sim_id, 1, re, im, indices, 1e-10) == 2);
+    assert(indices[0] == 1);
+
+    H(sim_id, 1);
+    X(sim_id, 0);
+    for (unsigned i = 0; i < 3; ++i)
+        release(sim_id, i);
+    destroy(sim_id);
+}
+
+void test_state_file()
+{
+    auto sim_id = init();
+    for (unsigned i = 0; i < 3; ++i)
+        allocateQubit(sim_id, i);
+    X(sim_id, 0);
+    H(sim_id, 2);
+    CX(sim_id, 2, 1);
+
+    const std::string path = "capi_test_state.bin";
+    assert(SaveState(sim_id, path.c_str()));
+
+    // inject the file into the qubits of another simulator
+    auto sim2 = init();
+    unsigned qs[] = {0, 1, 2};
+    for (unsigned q : qs)
+        allocateQubit(sim2, q);
+    assert(InjectStateFromFile(sim2, 3, qs, path.c_str()));
+
+    double re1[8], im1[8], re2[8], im2[8];
+    assert(DumpToBuffer(sim_id, 8, re1, im1, nullptr, -1.) == 8);
+    assert(DumpToBuffer(sim2, 8, re2, im2, nullptr, -1.) == 8);
+    for (unsigned i = 0; i < 8; ++i)
+        assert(std::abs(re1[i] - re2[i]) < 1e-10 && std::abs(im1[i] - im2[i]) < 1e-10);
+
+    // the file doesn't match the number of qubits, or doesn't exist
+    assert(!InjectStateFromFile(sim2, 2, qs, path.c_str()));
+    std::remove(path.c_str());
+    assert(!InjectStateFromFile(sim2, 3, qs, path.c_str()));
+
+    CX(sim2, 2, 1);
+    H(sim2, 2);
+    X(sim2, 0);
+    for (unsigned q : qs)
+        release(sim2, q);
+    destroy(sim2);
+
+    CX(sim_id, 2, 1);
+    H(sim_id, 2);
+    X(sim_id, 0);
+    for (unsigned i = 0; i < 3; ++i)
+        release(sim_id, i);
+    destroy(sim_id);
+}
+
+void test_async_flush()
+{
+    auto sync_id = init();
+    auto async_id = init();
+    seed(sync_id, 7);
+    seed(async_id, 7);
+    SetAsyncFlush(async_id, true);
+
+    const unsigned n = 10;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        allocateQubit(sync_id, i);
+        allocateQubit(async_id, i);
+    }
+
+    // enough gates to fill the gate cache a few times
+    for (unsigned layer = 0; layer < 400; ++layer)
+    {
+        for (unsigned sim_id : {sync_id, async_id})
+        {
+            for (unsigned i = 0; i < n; ++i)
+                Ry(sim_id, 0.1 * (layer + i), i);
+            for (unsigned i = 0; i + 1 < n; ++i)
+                CX(sim_id, i, i + 1);
+        }
+    }
+
+    double re1[1 << n], im1[1 << n], re2[1 << n], im2[1 << n];
+    assert(DumpToBuffer(sync_id, 1 << n, re1, im1, nullptr, -1.) == 1 << n);
+    assert(DumpToBuffer(async_id, 1 << n, re2, im2, nullptr, -1.) == 1 << n);
+    for (unsigned i = 0; i < (1u << n); ++i)
+        assert(std::abs(re1[i] - re2[i]) < 1e-10 && std::abs(im1[i] - im2[i]) < 1e-10);
+
+    for (unsigned i = 0; i < n; ++i)
+    {
+        H(sync_id, i);
+        H(async_id, i);
+        assert(M(sync_id, i) == M(async_id, i));
+    }
+
+    SetAsyncFlush(async_id, false);
+    destroy(async_id);
+    destroy(sync_id);
+}
+
+// releasing several qubits at once removes them from the state in one pass
+void test_release_qubits()
+{
+    auto sim_id = init();
+    auto ref_id = init();
+    SetShrinkThreshold(sim_id, 1);
+
+    const unsigned n = 8;
+    const std::vector<unsigned> kept = {0, 2, 5, 7};
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(sim_id, i);
+    for (unsigned i = 0; i < kept.size(); ++i)
+        allocateQubit(ref_id, i);
+
+    // T makes sure the state is a state vector
+    for (unsigned i = 0; i < kept.size(); ++i)
+    {
+        Ry(sim_id, 0.3 + i, kept[i]);
+        Ry(ref_id, 0.3 + i, i);
+        T(sim_id, kept[i]);
+        T(ref_id, i);
+    }
+    CX(sim_id, kept[0], kept[3]);
+    CX(ref_id, 0, 3);
+    X(sim_id, 3);
+    X(sim_id, 6);
+
+    unsigned released[] = {6, 1, 4, 3};
+    assert(!ReleaseQubits(sim_id, 4, released));
+    assert(num_qubits(sim_id) == kept.size());
+
+    const unsigned m = 1u << kept.size();
+    double re1[m], im1[m], re2[m], im2[m];
+    assert(DumpToBuffer(sim_id, m, re1, im1, nullptr, -1.) == m);
+    assert(DumpToBuffer(ref_id, m, re2, im2, nullptr, -1.) == m);
+    for (unsigned i = 0; i < m; ++i)
+        assert(std::abs(re1[i] - re2[i]) < 1e-10 && std::abs(im1[i] - im2[i]) < 1e-10);
+
+    // qubits in |0> are released cleanly, the released ids can be used again
+    unsigned zeros[] = {4, 1};
+    allocateQubit(sim_id, 1);
+    allocateQubit(sim_id, 4);
+    assert(ReleaseQubits(sim_id, 2, zeros));
+    H(sim_id, 5);
+    unsigned superposed[] = {5};
+    assert(!ReleaseQubits(sim_id, 1, superposed));
+    assert(num_qubits(sim_id) == kept.size() - 1);
+
+    // the default threshold keeps one qubit of headroom: a qubit allocated after the shrink doesn't reallocate
+    SetStabilizerMode(ref_id, false);
+    for (unsigned i = kept.size(); i < n; ++i)
+        allocateQubit(ref_id, i);
+    T(ref_id, 0);
+    M(ref_id, 0);
+    std::size_t full = 0, shrunk = 0, grown = 0, peak = 0;
+    MemoryFootprint(ref_id, &full, &peak);
+    unsigned upper[] = {4, 5, 6, 7};
+    assert(ReleaseQubits(ref_id, 4, upper));
+    MemoryFootprint(ref_id, &shrunk, &peak);
+    assert(full - shrunk == (16 - 2) * m * sizeof(std::complex<double>));
+    allocateQubit(ref_id, 4);
+    MemoryFootprint(ref_id, &grown, &peak);
+    assert(grown == shrunk);
+
+    destroy(ref_id);
+    destroy(sim_id);
+}
+
+void test_overlap()
+{
+    auto sim_id = init();
+    auto other_id = init();
+    const unsigned n = 5;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        allocateQubit(sim_id, i);
+        allocateQubit(other_id, i);
+    }
+    // qubit 1 of the other simulator moves to the last position
+    release(other_id, 1);
+    allocateQubit(other_id, 1);
+
+    for (unsigned sim : {sim_id, other_id})
+    {
+        T(sim, 0);
+        Ry(sim, 0.4, 0);
+        Ry(sim, 1.1, 3);
+        H(sim, 4);
+        CX(sim, 0, 1);
+        CX(sim, 3, 4);
+        T(sim, 1);
+    }
+    double re = 0., im = 0.;
+    Overlap(sim_id, other_id, &re, &im);
+    assert(std::abs(re - 1.) < 1e-10 && std::abs(im) < 1e-10);
+
+    // qubit 2 is |0> in both, the rotation changes the overlap to cos(theta / 2)
+    const double theta = 0.8;
+    R(other_id, 1, theta, 2);
+    Overlap(sim_id, other_id, &re, &im);
+    assert(std::abs(re - std::cos(theta / 2)) < 1e-10 && std::abs(im) < 1e-10);
+    Overlap(other_id, sim_id, &re, &im);
+    assert(std::abs(re - std::cos(theta / 2)) < 1e-10 && std::abs(im) < 1e-10);
+
+    unsigned q2[] = {2};
+    unsigned q013[] = {0, 1, 3};
+    assert(std::abs(TraceDistance(sim_id, other_id, 1, q2) - std::sin(theta / 2)) < 1e-10);
+    assert(TraceDistance(sim_id, other_id, 3, q013) < 1e-10);
+
+    // overlaps and trace distances of a pair from either side at the same time don't deadlock
+    std::thread forward([=]() {
+        double r, i;
+        unsigned q[] = {2};
+        for (int k = 0; k < 100; ++k)
+        {
+            Overlap(sim_id, other_id, &r, &i);
+            TraceDistance(sim_id, other_id, 1, q);
+        }
+    });
+    for (int k = 0; k < 100; ++k)
+    {
+        double r, i;
+        Overlap(other_id, sim_id, &r, &i);
+        TraceDistance(other_id, sim_id, 1, q2);
+    }
+    forward.join();
+
+    // the marginal of half a Bell pair is maximally mixed
+    auto bell_id = init();
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(bell_id, i);
+    H(bell_id, 0);
+    CX(bell_id, 0, 2);
+    auto zero_id = init();
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(zero_id, i);
+    assert(std::abs(TraceDistance(bell_id, zero_id, 1, q2) - 0.5) < 1e-10);
+
+    // the states must have the same qubits
+    allocateQubit(zero_id, n);
+    bool thrown = false;
+    try
+    {
+        Overlap(bell_id, zero_id, &re, &im);
+    }
+    catch (std::runtime_error const&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    destroy(zero_id);
+    destroy(bell_id);
+    destroy(other_id);
+    destroy(sim_id);
+}
+
+void test_reduced_density_matrix()
+{
+    auto sim_id = init();
+    for (unsigned i = 0; i < 4; ++i)
+        allocateQubit(sim_id, i);
+    const double theta = 0.7;
+    H(sim_id, 0);
+    CX(sim_id, 0, 3);
+    Ry(sim_id, theta, 1);
+    X(sim_id, 2);
+
+    double re[16], im[16];
+    unsigned q1[] = {1};
+    ReducedDensityMatrix(sim_id, 1, q1, re, im);
+    const double c = std::cos(theta / 2), s = std::sin(theta / 2);
+    assert(std::abs(re[0] - c * c) < 1e-10 && std::abs(re[1] - c * s) < 1e-10);
+    assert(std::abs(re[2] - c * s) < 1e-10 && std::abs(re[3] - s * s) < 1e-10);
+
+    // half a Bell pair is maximally mixed, both halves are the pure Bell state
+    unsigned q0[] = {0};
+    ReducedDensityMatrix(sim_id, 1, q0, re, im);
+    assert(std::abs(re[0] - 0.5) < 1e-10 && std::abs(re[1]) < 1e-10 && std::abs(re[3] - 0.5) < 1e-10);
+    unsigned q30[] = {3, 0};
+    ReducedDensityMatrix(sim_id, 2, q30, re, im);
+    for (unsigned i = 0; i < 16; ++i)
+        assert(std::abs(re[i] - ((i == 0 || i == 3 || i == 12 || i == 15) ? 0.5 : 0.)) < 1e-10 && std::abs(im[i]) < 1e-10);
+    destroy(sim_id);
+
+    // the matrix of 9 qubits (rows of the matrix split among the threads) traced down to 3 qubits agrees with the matrix
+    // of these 3 qubits (partial matrices per thread)
+    sim_id = init();
+    const unsigned n = 11;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        allocateQubit(sim_id, i);
+        Ry(sim_id, 0.3 + 0.2 * i, i);
+        T(sim_id, i);
+    }
+    for (unsigned i = 0; i + 1 < n; ++i)
+        CX(sim_id, i, i + 1);
+    H(sim_id, 4);
+    unsigned q9[] = {7, 2, 9, 0, 1, 3, 5, 6, 10};
+    std::vector<double> re9(1 << 18), im9(1 << 18);
+    ReducedDensityMatrix(sim_id, 9, q9, re9.data(), im9.data());
+    double re3[64], im3[64];
+    ReducedDensityMatrix(sim_id, 3, q9, re3, im3);
+    double trace = 0.;
+    for (unsigned r = 0; r < 512; ++r)
+        trace += re9[r * 512 + r];
+    assert(std::abs(trace - 1.) < 1e-10);
+    for (unsigned a = 0; a < 8; ++a)
+        for (unsigned b = 0; b < 8; ++b)
+        {
+            double sum_re = 0., sum_im = 0.;
+            for (unsigned e = 0; e < 64; ++e)
+            {
+                sum_re += re9[(a + 8 * e) * 512 + b + 8 * e];
+                sum_im += im9[(a + 8 * e) * 512 + b + 8 * e];
+            }
+            assert(std::abs(sum_re - re3[a * 8 + b]) < 1e-10 && std::abs(sum_im - im3[a * 8 + b]) < 1e-10);
+            assert(std::abs(re3[a * 8 + b] - re3[b * 8 + a]) < 1e-12 && std::abs(im3[a * 8 + b] + im3[b * 8 + a]) < 1e-12);
+        }
+    destroy(sim_id);
+}
+
+void test_random_choice()
+{
+    auto sim_id = init();
+    auto other_id = init();
+    seed(sim_id, 5);
+    seed(other_id, 5);
+
+    double p[] = {0.1, 0., 0.6, 0.3};
+    std::size_t counts[4] = {0, 0, 0, 0};
+    const int n = 20000;
+    for (int i = 0; i < n; ++i)
+    {
+        const std::size_t c = random_choice(sim_id, 4, p);
+        assert(c < 4);
+        ++counts[c];
+        // the same seed gives the same draws
+        assert(random_choice(other_id, 4, p) == c);
+    }
+    assert(counts[1] == 0);
+    for (int i = 0; i < 4; ++i)
+        assert(std::abs(double(counts[i]) / n - p[i]) < 0.02);
+
+    // a different distribution replaces the cached one; weights needn't be normalized
+    double q[] = {0., 0., 5.};
+    assert(random_choice(sim_id, 3, q) == 2);
+
+    destroy(other_id);
+    destroy(sim_id);
+}
+
+void test_memory_budget()
+{
+    auto sim_id = init();
+    const unsigned n = 10;
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(sim_id, i);
+    H(sim_id, 0);
+    T(sim_id, 0);
+    CX(sim_id, 0, 1);
+
+    const unsigned m = 1u << n;
+    std::vector<double> re1(m), im1(m), re2(m), im2(m);
+    assert(DumpToBuffer(sim_id, m, re1.data(), im1.data(), nullptr, -1.) == m);
+
+    std::size_t current = 0, peak = 0;
+    MemoryFootprint(sim_id, &current, &peak);
+    assert(current >= m * sizeof(std::complex<double>) && peak >= current);
+
+    // one more qubit needs a second buffer of twice the size: refused before anything changes
+    SetMemoryBudget(sim_id, current + m * sizeof(std::complex<double>));
+    bool refused = false;
+    try
+    {
+        allocateQubit(sim_id, n);
+    }
+    catch (std::bad_alloc const& e)
+    {
+        refused = std::string(e.what()).find("memory budget") != std::string::npos;
+    }
+    assert(refused);
+    assert(num_qubits(sim_id) == n);
+    assert(DumpToBuffer(sim_id, m, re2.data(), im2.data(), nullptr, -1.) == m);
+    assert(re1 == re2 && im1 == im2);
+
+    // snapshots keep the budget
+    auto snap_id = Snapshot(sim_id);
+    refused = false;
+    try
+    {
+        allocateQubit(snap_id, n);
+    }
+    catch (std::bad_alloc const&)
+    {
+        refused = true;
+    }
+    assert(refused);
+    destroy(snap_id);
+
+    SetMemoryBudget(sim_id, 0);
+    allocateQubit(sim_id, n);
+    std::size_t grown = 0;
+    MemoryFootprint(sim_id, &grown, &peak);
+    assert(grown >= 2 * m * sizeof(std::complex<double>) && peak >= grown + current / 2);
+
+    // the process-wide budget covers all simulators, a new state vector doesn't fit
+    std::size_t process = 0, process_peak = 0;
+    ProcessMemoryFootprint(&process, &process_peak);
+    assert(process >= 2 * m * sizeof(std::complex<double>) && process_peak >= process);
+    auto other_id = init();
+    SetStabilizerMode(other_id, true);
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(other_id, i);
+    SetProcessMemoryBudget(process + m);
+    refused = false;
+    try
+    {
+        T(other_id, 0);
+    }
+    catch (std::bad_alloc const&)
+    {
+        refused = true;
+    }
+    assert(refused);
+    // still in stabilizer mode
+    H(other_id, 0);
+    CX(other_id, 0, 1);
+    assert(M(other_id, 0) == M(other_id, 1));
+    SetProcessMemoryBudget(0);
+    T(other_id, 0);
+
+    destroy(other_id);
+    destroy(sim_id);
+}
+
+// fused matrices that don't fit into the process-wide budget fail the flush, in the caller or on the background
+// worker, and the gates that weren't applied stay pending
+void test_flush_budget()
+{
+    const unsigned n = 14;
+    for (bool async : {false, true})
+    {
+        auto sim_id = init();
+        auto ref_id = init();
+        for (unsigned sim : {sim_id, ref_id})
+        {
+            SetStabilizerMode(sim, false);
+            for (unsigned i = 0; i < n; ++i)
+                allocateQubit(sim, i);
+        }
+        SetAsyncFlush(sim_id, async);
+
+        // a full gate cache starts a background flush in asynchronous mode, it has to fail before the measurement
+        const unsigned gates = async ? 1200 : 280;
+        auto queue = [&](unsigned sim) {
+            for (unsigned g = 0; g < gates; g += 2)
+            {
+                H(sim, (g / 2) % n);
+                T(sim, (g / 2 + 1) % n);
+            }
+        };
+
+        std::size_t current = 0, peak = 0;
+        ProcessMemoryFootprint(&current, &peak);
+        SetProcessMemoryBudget(current + 512);
+        queue(sim_id);
+        bool refused = false;
+        try
+        {
+            M(sim_id, 0);
+        }
+        catch (std::bad_alloc const& e)
+        {
+            refused = std::string(e.what()).find("memory budget") != std::string::npos;
+        }
+        SetProcessMemoryBudget(0);
+        assert(refused);
+
+        queue(ref_id);
+        const unsigned m = 1u << n;
+        std::vector<double> re1(m), im1(m), re2(m), im2(m);
+        assert(DumpToBuffer(sim_id, m, re1.data(), im1.data(), nullptr, -1.) == m);
+        assert(DumpToBuffer(ref_id, m, re2.data(), im2.data(), nullptr, -1.) == m);
+        for (unsigned i = 0; i < m; ++i)
+            assert(std::abs(re1[i] - re2[i]) < 1e-10 && std::abs(im1[i] - im2[i]) < 1e-10);
+
+        SetAsyncFlush(sim_id, false);
+        destroy(ref_id);
+        destroy(sim_id);
+    }
+}
+
+std::map<std::string, double> perf_counters;
+
+void record_perf_counter(const char* name, double value)
+{
+    perf_counters[name] = value;
+}
+
+void test_perf_counters()
+{
+    auto sim_id = init();
+    const unsigned n = 4;
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(sim_id, i);
+    T(sim_id, 0); // leaves stabilizer mode
+    ResetPerfCounters(sim_id);
+
+    for (unsigned i = 0; i < n; ++i)
+        H(sim_id, i);
+    for (unsigned i = 0; i + 1 < n; ++i)
+        CX(sim_id, i, i + 1);
+    M(sim_id, 0);
+    double re[1 << n], im[1 << n];
+    DumpToBuffer(sim_id, 1 << n, re, im, nullptr, -1.);
+
+    GetPerfCounters(sim_id, record_perf_counter);
+    assert(perf_counters["gates_queued"] == 2 * n - 1);
+    assert(perf_counters["flushes_state_access"] == 1);
+    assert(perf_counters["flushes_gate_cache_full"] == 0);
+    assert(perf_counters["clusters"] >= 1);
+    double spans = 0.;
+    for (unsigned s = 1; s <= 7; ++s)
+        spans += perf_counters["fused_span_" + std::to_string(s)];
+    assert(spans == perf_counters["clusters"]);
+    assert(perf_counters["fused_calls"] == 1);
+    assert(perf_counters["fused_bytes"] > 0.);
+    assert(perf_counters["measurement_calls"] == 1);
+    assert(perf_counters["dump_calls"] == 1);
+    assert(perf_counters["dump_seconds"] >= 0.);
+
+    // enough gates to overflow the gate cache
+    for (unsigned i = 0; i < 1200; ++i)
+        Ry(sim_id, 0.1, i % n);
+    GetPerfCounters(sim_id, record_perf_counter);
+    assert(perf_counters["flushes_gate_cache_full"] >= 1);
+
+    ResetPerfCounters(sim_id);
+    GetPerfCounters(sim_id, record_perf_counter);
+    for (auto const& counter : perf_counters)
+        assert(counter.second == 0.);
+
+    destroy(sim_id);
+}
+
+void test_trace()
+{
+    const std::string path = "capi_test_trace.json";
+    assert(!StopTrace());
+    StartTrace(path.c_str());
+
+    auto sim_id = init();
+    for (unsigned i = 0; i < 3; ++i)
+        allocateQubit(sim_id, i);
+    T(sim_id, 0); // the events are recorded by the state vector, not in stabilizer mode
+    allocateQubit(sim_id, 3);
+    H(sim_id, 1);
+    CX(sim_id, 1, 2);
+    M(sim_id, 2);
+    destroy(sim_id);
+
+    assert(StopTrace());
+    std::ifstream in(path);
+    std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::remove(path.c_str());
+    assert(trace.find("\"traceEvents\"") != std::string::npos);
+    for (const char* name : {"\"allocate\"", "\"flush\"", "\"cluster\"", "\"kernel\"", "\"measure\""})
+        assert(trace.find(name) != std::string::npos);
+    assert(trace.find("\"threads\":") != std::string::npos);
+}
+
+// Clifford circuits run on a stabilizer tableau until the first non-Clifford gate, when asked for
+void test_stabilizer()
+{
+    // without the stabilizer mode (the default) the state vector keeps the global phase: Y|0> = i|1>
+    auto sim_id = init();
+    SetStabilizerMode(sim_id, false);
+    allocateQubit(sim_id, 0);
+    Y(sim_id, 0);
+    double re[2], im[2];
+    assert(DumpToBuffer(sim_id, 2, re, im, nullptr, -1.) == 2);
+    assert(std::abs(re[1]) < 1e-12 && std::abs(im[1] - 1.) < 1e-12);
+    destroy(sim_id);
+
+    // Basis states whose Z generators are reduced by later pivots, which flips their signs: X(1) and CX(1, 0) leave
+    // the generators Z0 Z1 and -Z1 of |11>. The state vectors built from the tableau must have the same amplitudes.
+    for (unsigned values = 0; values < 8; ++values)
+        for (unsigned pattern = 0; pattern < 4; ++pattern)
+        {
+            auto stab = init();
+            auto dense = init();
+            SetStabilizerMode(stab, true);
+            SetStabilizerMode(dense, false);
+            for (unsigned sim : {stab, dense})
+            {
+                for (unsigned i = 0; i < 3; ++i)
+                {
+                    allocateQubit(sim, i);
+                    if ((values >> i) & 1) X(sim, i);
+                }
+                CX(sim, 1, 0);
+                if (pattern & 1) CX(sim, 2, 1);
+                if (pattern & 2) CX(sim, 2, 0);
+            }
+            double re1[8], im1[8], re2[8], im2[8];
+            assert(DumpToBuffer(stab, 8, re1, im1, nullptr, -1.) == 8);
+            assert(DumpToBuffer(dense, 8, re2, im2, nullptr, -1.) == 8);
+            for (unsigned i = 0; i < 8; ++i)
+                assert(std::abs(re1[i] * re1[i] + im1[i] * im1[i] - re2[i] * re2[i] - im2[i] * im2[i]) < 1e-12);
+            destroy(stab);
+            destroy(dense);
+        }
+
+    // a GHZ state far beyond the reach of a state vector
+    sim_id = init();
+    SetStabilizerMode(sim_id, true);
+    const unsigned n = 80;
+    for (unsigned i = 0; i < n; ++i)
+        allocateQubit(sim_id, i);
+    H(sim_id, 0);
+    for (unsigned i = 1; i < n; ++i)
+        CX(sim_id, i - 1, i);
+    assert(num_qubits(sim_id) == n);
+    const unsigned first = M(sim_id, 0);
+    for (unsigned i = 0; i < n; ++i)
+    {
+        assert(M(sim_id, i) == first);
+        release(sim_id, i);
+    }
+    destroy(sim_id);
+
+    // the same random Clifford circuit on a tableau and on a state vector (forced by T and AdjT)
+    const unsigned m = 6;
+    auto stab = init();
+    auto dense = init();
+    SetStabilizerMode(stab, true);
+    seed(stab, 11);
+    seed(dense, 11);
+    for (unsigned i = 0; i < m; ++i)
+    {
+        allocateQubit(stab, i);
+        allocateQubit(dense, i);
+    }
+    T(dense, 0);
+    AdjT(dense, 0);
+
+    unsigned long long lcg = 12345;
+    auto next = [&lcg](unsigned bound) {
+        lcg = lcg * 6364136223846793005ull + 1442695040888963407ull;
+        return static_cast<unsigned>((lcg >> 33) % bound);
+    };
+    for (unsigned g = 0; g < 200; ++g)
+    {
+        unsigned a = next(m), b = (a + 1 + next(m - 1)) % m;
+        unsigned op = next(9);
+        for (unsigned sim : {stab, dense})
+        {
+            switch (op)
+            {
+            case 0: H(sim, a); break;
+            case 1: S(sim, a); break;
+            case 2: AdjS(sim, a); break;
+            case 3: X(sim, a); break;
+            case 4: Y(sim, a); break;
+            case 5: Z(sim, a); break;
+            case 6: CX(sim, a, b); break;
+            case 7: CZ(sim, a, b); break;
+            case 8: MCY(sim, 1, &a, b); break;
+            }
+        }
+        if (g % 50 == 49) assert(M(stab, a) == M(dense, a));
+    }
+
+    int bs[] = {1, 3, 2};
+    unsigned qs[] = {0, 2, 5};
+    for (unsigned k = 1; k <= 3; ++k)
+        assert(std::abs(JointEnsembleProbability(stab, k, bs, qs) - JointEnsembleProbability(dense, k, bs, qs)) < 1e-10);
+
+    // the state vector built from the tableau is the same up to a global phase
+    auto snap = Snapshot(stab);
+    T(stab, 0);
+    AdjT(stab, 0);
+    double re1[1 << m], im1[1 << m], re2[1 << m], im2[1 << m];
+    assert(DumpToBuffer(stab, 1 << m, re1, im1, nullptr, -1.) == 1 << m);
+    assert(DumpToBuffer(dense, 1 << m, re2, im2, nullptr, -1.) == 1 << m);
+    std::complex<double> overlap = 0.;
+    for (unsigned i = 0; i < (1u << m); ++i)
+        overlap += std::conj(std::complex<double>(re1[i], im1[i])) * std::complex<double>(re2[i], im2[i]);
+    assert(std::abs(std::abs(overlap) - 1.) < 1e-10);
+
+    // measurements on the tableau draw the same random numbers as on the state vector
+    unsigned zs[] = {2, 2};
+    unsigned pair[] = {1, 4};
+    assert(Measure(snap, 2, zs, pair) == Measure(dense, 2, zs, pair));
+    for (unsigned i = 0; i < m; ++i)
+    {
+        assert(M(snap, i) == M(dense, i));
+        release(snap, i);
+        release(dense, i);
+        M(stab, i);
+        release(stab, i);
+    }
+    destroy(snap);
+    destroy(dense);
+    destroy(stab);
+}
+
 int main()
 {
     std::cerr << "Testing allocate\n";
@@ -421,6 +1474,37 @@ int main()
     std::cerr << "Testing basis state permutation\n";
     test_permute_basis();
     test_permute_basis_adjoint();
+    test_permute_basis_by_function();
+    std::cerr << "Testing arbitrary unitaries\n";
+    test_apply_matrix();
+    std::cerr << "Testing quantum Fourier transform\n";
+    test_qft();
+    std::cerr << "Testing bulk dump\n";
+    test_dump_to_buffer();
+    std::cerr << "Testing snapshots\n";
+    test_snapshot();
+    std::cerr << "Testing state files\n";
+    test_state_file();
+    std::cerr << "Testing asynchronous flush\n";
+    test_async_flush();
+    std::cerr << "Testing batch release\n";
+    test_release_qubits();
+    std::cerr << "Testing overlaps\n";
+    test_overlap();
+    std::cerr << "Testing reduced density matrices\n";
+    test_reduced_density_matrix();
+    std::cerr << "Testing random choice\n";
+    test_random_choice();
+    std::cerr << "Testing memory budget\n";
+    test_memory_budget();
+    std::cerr << "Testing budget of a flush\n";
+    test_flush_budget();
+    std::cerr << "Testing performance counters\n";
+    test_perf_counters();
+    std::cerr << "Testing trace\n";
+    test_trace();
+    std::cerr << "Testing stabilizer mode\n";
+    test_stabilizer();
     std::cerr << "Testing dump\n";
     // test_dump();
     // test_dump_qubits();
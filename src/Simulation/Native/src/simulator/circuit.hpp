@@ -0,0 +1,138 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+
+#include "gates.hpp"
+#include "simulatorinterface.hpp"
+#include "types.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace Simulator
+{
+
+/// One operation of a recorded circuit. Engines that replay a circuit many times (noisy trajectories, gradients) take
+/// the circuit as a list of these and apply them to simulators through the simulator interface.
+struct Operation
+{
+    enum Kind : unsigned
+    {
+        X,
+        Y,
+        Z,
+        H,
+        S,
+        AdjS,
+        T,
+        AdjT,
+        R, // exp(-i angle / 2 P) for the Pauli operator P of `basis`, as Simulator::R
+        M  // measurement in the computational basis
+    };
+
+    Kind kind;
+    logical_qubit_id target;
+    std::vector<logical_qubit_id> controls;
+    Gates::Basis basis = Gates::PauliI;
+    double angle = 0.;
+
+    static Operation gate(Kind kind, logical_qubit_id target, std::vector<logical_qubit_id> controls = {})
+    {
+        return Operation{kind, target, std::move(controls)};
+    }
+
+    static Operation rotation(
+        Gates::Basis basis,
+        double angle,
+        logical_qubit_id target,
+        std::vector<logical_qubit_id> controls = {})
+    {
+        return Operation{R, target, std::move(controls), basis, angle};
+    }
+
+    static Operation measurement(logical_qubit_id target)
+    {
+        return Operation{M, target, {}};
+    }
+
+    /// the controls followed by the target
+    std::vector<logical_qubit_id> qubits() const
+    {
+        std::vector<logical_qubit_id> qs(controls);
+        qs.push_back(target);
+        return qs;
+    }
+};
+
+using Circuit = std::vector<Operation>;
+
+/// The inverse of the gate `op`; measurements have none.
+inline Operation adjoint(Operation op)
+{
+    switch (op.kind)
+    {
+    case Operation::S:
+        op.kind = Operation::AdjS;
+        break;
+    case Operation::AdjS:
+        op.kind = Operation::S;
+        break;
+    case Operation::T:
+        op.kind = Operation::AdjT;
+        break;
+    case Operation::AdjT:
+        op.kind = Operation::T;
+        break;
+    case Operation::R:
+        op.angle = -op.angle;
+        break;
+    case Operation::M:
+        throw std::runtime_error("a measurement has no adjoint");
+    default:
+        break;
+    }
+    return op;
+}
+
+/// Applies `op` to `sim`. Returns the outcome of a measurement, false for all other operations.
+inline bool apply(SimulatorInterface& sim, Operation const& op)
+{
+    const bool controlled = !op.controls.empty();
+    switch (op.kind)
+    {
+#define CASE(OP)                                                                                                       \
+    case Operation::OP:                                                                                                \
+        if (controlled)                                                                                                \
+            sim.C##OP(op.controls, op.target);                                                                         \
+        else                                                                                                           \
+            sim.OP(op.target);                                                                                         \
+        break;
+        CASE(X)
+        CASE(Y)
+        CASE(Z)
+        CASE(H)
+        CASE(S)
+        CASE(AdjS)
+        CASE(T)
+        CASE(AdjT)
+#undef CASE
+    case Operation::R:
+        if (controlled)
+            sim.CR(op.basis, op.angle, op.controls, op.target);
+        else
+            sim.R(op.basis, op.angle, op.target);
+        break;
+    case Operation::M:
+        return sim.M(op.target);
+    }
+    return false;
+}
+
+} // namespace Simulator
+} // namespace Quantum
+} // namespace Microsoft
@@ -4,8 +4,10 @@
 #include "simulator/factory.hpp"
 #include "config.hpp"
 #include "util/cpuid.hpp"
+#include <cstdlib>
 #include <iostream>
 #include <shared_mutex>
+#include <string>
 
 namespace Microsoft
 {
@@ -14,18 +16,38 @@ namespace Quantum
 namespace SimulatorGeneric
 {
 Microsoft::Quantum::Simulator::SimulatorInterface* createSimulator(unsigned);
+Microsoft::Quantum::Simulator::SimulatorInterface* createShardedSimulator(
+    std::string const&,
+    unsigned,
+    unsigned,
+    unsigned);
 }
 namespace SimulatorAVX
 {
 Microsoft::Quantum::Simulator::SimulatorInterface* createSimulator(unsigned);
+Microsoft::Quantum::Simulator::SimulatorInterface* createShardedSimulator(
+    std::string const&,
+    unsigned,
+    unsigned,
+    unsigned);
 }
 namespace SimulatorAVX2
 {
 Microsoft::Quantum::Simulator::SimulatorInterface* createSimulator(unsigned);
+Microsoft::Quantum::Simulator::SimulatorInterface* createShardedSimulator(
+    std::string const&,
+    unsigned,
+    unsigned,
+    unsigned);
 }
 namespace SimulatorAVX512
 {
 Microsoft::Quantum::Simulator::SimulatorInterface* createSimulator(unsigned);
+Microsoft::Quantum::Simulator::SimulatorInterface* createShardedSimulator(
+    std::string const&,
+    unsigned,
+    unsigned,
+    unsigned);
 }
 } // namespace Quantum
 } // namespace Microsoft
@@ -39,17 +61,42 @@ namespace Simulator
 std::shared_mutex _mutex;
 std::vector<std::shared_ptr<SimulatorInterface>> _psis;
 
+// The instruction set of the simulators to create: the widest one the processor supports, unless the environment
+// variable QDK_SIM_ISA asks for a narrower one (generic, avx, avx2 or avx512), e.g. to compare them in benchmarks.
+static int isa_level()
+{
+    int level = haveAVX512() ? 3 : (haveFMA() && haveAVX2()) ? 2 : haveAVX() ? 1 : 0;
+    std::string isa;
+#ifdef _MSC_VER
+    char* env = nullptr;
+    size_t len;
+    if (_dupenv_s(&env, &len, "QDK_SIM_ISA") == 0 && env != nullptr)
+    {
+        isa = env;
+        free(env);
+    }
+#else
+    const char* env = getenv("QDK_SIM_ISA");
+    if (env != nullptr) isa = env;
+#endif
+    const char* const names[] = {"generic", "avx", "avx2", "avx512"};
+    for (int l = 0; l < level; ++l)
+        if (isa == names[l]) return l;
+    return level;
+}
+
 SimulatorInterface* createSimulator(unsigned maxlocal)
 {
-    if (haveAVX512())
+    const int level = isa_level();
+    if (level == 3)
     {
         return SimulatorAVX512::createSimulator(maxlocal);
     }
-    else if (haveFMA() && haveAVX2())
+    else if (level == 2)
     {
         return SimulatorAVX2::createSimulator(maxlocal);
     }
-    else if (haveAVX())
+    else if (level == 1)
     {
         return SimulatorAVX::createSimulator(maxlocal);
     }
@@ -59,7 +106,33 @@ SimulatorInterface* createSimulator(unsigned maxlocal)
     }
 }
 
-MICROSOFT_QUANTUM_DECL unsigned create(unsigned maxlocal)
+SimulatorInterface* createShardedSimulator(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal)
+{
+    const int level = isa_level();
+    if (level == 3)
+    {
+        return SimulatorAVX512::createShardedSimulator(session, rank, processes, maxlocal);
+    }
+    else if (level == 2)
+    {
+        return SimulatorAVX2::createShardedSimulator(session, rank, processes, maxlocal);
+    }
+    else if (level == 1)
+    {
+        return SimulatorAVX::createShardedSimulator(session, rank, processes, maxlocal);
+    }
+    else
+    {
+        return SimulatorGeneric::createShardedSimulator(session, rank, processes, maxlocal);
+    }
+}
+
+// stores the simulator in the first free slot and returns the slot number as the simulator id
+static unsigned emplace(std::shared_ptr<SimulatorInterface> psi)
 {
     std::lock_guard<std::shared_mutex> lock(_mutex);
 
@@ -75,17 +148,38 @@ MICROSOFT_QUANTUM_DECL unsigned create(unsigned maxlocal)
 
     if (emptySlot == -1)
     {
-        _psis.push_back(std::shared_ptr<SimulatorInterface>(createSimulator(maxlocal)));
+        _psis.push_back(std::move(psi));
         emptySlot = _psis.size() - 1;
     }
     else
     {
-        _psis[emptySlot] = std::shared_ptr<SimulatorInterface>(createSimulator(maxlocal));
+        _psis[emptySlot] = std::move(psi);
     }
 
     return static_cast<unsigned>(emptySlot);
 }
 
+MICROSOFT_QUANTUM_DECL unsigned create(unsigned maxlocal)
+{
+    return emplace(std::shared_ptr<SimulatorInterface>(createSimulator(maxlocal)));
+}
+
+MICROSOFT_QUANTUM_DECL unsigned createSharded(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal)
+{
+    return emplace(std::shared_ptr<SimulatorInterface>(createShardedSimulator(session, rank, processes, maxlocal)));
+}
+
+MICROSOFT_QUANTUM_DECL unsigned clone(unsigned id)
+{
+    // copy the pointer, the slot might move while the new simulator is being stored
+    std::shared_ptr<SimulatorInterface> psi = get(id);
+    return emplace(std::shared_ptr<SimulatorInterface>(psi->clone()));
+}
+
 MICROSOFT_QUANTUM_DECL void destroy(unsigned id)
 {
     std::lock_guard<std::shared_mutex> lock(_mutex);
@@ -3,6 +3,7 @@
 
 #include "config.hpp"
 #include "simulatorinterface.hpp"
+#include <string>
 
 namespace Microsoft
 {
@@ -11,6 +12,13 @@ namespace Quantum
 namespace Simulator
 {
 MICROSOFT_QUANTUM_DECL unsigned create(unsigned = 0u);
+// one of the `processes` processes of a sharded simulator, see ShardedSimulator
+MICROSOFT_QUANTUM_DECL unsigned createSharded(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal);
+MICROSOFT_QUANTUM_DECL unsigned clone(unsigned);
 MICROSOFT_QUANTUM_DECL void destroy(unsigned);
 MICROSOFT_QUANTUM_DECL std::shared_ptr<SimulatorInterface>& get(unsigned);
 } // namespace Simulator
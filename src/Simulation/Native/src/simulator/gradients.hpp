@@ -0,0 +1,182 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "circuit.hpp"
+#include "simulatorinterface.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace Simulator
+{
+
+/// A term of an observable: a real coefficient times the product of the Pauli operators `bases` on `qubits`.
+struct PauliTerm
+{
+    double coefficient;
+    std::vector<Gates::Basis> bases;
+    std::vector<logical_qubit_id> qubits;
+};
+
+using Observable = std::vector<PauliTerm>;
+
+/// Expectation values of an observable H after a parameterized circuit, and their gradients with respect to the
+/// parameters, by adjoint differentiation. The forward pass runs the circuit once to |psi>. The backward pass undoes
+/// the gates one by one on both |psi> and H|psi>, and reads the derivative of every parameterized rotation off an
+/// overlap of the two states at that point. A gradient thus takes about three runs of the circuit and a few sweeps
+/// over the state per parameterized rotation, where the parameter-shift rule takes two runs per parameter.
+///
+/// The circuit must not measure. The simulator must support snapshots, overlaps and Pauli sums.
+class GradientEngine
+{
+  public:
+    explicit GradientEngine(Circuit circuit)
+        : circuit_(std::move(circuit))
+        , bindings_(circuit_.size())
+    {
+        for (Operation const& op : circuit_)
+            if (op.kind == Operation::M) throw std::runtime_error("circuits with measurements can't be differentiated");
+    }
+
+    /// Makes the angle of the rotation `operation` (an index into the circuit) its recorded angle plus
+    /// factor * theta[parameter]. A parameter can drive several rotations.
+    void bind(std::size_t operation, std::size_t parameter, double factor = 1.)
+    {
+        if (operation >= circuit_.size() || circuit_[operation].kind != Operation::R)
+            throw std::runtime_error("only rotations can be bound to a parameter");
+        bindings_[operation] = Binding{parameter, factor};
+        num_parameters_ = std::max(num_parameters_, parameter + 1);
+    }
+
+    std::size_t num_parameters() const
+    {
+        return num_parameters_;
+    }
+
+    /// <psi|H|psi> for the state |psi> the circuit with the parameters theta prepares from the state of `initial`,
+    /// which stays unchanged.
+    double expectation(SimulatorInterface const& initial, std::vector<double> const& theta, Observable const& h) const
+    {
+        std::unique_ptr<SimulatorInterface> psi = forward(initial, theta);
+        std::unique_ptr<SimulatorInterface> hpsi(psi->clone());
+        apply_observable(*hpsi, h);
+        return psi->Overlap(*hpsi).real();
+    }
+
+    /// Returns the expectation value as `expectation` and stores its derivatives with respect to theta in `gradient`.
+    double gradient(
+        SimulatorInterface const& initial,
+        std::vector<double> const& theta,
+        Observable const& h,
+        std::vector<double>& gradient) const
+    {
+        gradient.assign(num_parameters_, 0.);
+        std::unique_ptr<SimulatorInterface> phi = forward(initial, theta);
+        std::unique_ptr<SimulatorInterface> lambda(phi->clone());
+        apply_observable(*lambda, h);
+        const double value = phi->Overlap(*lambda).real();
+
+        // d<psi|H|psi>/d angle_j = 2 Re <lambda_j| dU_j/d angle_j |phi_j-1>, where phi_j is the state after gate j and
+        // lambda_j = U_j+1^dagger ... U_G^dagger H |psi>. A rotation by exp(-i angle/2 G) has the derivative
+        // -i/2 G U_j, so that is Im <lambda_j|G|phi_j>.
+        std::unique_ptr<SimulatorInterface> scratch(phi->clone());
+        for (std::size_t j = circuit_.size(); j-- > 0;)
+        {
+            const Operation op = bound(j, theta);
+            Binding const& b = bindings_[j];
+            if (b.parameter != unbound)
+                gradient[b.parameter] += b.factor * generator_overlap(*lambda, *phi, *scratch, op).imag();
+            if (j == 0) break;
+            const Operation inverse = adjoint(op);
+            apply(*phi, inverse);
+            apply(*lambda, inverse);
+        }
+        return value;
+    }
+
+  private:
+    static constexpr std::size_t unbound = std::numeric_limits<std::size_t>::max();
+
+    struct Binding
+    {
+        std::size_t parameter = unbound;
+        double factor = 0.;
+    };
+
+    // operation j with its angle for the parameters theta
+    Operation bound(std::size_t j, std::vector<double> const& theta) const
+    {
+        Operation op = circuit_[j];
+        Binding const& b = bindings_[j];
+        if (b.parameter != unbound)
+        {
+            if (b.parameter >= theta.size()) throw std::runtime_error("too few parameters for the circuit");
+            op.angle += b.factor * theta[b.parameter];
+        }
+        return op;
+    }
+
+    std::unique_ptr<SimulatorInterface> forward(
+        SimulatorInterface const& initial,
+        std::vector<double> const& theta) const
+    {
+        std::unique_ptr<SimulatorInterface> psi(initial.clone());
+        for (std::size_t j = 0; j < circuit_.size(); ++j)
+            apply(*psi, bound(j, theta));
+        return psi;
+    }
+
+    static void apply_observable(SimulatorInterface& sim, Observable const& h)
+    {
+        std::vector<double> c;
+        std::vector<std::vector<Gates::Basis>> bs;
+        std::vector<std::vector<logical_qubit_id>> qs;
+        for (PauliTerm const& term : h)
+        {
+            c.push_back(term.coefficient);
+            bs.push_back(term.bases);
+            qs.push_back(term.qubits);
+        }
+        sim.ApplyPauliSum(c, bs, qs);
+    }
+
+    // <lambda|G|phi> for the generator G of the rotation op: its Pauli operator P on the target, projected onto the
+    // controls being 1. With controls, G = CP - (1 + CZ) / 2, where CZ is a Z on the last control controlled by the
+    // others, which are unitaries the simulator can apply. `scratch` is overwritten.
+    static std::complex<double> generator_overlap(
+        SimulatorInterface& lambda,
+        SimulatorInterface& phi,
+        SimulatorInterface& scratch,
+        Operation const& op)
+    {
+        static const Operation::Kind paulis[] = {Operation::X, Operation::Z, Operation::Y}; // PauliX, PauliZ, PauliY
+        scratch.restore(phi);
+        if (op.basis != Gates::PauliI) apply(scratch, Operation::gate(paulis[op.basis - 1], op.target, op.controls));
+        const std::complex<double> cp = lambda.Overlap(scratch);
+        if (op.controls.empty()) return cp;
+
+        scratch.restore(phi);
+        std::vector<logical_qubit_id> cs(op.controls.begin(), op.controls.end() - 1);
+        apply(scratch, Operation::gate(Operation::Z, op.controls.back(), cs));
+        return cp - 0.5 * (lambda.Overlap(phi) + lambda.Overlap(scratch));
+    }
+
+    Circuit circuit_;
+    std::vector<Binding> bindings_;
+    std::size_t num_parameters_ = 0;
+};
+
+} // namespace Simulator
+} // namespace Quantum
+} // namespace Microsoft
@@ -4,6 +4,7 @@
 #pragma once
 
 #include "gates.hpp"
+#include "simulator/reductions.hpp"
 #include "util/argmaxnrm2.hpp"
 #include "util/bititerator.hpp"
 #include "util/bitops.hpp"
@@ -12,6 +13,7 @@
 
 #include <atomic>
 #include <complex>
+#include <numeric>
 namespace Microsoft
 {
 namespace Quantum
@@ -29,6 +31,75 @@ inline std::size_t make_mask(std::vector<unsigned> const& qs)
     return mask;
 }
 
+// copy the amplitudes of `src` into `dst` in parallel (no reallocation if `dst` already has the right size)
+template <class T, class A1, class A2>
+void parallel_copy(std::vector<T, A1> const& src, std::vector<T, A2>& dst)
+{
+    dst.resize(src.size());
+    T const* from = src.data();
+    T* to = dst.data();
+#pragma omp parallel for schedule(static)
+    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(src.size()); ++i)
+        to[i] = from[i];
+}
+
+// Copies the amplitudes whose squared magnitude is above `threshold` into the arrays `re` and `im` of capacity `n`, in the
+// order of their basis state index, and, if `indices` isn't null, their indices. A negative threshold selects all
+// amplitudes. Returns the number of selected amplitudes, which might exceed `n` (the excess isn't copied).
+template <class T, class A>
+std::size_t copy_amplitudes(
+    std::vector<std::complex<T>, A> const& wfn,
+    double threshold,
+    std::size_t n,
+    double* re,
+    double* im,
+    std::size_t* indices)
+{
+    if (threshold < 0.)
+    {
+        const std::intptr_t m = static_cast<std::intptr_t>(std::min(n, wfn.size()));
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t i = 0; i < m; ++i)
+        {
+            re[i] = wfn[i].real();
+            im[i] = wfn[i].imag();
+            if (indices != nullptr) indices[i] = i;
+        }
+        return wfn.size();
+    }
+
+    // count the selected amplitudes per chunk, then each chunk writes its amplitudes starting at its prefix sum
+    std::vector<std::size_t> chunks = split_interval_in_chunks(wfn.size(), omp_get_max_threads());
+    const std::intptr_t nchunks = static_cast<std::intptr_t>(chunks.size()) - 1;
+    std::vector<std::size_t> offsets(chunks.size(), 0);
+#pragma omp parallel for schedule(static, 1)
+    for (std::intptr_t c = 0; c < nchunks; ++c)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+            if (std::norm(wfn[i]) > threshold) ++count;
+        offsets[c + 1] = count;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+#pragma omp parallel for schedule(static, 1)
+    for (std::intptr_t c = 0; c < nchunks; ++c)
+    {
+        std::size_t k = offsets[c];
+        for (std::size_t i = chunks[c]; i < chunks[c + 1] && k < n; ++i)
+        {
+            if (std::norm(wfn[i]) > threshold)
+            {
+                re[k] = wfn[i].real();
+                im[k] = wfn[i].imag();
+                if (indices != nullptr) indices[k] = i;
+                ++k;
+            }
+        }
+    }
+    return offsets.back();
+}
+
 template <class T, class A>
 void swap(std::vector<T, A>& wfn, unsigned q1, unsigned q2)
 {
@@ -59,15 +130,21 @@ void swap(std::vector<T, A>& wfn, unsigned q1, unsigned q2)
 #endif
 }
 
+// zeroes the amplitudes whose parity on qs differs from val and multiplies the others by scale
 template <class T, class A>
-void jointcollapse(std::vector<T, A>& wfn, std::vector<unsigned> const& qs, bool val)
+void jointcollapse(std::vector<T, A>& wfn, std::vector<unsigned> const& qs, bool val, double scale = 1.)
 {
     std::size_t mask = make_mask(qs);
+    const auto s = static_cast<typename T::value_type>(scale);
 
-// sum up probabilities for all configuratiions where an odd number of selected bits is set
 #pragma omp parallel for schedule(static)
     for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); i++)
-        if (poppar(i & mask) != val) wfn[i] = 0.;
+    {
+        if (poppar(i & mask) != val)
+            wfn[i] = 0.;
+        else
+            wfn[i] *= s;
+    }
 }
 
 template <class T, class A>
@@ -85,31 +162,100 @@ unsigned getvalue(
     return 2;
 }
 
+// Zeroes the amplitudes with qubit q different from val and multiplies the others by scale, in a single sweep. With
+// `compact`, the amplitudes with qubit q equal to val are instead moved (and scaled) to the lower half of the state and
+// the state is shrunk by half.
 template <class T, class A>
-void collapse(std::vector<T, A>& wfn, unsigned q, bool val, bool compact = false)
+void collapse(std::vector<T, A>& wfn, unsigned q, bool val, bool compact = false, double scale = 1.)
 {
+    const std::size_t offset = 1ull << q;
+    const std::size_t maski = ~(offset - 1);
+    const std::intptr_t half = static_cast<std::intptr_t>(wfn.size() / 2);
+    const auto s = static_cast<typename T::value_type>(scale);
     if (compact)
     {
-        std::size_t offset = (1ull << q);
-        T* base = &wfn[0];
-        T* dst = (val ? base : base + offset);
-        T* src = dst + offset;
-        while (src < base + wfn.size())
+        // Block j of `offset` amplitudes of the result is block 2 j + val of the state. Writing block j overwrites the
+        // source of block j / 2 only, so the blocks are moved in rounds [1, 2), [2, 4), [4, 8), ..., each of which
+        // only reads blocks that no other block of the same round writes.
+        const std::size_t blocks = wfn.size() / (2 * offset);
+        T* base = wfn.data();
+        if (val || scale != 1.)
         {
-            std::copy_n(src, offset, dst);
-            src += 2 * offset;
-            dst += offset;
+#pragma omp parallel for schedule(static)
+            for (std::intptr_t d = 0; d < static_cast<std::intptr_t>(offset); ++d)
+                base[d] = base[d + (val ? offset : 0)] * s;
+        }
+        for (std::size_t lo = 1; lo < blocks; lo *= 2)
+        {
+            const std::size_t hi = std::min(2 * lo, blocks);
+            const std::intptr_t n = static_cast<std::intptr_t>((hi - lo) * offset);
+#pragma omp parallel for schedule(static)
+            for (std::intptr_t l = 0; l < n; ++l)
+            {
+                const std::size_t j = lo + l / offset;
+                const std::size_t d = l % offset;
+                base[j * offset + d] = base[(2 * j + (val ? 1 : 0)) * offset + d] * s;
+            }
         }
         wfn.resize(wfn.size() / 2);
     }
     else
     {
-        std::size_t mask = (1ull << q);
-        std::size_t state = (val ? mask : 0ul);
+        const std::size_t keep = (val ? offset : 0);
+        const std::size_t drop = (val ? 0 : offset);
 #pragma omp parallel for schedule(static)
-        for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); ++i)
-            if ((i & mask) != state) wfn[i] = 0.;
+        for (std::intptr_t l = 0; l < half; l++)
+        {
+            std::size_t i = ((l & maski) << 1) + (l & (offset - 1));
+            wfn[i + keep] *= s;
+            wfn[i + drop] = 0.;
+        }
+    }
+}
+
+// Removes the classical qubits at positions ps (in increasing order) from the state, keeping the amplitudes in which
+// the qubit at ps[i] has the value of bit i of `values`. The result is built in place: with `run` the length of the runs
+// of consecutive amplitudes below ps[0], run j of the result comes from run b(j) >= 2 j of the state, so the runs are
+// moved in rounds [1, 2), [2, 4), [4, 8), ..., each of which only reads runs that no other run of the same round
+// writes. The state shrinks by a factor of 2^ps.size().
+template <class T, class A>
+void compact(std::vector<T, A>& wfn, std::vector<unsigned> const& ps, std::size_t values)
+{
+    if (ps.empty()) return;
+    const std::size_t run = 1ull << ps[0];
+    const std::size_t runs = (wfn.size() >> ps.size()) / run;
+
+    // the run of the state that becomes run j of the result
+    auto source = [&ps, values](std::size_t j) {
+        for (std::size_t i = 0; i < ps.size(); ++i)
+        {
+            const unsigned r = ps[i] - ps[0];
+            const std::size_t low = j & ((1ull << r) - 1);
+            j = ((j - low) << 1) | (((values >> i) & 1) << r) | low;
+        }
+        return j;
+    };
+
+    T* base = wfn.data();
+    if (const std::size_t b = source(0))
+    {
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t d = 0; d < static_cast<std::intptr_t>(run); ++d)
+            base[d] = base[b * run + d];
     }
+    for (std::size_t lo = 1; lo < runs; lo *= 2)
+    {
+        const std::size_t hi = std::min(2 * lo, runs);
+        const std::intptr_t n = static_cast<std::intptr_t>((hi - lo) * run);
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t l = 0; l < n; ++l)
+        {
+            const std::size_t j = lo + l / run;
+            const std::size_t d = l % run;
+            base[j * run + d] = base[source(j) * run + d];
+        }
+    }
+    wfn.resize(wfn.size() >> ps.size());
 }
 
 template <class T, class A>
@@ -122,65 +268,114 @@ bool isclassical(
     bool have0 = false;
     bool have1 = false;
 
-    std::size_t maski = ~(offset - 1);
-#ifndef _MSC_VER
-#pragma omp parallel for schedule(static) reduction(|| : have0, have1)
-    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); i += 2 * offset)
-        for (std::intptr_t j = 0; j < static_cast<std::intptr_t>(offset); ++j)
-        {
-            have0 = have0 || std::norm(wfn[i + j]) >= eps;
-            have1 = have1 || std::norm(wfn[i + j + offset]) >= eps;
-        }
-#else
-#pragma omp parallel for schedule(static) reduction(|| : have0, have1)
-    for (std::intptr_t l = 0; l < static_cast<std::intptr_t>(wfn.size()) / 2; l++)
+#pragma omp parallel reduction(|| : have0, have1)
     {
-        std::intptr_t j = l % offset;
-        std::intptr_t i = ((l & maski) << 1);
-        have0 = have0 || std::norm(wfn[i + j]) >= eps;
-        have1 = have1 || std::norm(wfn[i + j + offset]) >= eps;
+        std::size_t start, end;
+        detail::thread_range(wfn.size() / 2, start, end);
+        double max0 = 0.;
+        double max1 = 0.;
+        detail::for_each_run(start, end, static_cast<unsigned>(q), [&](std::size_t i, std::size_t len) {
+            max0 = std::max(max0, detail::max_norm(&wfn[i], len));
+            max1 = std::max(max1, detail::max_norm(&wfn[i + offset], len));
+        });
+        have0 = have0 || max0 >= eps;
+        have1 = have1 || max1 >= eps;
     }
-#endif
 
     if (have0 && have1) return false;
     return true;
 }
 
+// the probabilities of measuring an even and an odd parity of the qubits qs, in a single sweep
+template <class T, class A>
+void jointprobabilities(std::vector<T, A> const& wfn, std::vector<unsigned> const& qs, double& prob0, double& prob1)
+{
+    const std::size_t mask = make_mask(qs);
+    // the parity is constant on runs of 2^(lowest qubit) consecutive basis states
+    std::size_t run = wfn.size();
+    if (mask != 0) run = mask & (~mask + 1);
+
+    double p0 = 0.;
+    double p1 = 0.;
+#pragma omp parallel reduction(+ : p0, p1)
+    {
+        std::size_t start, end;
+        detail::thread_range(wfn.size() / run, start, end);
+        for (std::size_t r = start; r < end; ++r)
+        {
+            const double p = detail::sum_norm(&wfn[r * run], run);
+            if (poppar((r * run) & mask))
+                p1 += p;
+            else
+                p0 += p;
+        }
+    }
+    prob0 = p0;
+    prob1 = p1;
+}
+
 template <class T, class A>
 double jointprobability(std::vector<T, A> const& wfn, std::vector<unsigned> const& qs, bool val = true)
 {
-    std::size_t mask = 0;
-    double prob = 0.;
-    for (std::size_t q : qs)
-        mask = mask | (1ull << q);
-// sum up probabilities for all configuratiions where an odd number of selected bits is set
-#pragma omp parallel for schedule(static) reduction(+ : prob)
-    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); i++)
-        if (poppar(i & mask) == val) prob += std::norm(wfn[i]);
-    return prob;
+    // sum up probabilities for all configurations where an odd (or even, if !val) number of selected bits is set
+    double prob0, prob1;
+    jointprobabilities(wfn, qs, prob0, prob1);
+    return val ? prob1 : prob0;
 }
 
+// the probabilities of measuring qubit q as 0 and as 1, in a single sweep
 template <class T, class A>
-double probability(std::vector<std::complex<T>, A> const& wfn, unsigned q)
+void probabilities(std::vector<std::complex<T>, A> const& wfn, unsigned q, double& prob0, double& prob1)
 {
     std::size_t offset = 1ull << q;
-    T prob = 0.;
-    std::size_t maski = ~(offset - 1);
-#ifndef _MSC_VER
-#pragma omp parallel for schedule(static) reduction(+ : prob)
-    for (std::intptr_t i = offset; i < static_cast<std::intptr_t>(wfn.size()); i += 2 * offset)
-        for (std::intptr_t d = 0; d < static_cast<std::intptr_t>(offset); ++d)
-            prob += std::norm(wfn[i + d]);
-#else
-#pragma omp parallel for schedule(static) reduction(+ : prob)
-    for (std::intptr_t l = 0; l < static_cast<std::intptr_t>(wfn.size()) / 2; l++)
+    double p0 = 0.;
+    double p1 = 0.;
+#pragma omp parallel reduction(+ : p0, p1)
+    {
+        std::size_t start, end;
+        detail::thread_range(wfn.size() / 2, start, end);
+        double s0 = 0.;
+        double s1 = 0.;
+        if (q == 0)
+        {
+            if (start < end) detail::sum_norm_pairs(&wfn[2 * start], end - start, s0, s1);
+        }
+        else
+        {
+            detail::for_each_run(start, end, q, [&](std::size_t i, std::size_t len) {
+                s0 += detail::sum_norm(&wfn[i], len);
+                s1 += detail::sum_norm(&wfn[i + offset], len);
+            });
+        }
+        p0 += s0;
+        p1 += s1;
+    }
+    prob0 = p0;
+    prob1 = p1;
+}
+
+template <class T, class A>
+double probability(std::vector<std::complex<T>, A> const& wfn, unsigned q)
+{
+    if (q == 0)
     {
-        std::intptr_t j = l % offset;
-        std::intptr_t i = offset + ((l & maski) << 1);
-        prob += std::norm(wfn[i + j]);
+        double prob0, prob1;
+        probabilities(wfn, q, prob0, prob1);
+        return prob1;
     }
-#endif
 
+    // only the amplitudes with qubit q = 1 need to be read
+    std::size_t offset = 1ull << q;
+    double prob = 0.;
+#pragma omp parallel reduction(+ : prob)
+    {
+        std::size_t start, end;
+        detail::thread_range(wfn.size() / 2, start, end);
+        double s1 = 0.;
+        detail::for_each_run(
+            start, end, q, [&](std::size_t i, std::size_t len) { s1 += detail::sum_norm(&wfn[i + offset], len); });
+        prob += s1;
+    }
     return prob;
 }
 
@@ -353,14 +548,64 @@ double jointprobability(
     return prob;
 }
 
+// Multiplies the amplitudes of the basis states with all the bits in cmask set by the diagonal entry selected by the
+// bits at the positions qs (qs[i] is bit i of the index into diag).
+template <class T, class A1, class A2>
+void apply_controlled_diagonal(
+    std::vector<T, A1>& wfn,
+    std::vector<T, A2> const& diag,
+    std::vector<unsigned> const& qs,
+    std::size_t cmask)
+{
+    assert(diag.size() == 1ull << qs.size());
+#pragma omp parallel for schedule(static)
+    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); ++i)
+    {
+        if ((i & cmask) != cmask) continue;
+        std::size_t r = 0;
+        for (unsigned l = 0; l < qs.size(); ++l)
+            r |= ((i >> qs[l]) & 1ull) << l;
+        wfn[i] *= diag[r];
+    }
+}
+
+// Replaces wfn by sum_k c[k] P_k wfn, where the Pauli operator P_k flips the bits in xmasks[k] and changes the sign of
+// the basis states with an odd number of bits in zmasks[k] (before the flip); the factors of i of its Y operators are
+// part of c[k]. Every output amplitude gathers its terms, so the threads write disjoint amplitudes.
+template <class T, class A>
+void apply_pauli_sum(
+    std::vector<std::complex<T>, A>& wfn,
+    std::vector<std::complex<T>> const& c,
+    std::vector<std::size_t> const& xmasks,
+    std::vector<std::size_t> const& zmasks)
+{
+    std::vector<std::complex<T>, A> out(wfn.size());
+#pragma omp parallel for schedule(static)
+    for (std::intptr_t y = 0; y < static_cast<std::intptr_t>(wfn.size()); ++y)
+    {
+        std::complex<T> sum = 0.;
+        for (std::size_t k = 0; k < c.size(); ++k)
+        {
+            const std::size_t x = static_cast<std::size_t>(y) ^ xmasks[k];
+            const std::complex<T> term = c[k] * wfn[x];
+            sum += poppar(x & zmasks[k]) ? -term : term;
+        }
+        out[y] = sum;
+    }
+    wfn.swap(out);
+}
+
 // get the 2-norm
 template <class T, class A>
 double nrm2(std::vector<std::complex<T>, A> const& x)
 {
     double sum = 0.;
-#pragma omp parallel for schedule(static) reduction(+ : sum)
-    for (std::intptr_t i = 0; i < (std::intptr_t)x.size(); ++i)
-        sum += x[i].real() * x[i].real() + x[i].imag() * x[i].imag();
+#pragma omp parallel reduction(+ : sum)
+    {
+        std::size_t start, end;
+        detail::thread_range(x.size(), start, end);
+        if (start < end) sum += detail::sum_norm(&x[start], end - start);
+    }
     return std::sqrt(sum);
 }
 
@@ -373,94 +618,139 @@ void normalize(std::vector<T, A>& wfn)
         wfn[i] *= scale;
 }
 
+// <a|b>, where bit p of the index of an amplitude of a is bit perm[p] of the index of the corresponding amplitude of b.
+// An empty perm means the same order. Otherwise the permuted index is combined from two tables, one for the low and one
+// for the high half of the bits.
+template <class T, class A1, class A2>
+std::complex<double> inner_product(
+    std::vector<std::complex<T>, A1> const& a,
+    std::vector<std::complex<T>, A2> const& b,
+    std::vector<unsigned> const& perm)
+{
+    assert(a.size() == b.size());
+    double re = 0., im = 0.;
+    if (perm.empty())
+    {
+#pragma omp parallel reduction(+ : re, im)
+        {
+            std::size_t start, end;
+            detail::thread_range(a.size(), start, end);
+            if (start < end)
+            {
+                const std::complex<double> sum = detail::sum_conj_product(&a[start], &b[start], end - start);
+                re += sum.real();
+                im += sum.imag();
+            }
+        }
+        return {re, im};
+    }
+
+    const unsigned n = static_cast<unsigned>(perm.size()), low = n / 2;
+    std::vector<std::size_t> low_table(std::size_t(1) << low), high_table(std::size_t(1) << (n - low));
+    for (std::size_t x = 0; x < low_table.size(); ++x)
+        for (unsigned p = 0; p < low; ++p)
+            low_table[x] |= ((x >> p) & 1ull) << perm[p];
+    for (std::size_t x = 0; x < high_table.size(); ++x)
+        for (unsigned p = low; p < n; ++p)
+            high_table[x] |= ((x >> (p - low)) & 1ull) << perm[p];
+
+    const std::size_t low_mask = low_table.size() - 1;
+#pragma omp parallel for schedule(static) reduction(+ : re, im)
+    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(a.size()); ++i)
+    {
+        const std::size_t j = low_table[i & low_mask] | high_table[static_cast<std::size_t>(i) >> low];
+        const std::complex<double> t = std::conj(std::complex<double>(a[i])) * std::complex<double>(b[j]);
+        re += t.real();
+        im += t.imag();
+    }
+    return {re, im};
+}
+
+// Copies the amplitudes of the basis states that agree with pivot_position on all qubits but qs (which must be sorted)
+// into qubitswfn, and returns their 2-norm.
 template <class T, class A1, class A2>
-void subsytemwavefunction_by_pivot(
+double subsytemwavefunction_by_pivot(
     std::vector<T, A1> const& wfn,
     std::vector<unsigned> const& qs,
     std::vector<T, A2>& qubitswfn,
     std::size_t pivot_position)
 {
-
-    const unsigned bit_size = sizeof(std::size_t) * 8;
     assert(qs.size() > 0);
     for (std::size_t i = 0; i < qs.size() - 1; ++i)
     {
         assert(qs[i] < qs[i + 1]);
     }
+    assert(qubitswfn.size() == 1ull << qs.size());
 
-    std::size_t max = 1ull << qs.size();
-
-    std::vector<size_t> chunks;
-
+    double sum = 0.;
+#pragma omp parallel reduction(+ : sum)
     {
-#pragma omp single
-        chunks = split_interval_in_chunks(max, omp_get_num_threads());
-        int thread_id = omp_get_thread_num();
-        if (thread_id < chunks.size() - 1)
+        std::size_t start, end;
+        detail::thread_range(qubitswfn.size(), start, end);
+        if (start < end)
         {
-            std::size_t start = chunks[thread_id];
             bititerator it(start, pivot_position, qs);
-            for (std::size_t i = start; i < chunks[thread_id + 1]; ++i, ++it)
+            for (std::size_t i = start; i < end; ++i, ++it)
             {
                 qubitswfn[i] = wfn[it.b];
+                sum += std::norm(qubitswfn[i]);
             }
         }
     }
+    return std::sqrt(sum);
 }
 
-template <class T, class A1, class A2, class A3>
-bool istensorproduct(
-    std::vector<T, A1> const& wfn,
-    std::vector<unsigned> const& qs1,
-    std::vector<T, A2> const& wfn1,
-    std::vector<unsigned> const& qs2,
-    std::vector<T, A3> const& wfn2,
-    T phase,
-    double tolerance)
+// Returns the 2-norm of the amplitudes of the basis states that agree with pivot_position on all qubits but qs.
+template <class T, class A>
+double subsytemnrm2_by_pivot(std::vector<T, A> const& wfn, std::vector<unsigned> const& qs, std::size_t pivot_position)
 {
-
-    const unsigned bit_size = sizeof(std::size_t) * 8;
-    assert(wfn.size() == wfn1.size() * wfn2.size());
-
-    assert(wfn1.size() == 1ull << qs1.size());
-    assert(wfn2.size() == 1ull << qs2.size());
-
-    assert(qs2 == complement(qs1, static_cast<unsigned>(qs1.size() + qs2.size())));
-    assert(qs1 == complement(qs2, static_cast<unsigned>(qs1.size() + qs2.size())));
-
-    std::vector<size_t> chunks = split_interval_in_chunks(wfn1.size(), 1);
-
-    double tol_squared = tolerance * tolerance;
-
-    std::bitset<bit_size> compl_bits(0);
-    for (unsigned i : qs2)
+    double sum = 0.;
+#pragma omp parallel reduction(+ : sum)
     {
-        compl_bits.set(i);
+        std::size_t start, end;
+        detail::thread_range(1ull << qs.size(), start, end);
+        if (start < end)
+        {
+            bititerator it(start, pivot_position, qs);
+            for (std::size_t i = start; i < end; ++i, ++it)
+                sum += std::norm(wfn[it.b]);
+        }
     }
-    std::size_t compl_st = compl_bits.to_ullong();
+    return std::sqrt(sum);
+}
+
+// Checks that wfn is the tensor product of its slices through pivot_position along the qubits in qs1_mask and along
+// the remaining qubits, that is wfn[x] = scale * wfn[x on qs1, pivot elsewhere] * wfn[pivot on qs1, x elsewhere]
+// for all x, up to the given tolerance. The threads stop as soon as one of them finds a witness of entanglement.
+template <class T, class A>
+bool istensorproduct(
+    std::vector<T, A> const& wfn,
+    std::size_t qs1_mask,
+    std::size_t pivot_position,
+    T scale,
+    double tolerance)
+{
+    const double tol_squared = tolerance * tolerance;
+    const std::size_t pivot1 = pivot_position & ~qs1_mask;
+    const std::size_t pivot2 = pivot_position & qs1_mask;
+    // the flag is polled once per block to keep the inner loop free of shared memory accesses
+    const std::size_t block = 1ull << 12;
 
     std::atomic<bool> go(true);
+#pragma omp parallel
     {
-        int thread_id = omp_get_thread_num();
-        if (thread_id < chunks.size() - 1)
+        std::size_t start, end;
+        detail::thread_range(wfn.size(), start, end);
+        for (std::size_t b = start; b < end && go.load(std::memory_order_relaxed); b += block)
         {
-            std::size_t st = chunks[thread_id];
-            bititerator it_compl(st, compl_st, qs1);
-            bititerator it(st, 0, qs1);
-            bititerator it_inner(0, qs2);
-            for (std::size_t i = st; i < chunks[thread_id + 1] && go; ++i, ++it, ++it_compl)
+            const std::size_t block_end = std::min(end, b + block);
+            bool separable = true;
+            for (std::size_t x = b; x < block_end; ++x)
             {
-                it_inner.b = it.b;
-                it_inner.mask_values = it_compl.b;
-                T val = phase * wfn1[i];
-                for (std::size_t i_inner = 0; i_inner < wfn2.size() && go; ++i_inner, ++it_inner)
-                {
-                    if (std::norm(val * wfn2[i_inner] - wfn[it_inner.b]) > tol_squared)
-                    {
-                        go = false;
-                    }
-                }
+                T val = scale * wfn[(x & qs1_mask) | pivot1] * wfn[(x & ~qs1_mask) | pivot2];
+                separable &= !(std::norm(val - wfn[x]) > tol_squared);
             }
+            if (!separable) go.store(false, std::memory_order_relaxed);
         }
     }
 
@@ -469,6 +759,7 @@ bool istensorproduct(
 
 // Extracts wave function for a given subset of qubits. Returns true and writes wave-function into
 // qubitswfn if given subset of qubits and its complement are in separable state.
+// Apart from qubitswfn, which is provided by the caller, no storage proportional to the size of the state is needed.
 template <class T, class A1, class A2>
 bool subsytemwavefunction(
     std::vector<T, A1> const& wfn,
@@ -476,8 +767,6 @@ bool subsytemwavefunction(
     std::vector<T, A2>& qubitswfn,
     double tolerance)
 {
-    const unsigned bit_size = sizeof(std::size_t) * 8;
-
     assert(qubitswfn.size() == 1ull << qs.size());
     assert(tolerance > 0.0);
 
@@ -489,30 +778,27 @@ bool subsytemwavefunction(
     T pivot = wfn[pivot_position];
     T pivot_phase = std::conj(pivot / std::abs(pivot));
 
-    subsytemwavefunction_by_pivot(wfn, sorted, qubitswfn, pivot_position);
-    normalize(qubitswfn);
+    double nrm1 = subsytemwavefunction_by_pivot(wfn, sorted, qubitswfn, pivot_position);
 
     unsigned total_qubits = ilog2(wfn.size());
 
     if (total_qubits > sorted.size())
     {
-        std::vector<unsigned> qs_rest = complement(sorted, total_qubits);
-        std::vector<T, A1> qubitswfn_rest(1ull << (qs_rest.size()));
-        assert(qubitswfn_rest.size() * qubitswfn.size() == wfn.size());
-        subsytemwavefunction_by_pivot(wfn, qs_rest, qubitswfn_rest, pivot_position);
-        normalize(qubitswfn_rest);
-
-        // it remains to check that we indeed have a tensor product
-        if (sorted.size() > qs_rest.size())
-        {
-            if (!istensorproduct(wfn, sorted, qubitswfn, qs_rest, qubitswfn_rest, pivot_phase, tolerance)) return false;
-        }
-        else
-        {
-            if (!istensorproduct(wfn, qs_rest, qubitswfn_rest, sorted, qubitswfn, pivot_phase, tolerance)) return false;
-        }
+        // it remains to check that we indeed have a tensor product; the amplitudes of the complement are read from
+        // the state directly instead of being extracted
+        std::size_t mask = 0;
+        for (unsigned q : sorted)
+            mask |= 1ull << q;
+        double nrm2 = subsytemnrm2_by_pivot(wfn, complement(sorted, total_qubits), pivot_position);
+        if (!istensorproduct(wfn, mask, pivot_position, pivot_phase / static_cast<T>(nrm1 * nrm2), tolerance))
+            return false;
     }
 
+    T scale = 1. / nrm1;
+#pragma omp parallel for schedule(static)
+    for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(qubitswfn.size()); ++i)
+        qubitswfn[i] *= scale;
+
     // put back to original sorting:
     for (unsigned i = 0; i < qs.size(); ++i)
     {
@@ -532,6 +818,283 @@ bool subsytemwavefunction(
 
     return true;
 }
+
+namespace detail
+{
+// e^(sign 2 pi i a / 2^bits) for 0 <= a < 2^bits, computed from two tables of about 2^(bits/2) entries each
+class twiddles
+{
+  public:
+    twiddles(unsigned bits, double sign)
+        : low_bits_((bits + 1) / 2)
+        , low_(1ull << low_bits_)
+        , high_(1ull << (bits - low_bits_))
+    {
+        const double angle = sign * 2. * std::acos(-1.) / std::ldexp(1., bits);
+        for (std::size_t a = 0; a < low_.size(); ++a)
+            low_[a] = std::polar(1., angle * a);
+        for (std::size_t a = 0; a < high_.size(); ++a)
+            high_[a] = std::polar(1., angle * static_cast<double>(a << low_bits_));
+    }
+
+    std::complex<double> operator()(std::size_t a) const
+    {
+        return low_[a & (low_.size() - 1)] * high_[a >> low_bits_];
+    }
+
+  private:
+    unsigned low_bits_;
+    std::vector<std::complex<double>> low_;
+    std::vector<std::complex<double>> high_;
+};
+
+// the bits of x at the positions qs, as a number (qs[i] becomes bit i)
+inline std::size_t extract_bits(std::size_t x, std::vector<unsigned> const& qs, unsigned num_bits)
+{
+    std::size_t r = 0;
+    for (unsigned l = 0; l < num_bits; ++l)
+        r |= ((x >> qs[l]) & 1ull) << l;
+    return r;
+}
+
+// the inverse of extract_bits: bit i of r at position qs[i]
+inline std::size_t deposit_bits(std::size_t r, std::vector<unsigned> const& qs)
+{
+    std::size_t x = 0;
+    for (unsigned l = 0; l < qs.size(); ++l)
+        x |= ((r >> l) & 1ull) << qs[l];
+    return x;
+}
+
+inline std::size_t reverse_bits(std::size_t r, unsigned num_bits)
+{
+    std::size_t rr = 0;
+    for (unsigned l = 0; l < num_bits; ++l)
+        rr |= ((r >> l) & 1ull) << (num_bits - 1 - l);
+    return rr;
+}
+} // namespace detail
+
+// Writes the reduced density matrix of the qubits at the positions qs, rho(r, c) = sum_x psi(r, x) conj(psi(c, x)), into
+// the row-major 2^k x 2^k matrix rho, where psi(r, x) is the amplitude with bit i of r at position qs[i] and the bits of
+// x at the other positions. This is rho = Psi Psi^dagger for the 2^k x 2^(n-k) matrix Psi, which is processed in panels
+// of consecutive columns x: a panel is gathered row by row (for a fixed r the amplitudes of consecutive x are mostly
+// adjacent in the state) and every entry of the upper triangle gets the dot product of two panel rows. Small matrices
+// are accumulated by every thread over its share of the columns into a partial matrix, and the partial matrices are
+// added at the end. Larger matrices (k > 8) would make the partial matrices too big, so the threads share the panels and
+// split the rows of rho instead.
+template <class T, class A>
+void reduced_density_matrix(
+    std::vector<std::complex<T>, A> const& wfn,
+    std::vector<unsigned> const& qs,
+    std::vector<std::complex<double>>& rho)
+{
+    const std::size_t dim = std::size_t(1) << qs.size();
+    const std::size_t rest = wfn.size() >> qs.size();
+    const std::size_t width = std::min<std::size_t>(64, rest);
+    std::vector<unsigned> sorted(qs);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<std::size_t> offsets(dim);
+    for (std::size_t r = 0; r < dim; ++r)
+        offsets[r] = detail::deposit_bits(r, qs);
+
+    // the indices of psi(0, x) for x = x0, ..., x0 + count - 1
+    auto columns = [&sorted](std::size_t x0, std::size_t count, std::size_t* bases) {
+        for (std::size_t j = 0; j < count; ++j)
+        {
+            std::size_t base = x0 + j;
+            for (unsigned p : sorted)
+                base = ((base >> p) << (p + 1)) | (base & ((1ull << p) - 1));
+            bases[j] = base;
+        }
+    };
+    auto gather = [&wfn, &offsets, width](std::size_t r, std::size_t const* bases, std::size_t count,
+                                          std::complex<double>* panel) {
+        for (std::size_t j = 0; j < count; ++j)
+            panel[r * width + j] = wfn[bases[j] | offsets[r]];
+    };
+    // psi(r, .) psi(c, .)^dagger over the panel
+    auto entry = [width](std::complex<double> const* panel, std::size_t r, std::size_t c, std::size_t count) {
+        return std::conj(detail::sum_conj_product(&panel[r * width], &panel[c * width], count));
+    };
+
+    rho.assign(dim * dim, 0.);
+    if (dim <= 256)
+    {
+#pragma omp parallel
+        {
+            std::vector<std::complex<double>> partial(dim * dim, 0.), panel(dim * width);
+            std::vector<std::size_t> bases(width);
+            std::size_t start, end;
+            detail::thread_range(rest, start, end);
+            for (std::size_t x0 = start; x0 < end; x0 += width)
+            {
+                const std::size_t count = std::min(width, end - x0);
+                columns(x0, count, bases.data());
+                for (std::size_t r = 0; r < dim; ++r)
+                    gather(r, bases.data(), count, panel.data());
+                for (std::size_t r = 0; r < dim; ++r)
+                    for (std::size_t c = r; c < dim; ++c)
+                        partial[r * dim + c] += entry(panel.data(), r, c, count);
+            }
+#pragma omp critical
+            for (std::size_t i = 0; i < partial.size(); ++i)
+                rho[i] += partial[i];
+        }
+    }
+    else
+    {
+        std::vector<std::complex<double>> panel(dim * width);
+        std::vector<std::size_t> bases(width);
+        for (std::size_t x0 = 0; x0 < rest; x0 += width)
+        {
+            const std::size_t count = std::min(width, rest - x0);
+            columns(x0, count, bases.data());
+#pragma omp parallel for schedule(static)
+            for (std::intptr_t r = 0; r < static_cast<std::intptr_t>(dim); ++r)
+                gather(static_cast<std::size_t>(r), bases.data(), count, panel.data());
+            // the rows of the upper triangle get shorter, hence the dynamic schedule
+#pragma omp parallel for schedule(dynamic, 16)
+            for (std::intptr_t r = 0; r < static_cast<std::intptr_t>(dim); ++r)
+                for (std::size_t c = static_cast<std::size_t>(r); c < dim; ++c)
+                    rho[r * dim + c] += entry(panel.data(), static_cast<std::size_t>(r), c, count);
+        }
+    }
+    for (std::size_t r = 0; r < dim; ++r)
+        for (std::size_t c = 0; c < r; ++c)
+            rho[r * dim + c] = std::conj(rho[c * dim + r]);
+}
+
+// Applies the quantum Fourier transform |x> -> 2^(-k/2) sum_y e^(2 pi i x y / 2^k) |y> (or its adjoint, with the
+// opposite sign) to the register of the k qubits at the positions qs, where qs[i] is bit i of x and y.
+// The transform is a radix-2 decimation-in-frequency FFT along every column of the state (the 2^k amplitudes that
+// only differ on the register). If there are enough columns to keep all threads busy and a column fits into the cache,
+// the columns are transformed independently in per-thread buffers, which costs a single sweep over the state.
+// Otherwise the butterfly stages are applied in cache-sized blocks of qubits, a sweep per block, followed by a sweep
+// for the bit reversal.
+template <class T, class A>
+void qft(std::vector<T, A>& wfn, std::vector<unsigned> const& qs, bool adjoint)
+{
+    const unsigned k = static_cast<unsigned>(qs.size());
+    if (k == 0) return;
+    const std::size_t dim = 1ull << k;
+    const std::size_t columns = wfn.size() / dim;
+    const detail::twiddles w(k, adjoint ? -1. : 1.);
+    const T scale = static_cast<T>(1. / std::sqrt(static_cast<double>(dim)));
+
+    if (columns >= 2 * static_cast<std::size_t>(omp_get_max_threads()) && k <= 16)
+    {
+        std::vector<unsigned> rest = complement(qs, ilog2(wfn.size()));
+        std::vector<std::size_t> offsets(dim), reversed_offsets(dim);
+        for (std::size_t r = 0; r < dim; ++r)
+        {
+            offsets[r] = detail::deposit_bits(r, qs);
+            reversed_offsets[r] = detail::deposit_bits(detail::reverse_bits(r, k), qs);
+        }
+
+#pragma omp parallel
+        {
+            std::vector<T> column(dim);
+#pragma omp for schedule(static)
+            for (std::intptr_t c = 0; c < static_cast<std::intptr_t>(columns); ++c)
+            {
+                const std::size_t base = detail::deposit_bits(c, rest);
+                // gather in bit-reversed order, so the in-place stages below leave the result in natural order
+                for (std::size_t r = 0; r < dim; ++r)
+                    column[r] = wfn[base | reversed_offsets[r]];
+
+                // decimation in time: stage s combines transforms of size m into transforms of size 2 m
+                for (std::size_t m = 1, s = 0; m < dim; m <<= 1, ++s)
+                {
+                    for (std::size_t b = 0; b < dim; b += 2 * m)
+                    {
+                        for (std::size_t j = 0; j < m; ++j)
+                        {
+                            T u = column[b + j];
+                            T v = column[b + j + m] * static_cast<T>(w(j << (k - 1 - s)));
+                            column[b + j] = u + v;
+                            column[b + j + m] = u - v;
+                        }
+                    }
+                }
+
+                for (std::size_t r = 0; r < dim; ++r)
+                    wfn[base | offsets[r]] = column[r] * scale;
+            }
+        }
+    }
+    else
+    {
+        // Decimation in frequency: stage s pairs the amplitudes that differ on qubit qs[s], starting with the highest,
+        // and its twiddle factor only depends on the register bits below s. The stages are applied in blocks of up to
+        // max_block qubits qs[lo], ..., qs[hi - 1]: the amplitudes that only differ on these qubits are gathered into a
+        // per-thread buffer that fits into the cache, go through the stages hi - 1, ..., lo there (with the register
+        // bits below lo fixed), and are written back. A register of k qubits thus takes ceil(k / max_block) sweeps.
+        const unsigned max_block = 12;
+        const unsigned blocks = (k + max_block - 1) / max_block;
+        const unsigned n = ilog2(wfn.size());
+        for (unsigned b = blocks; b-- > 0;)
+        {
+            const unsigned lo = b * k / blocks, hi = (b + 1) * k / blocks, width = hi - lo;
+            const std::vector<unsigned> block(qs.begin() + lo, qs.begin() + hi);
+            const std::vector<unsigned> rest = complement(block, n);
+            const std::size_t size = 1ull << width;
+            std::vector<std::size_t> offsets(size);
+            for (std::size_t r = 0; r < size; ++r)
+                offsets[r] = detail::deposit_bits(r, block);
+
+#pragma omp parallel
+            {
+                std::vector<T> buffer(size);
+#pragma omp for schedule(static)
+                for (std::intptr_t g = 0; g < static_cast<std::intptr_t>(wfn.size() >> width); ++g)
+                {
+                    const std::size_t base = detail::deposit_bits(g, rest);
+                    const std::size_t low = detail::extract_bits(base, qs, lo);
+                    for (std::size_t r = 0; r < size; ++r)
+                        buffer[r] = wfn[base | offsets[r]];
+
+                    for (unsigned t = width; t-- > 0;)
+                    {
+                        const unsigned s = lo + t;
+                        const std::size_t m = 1ull << t;
+                        for (std::size_t c = 0; c < size; c += 2 * m)
+                        {
+                            for (std::size_t j = 0; j < m; ++j)
+                            {
+                                T u = buffer[c + j];
+                                T v = buffer[c + j + m];
+                                buffer[c + j] = u + v;
+                                buffer[c + j + m] = (u - v) * static_cast<T>(w((low | (j << lo)) << (k - 1 - s)));
+                            }
+                        }
+                    }
+
+                    for (std::size_t r = 0; r < size; ++r)
+                        wfn[base | offsets[r]] = buffer[r];
+                }
+            }
+        }
+
+        // the result is in bit-reversed order on the register
+        const std::size_t qmask = make_mask(qs);
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn.size()); ++i)
+        {
+            const std::size_t r = detail::extract_bits(i, qs, k);
+            const std::size_t rr = detail::reverse_bits(r, k);
+            if (r < rr)
+            {
+                const std::size_t i2 = (i & ~qmask) | detail::deposit_bits(rr, qs);
+                T tmp = wfn[i];
+                wfn[i] = wfn[i2] * scale;
+                wfn[i2] = tmp * scale;
+            }
+            else if (r == rr)
+                wfn[i] *= scale;
+        }
+    }
+}
 } // namespace kernels
 } // namespace SIMULATOR
 } // namespace Quantum
@@ -3,14 +3,23 @@
 
 #include "catch.hpp"
 
+#include "simulator/gradients.hpp"
 #include "simulator/simulator.hpp"
+#include "simulator/trajectories.hpp"
 #include "util/bititerator.hpp"
 #include "util/bitops.hpp"
+#include "util/philox.hpp"
+#include "util/tracing.hpp"
 
 #include <bitset>
 #include <chrono>
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <thread>
 
+using namespace Microsoft::Quantum;
 using namespace Microsoft::Quantum::SIMULATOR;
 
 TEST_CASE("test_exp", "[local_test]")
@@ -182,6 +191,59 @@ TEST_CASE("Logical vs positional qubit ids", "[local_test]")
     REQUIRE(psi.num_qubits() == 0);
 }
 
+// The wave function tracks which qubits are known to be classical as the gates arrive; the tracked values must always
+// agree with a scan of the state.
+TEST_CASE("Tracking of classical qubits", "[local_test]")
+{
+    using namespace Microsoft::Quantum::SIMULATOR::kernels;
+    Wavefunction<ComplexType> psi;
+    psi.seed(11);
+    const unsigned n = 5;
+    for (unsigned i = 0; i < n; ++i)
+        psi.allocate_qubit();
+
+    std::mt19937 gen(5);
+    std::uniform_int_distribution<unsigned> qubit(0, n - 1), kind(0, 7);
+    for (unsigned step = 0; step < 300; ++step)
+    {
+        const unsigned q = qubit(gen);
+        const unsigned c = (q + 1 + qubit(gen) % (n - 1)) % n;
+        switch (kind(gen))
+        {
+        case 0:
+            psi.apply(Gates::X(q));
+            break;
+        case 1:
+            psi.apply_controlled(c, Gates::X(q));
+            break;
+        case 2:
+            psi.apply_controlled(c, Gates::Y(q));
+            break;
+        case 3:
+            psi.apply(Gates::S(q));
+            break;
+        case 4:
+            psi.apply_controlled(c, Gates::T(q));
+            break;
+        case 5:
+            if (step % 3 == 0) psi.apply(Gates::H(q));
+            break;
+        case 6:
+            psi.apply(Gates::R(Gates::PauliY, 0.4, q));
+            break;
+        default:
+            psi.measure(q);
+        }
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            const bool classical = isclassical(psi.data(), psi.get_qubit_position(i));
+            REQUIRE(psi.isclassical(i) == classical);
+            if (classical) REQUIRE(psi.getvalue(i) == (getvalue(psi.data(), psi.get_qubit_position(i)) == 1));
+        }
+    }
+}
+
 TEST_CASE("Clustering", "[local_test]")
 {
     TinyMatrix<ComplexType, 2> ignore;
@@ -966,3 +1028,338 @@ TEST_CASE("test_extract_qubits_state", "[local_test]")
     test_extract_qubits_cat_state(6, {0, 1, 3}, {0, 1});
     test_extract_qubits_cat_state(10, {0, 5}, {5, 6});
 }
+
+#ifndef _WIN32
+TEST_CASE("State vector in a memory-mapped file", "[local_test]")
+{
+    Microsoft::Quantum::MappedStorage& storage = Microsoft::Quantum::MappedStorage::instance();
+    storage.configure(std::filesystem::temp_directory_path().string(), 1024);
+
+    SimulatorType sim;
+    auto qs = sim.allocate(8);
+    CHECK(storage.is_mapped(sim.data()));
+
+    sim.H(qs[0]);
+    for (unsigned i = 1; i < qs.size(); ++i)
+        sim.CX(qs[i - 1], qs[i]);
+    bool m = sim.M(qs[0]);
+    for (auto q : qs)
+        CHECK(sim.M(q) == m);
+    for (auto q : qs)
+        if (m) sim.X(q);
+    sim.release(qs);
+
+    storage.configure("", 0);
+    SimulatorType sim2;
+    auto q = sim2.allocate(8);
+    CHECK_FALSE(storage.is_mapped(sim2.data()));
+    sim2.release(q);
+}
+#endif
+
+TEST_CASE("Collapse with and without compaction", "[local_test]")
+{
+    using namespace Microsoft::Quantum::SIMULATOR::kernels;
+    const unsigned n = 5;
+    for (unsigned q = 0; q < n; ++q)
+    {
+        for (bool val : {false, true})
+        {
+            WavefunctionStorage wfn(1ull << n);
+            for (std::size_t i = 0; i < wfn.size(); ++i)
+                wfn[i] = ComplexType(double(i), -double(i));
+
+            WavefunctionStorage zeroed(wfn);
+            collapse(zeroed, q, val, false, 0.5);
+            collapse(wfn, q, val, true, 0.5);
+            REQUIRE(wfn.size() == (1ull << (n - 1)));
+
+            const std::size_t low = (1ull << q) - 1;
+            for (std::size_t i = 0; i < zeroed.size(); ++i)
+            {
+                const bool bit = (i >> q) & 1;
+                if (bit != val)
+                    CHECK(zeroed[i] == ComplexType(0.));
+                else
+                {
+                    CHECK(zeroed[i] == ComplexType(0.5 * i, -0.5 * i));
+                    // the compacted state drops bit q from the index
+                    CHECK(wfn[(i & low) | ((i >> 1) & ~low)] == zeroed[i]);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Compaction of several qubits", "[local_test]")
+{
+    using namespace Microsoft::Quantum::SIMULATOR::kernels;
+    const unsigned n = 7;
+    for (std::vector<unsigned> ps : {std::vector<unsigned>{0, 3}, {2, 5, 6}, {6}, {1, 2, 4}})
+    {
+        for (std::size_t values = 0; values < (1ull << ps.size()); ++values)
+        {
+            WavefunctionStorage wfn(1ull << n);
+            for (std::size_t i = 0; i < wfn.size(); ++i)
+                wfn[i] = ComplexType(double(i), 1.);
+
+            std::vector<ComplexType> expected;
+            for (std::size_t i = 0; i < wfn.size(); ++i)
+            {
+                bool match = true;
+                for (std::size_t k = 0; k < ps.size(); ++k)
+                    match = match && (((i >> ps[k]) & 1) == ((values >> k) & 1));
+                if (match) expected.push_back(wfn[i]);
+            }
+
+            compact(wfn, ps, values);
+            REQUIRE(wfn.size() == expected.size());
+            for (std::size_t i = 0; i < wfn.size(); ++i)
+                CHECK(wfn[i] == expected[i]);
+        }
+    }
+}
+
+TEST_CASE("Probability and norm reductions", "[local_test]")
+{
+    using namespace Microsoft::Quantum::SIMULATOR::kernels;
+    const unsigned n = 9;
+    WavefunctionStorage wfn(1ull << n);
+    std::mt19937 gen(17);
+    std::normal_distribution<double> normal;
+    for (auto& a : wfn)
+        a = ComplexType(normal(gen), normal(gen));
+    normalize(wfn);
+    REQUIRE(nrm2(wfn) == Approx(1.).epsilon(1e-14));
+
+    for (unsigned q = 0; q < n; ++q)
+    {
+        double expected = 0.;
+        for (std::size_t i = 0; i < wfn.size(); ++i)
+            if ((i >> q) & 1) expected += std::norm(wfn[i]);
+        double prob0, prob1;
+        probabilities(wfn, q, prob0, prob1);
+        CHECK(probability(wfn, q) == Approx(expected).epsilon(1e-13));
+        CHECK(prob1 == Approx(expected).epsilon(1e-13));
+        CHECK(prob0 == Approx(1. - expected).epsilon(1e-13));
+        CHECK_FALSE(isclassical(wfn, q));
+
+        std::vector<unsigned> qs = {q, (q + 3) % n};
+        if (qs[0] == qs[1]) qs.pop_back();
+        double parity = 0.;
+        for (std::size_t i = 0; i < wfn.size(); ++i)
+            if (Microsoft::Quantum::poppar(i & make_mask(qs))) parity += std::norm(wfn[i]);
+        CHECK(jointprobability(wfn, qs) == Approx(parity).epsilon(1e-13));
+    }
+
+    collapse(wfn, 4, true, false, 1. / std::sqrt(probability(wfn, 4)));
+    CHECK(isclassical(wfn, 4));
+    CHECK(probability(wfn, 4) == Approx(1.).epsilon(1e-13));
+}
+
+TEST_CASE("Noisy trajectories", "[local_test]")
+{
+    using namespace Microsoft::Quantum::Simulator;
+    SimulatorType sim;
+    sim.allocateQubit(0);
+    sim.allocateQubit(1);
+
+    {
+        // a certain bit flip after X
+        NoiseModel noise;
+        noise.set(Operation::X, NoiseChannel::pauli(1., 0., 0.));
+        TrajectoryEngine engine({Operation::gate(Operation::X, 0), Operation::measurement(0)}, noise);
+        for (auto const& r : engine.run(sim, 20, 1))
+        {
+            REQUIRE(r.size() == 1);
+            CHECK_FALSE(r[0]);
+        }
+    }
+
+    {
+        // full and half amplitude damping after X
+        for (double gamma : {1., 0.5})
+        {
+            NoiseModel noise;
+            noise.set(Operation::X, NoiseChannel::amplitude_damping(gamma));
+            TrajectoryEngine engine(
+                {Operation::gate(Operation::X, 0), Operation::gate(Operation::H, 1), Operation::measurement(0)}, noise);
+            unsigned ones = 0;
+            const unsigned n = 400;
+            for (auto const& r : engine.run(sim, n, 7))
+                ones += r[0];
+            if (gamma == 1.)
+                CHECK(ones == 0);
+            else
+                CHECK(std::abs(double(ones) / n - 0.5) < 0.1);
+        }
+    }
+
+    {
+        // the outcomes only depend on the seed, not on the number of concurrent trajectories
+        NoiseModel noise;
+        noise.set(Operation::H, NoiseChannel::pauli(0.1, 0.1, 0.1));
+        noise.set(Operation::M, NoiseChannel::pauli(0.05, 0., 0.));
+        Circuit circuit = {
+            Operation::gate(Operation::H, 0), Operation::gate(Operation::X, 1, {0}), Operation::measurement(0),
+            Operation::rotation(Gates::PauliY, 0.3, 1), Operation::measurement(1)};
+        TrajectoryEngine engine(circuit, noise);
+        engine.set_concurrency(1);
+        auto serial = engine.run(sim, 50, 3);
+        engine.set_concurrency(3);
+        std::vector<unsigned> seen(50, 0);
+        auto concurrent = engine.run(sim, 50, 3, [&seen](unsigned t, SimulatorInterface& state, std::vector<bool> const&) {
+            seen[t] = state.num_qubits();
+        });
+        CHECK(serial == concurrent);
+        for (unsigned s : seen)
+            CHECK(s == 2);
+    }
+    CHECK(sim.M(0) == false);
+}
+
+TEST_CASE("Adjoint gradients", "[local_test]")
+{
+    using namespace Microsoft::Quantum::Simulator;
+    SimulatorType sim;
+    for (unsigned q = 0; q < 3; ++q)
+        sim.allocateQubit(q);
+
+    {
+        // <Z> after Ry(theta) is cos(theta)
+        GradientEngine engine({Operation::rotation(Gates::PauliY, 0., 0)});
+        engine.bind(0, 0);
+        std::vector<double> gradient;
+        CHECK(engine.gradient(sim, {0.7}, {{1., {Gates::PauliZ}, {0}}}, gradient) == Approx(std::cos(0.7)));
+        REQUIRE(gradient.size() == 1);
+        CHECK(gradient[0] == Approx(-std::sin(0.7)));
+    }
+
+    // controlled rotations, a shared parameter, a controlled phase and a fixed offset, against central differences
+    Circuit circuit = {
+        Operation::gate(Operation::H, 0),
+        Operation::rotation(Gates::PauliY, 0., 1),
+        Operation::gate(Operation::X, 2, {0}),
+        Operation::rotation(Gates::PauliZ, 0.2, 2),
+        Operation::rotation(Gates::PauliX, 0., 1, {0}),
+        Operation::gate(Operation::T, 1),
+        Operation::rotation(Gates::PauliI, 0., 0, {2}),
+        Operation::rotation(Gates::PauliY, 0., 0, {1, 2}),
+        Operation::gate(Operation::H, 2),
+        Operation::rotation(Gates::PauliX, 0., 2)};
+    GradientEngine engine(circuit);
+    engine.bind(1, 0);
+    engine.bind(3, 1);
+    engine.bind(4, 2);
+    engine.bind(6, 1, 0.5);
+    engine.bind(7, 3);
+    engine.bind(9, 0, -2.);
+    CHECK(engine.num_parameters() == 4);
+    CHECK_THROWS(engine.bind(0, 0));
+
+    const Observable h = {
+        {0.5, {Gates::PauliZ, Gates::PauliZ}, {0, 1}},
+        {0.3, {Gates::PauliX}, {2}},
+        {-0.7, {Gates::PauliY, Gates::PauliY}, {1, 2}},
+        {0.4, {Gates::PauliX, Gates::PauliY, Gates::PauliZ}, {0, 1, 2}},
+        {0.2, {}, {}}};
+    const std::vector<double> theta = {0.3, -1.1, 0.8, 2.0};
+    std::vector<double> gradient;
+    const double value = engine.gradient(sim, theta, h, gradient);
+    CHECK(value == Approx(engine.expectation(sim, theta, h)).epsilon(1e-12));
+
+    // the expectation from the Pauli sum agrees with the joint probabilities of the terms
+    {
+        const double shift[] = {0., theta[0], 0., theta[1], theta[2], 0., 0.5 * theta[1], theta[3], 0., -2. * theta[0]};
+        std::unique_ptr<SimulatorInterface> psi(sim.clone());
+        for (std::size_t j = 0; j < circuit.size(); ++j)
+        {
+            Operation op = circuit[j];
+            op.angle += shift[j];
+            apply(*psi, op);
+        }
+        double expected = 0.2;
+        for (std::size_t k = 0; k + 1 < h.size(); ++k)
+            expected += h[k].coefficient * (1. - 2. * psi->JointEnsembleProbability(h[k].bases, h[k].qubits));
+        CHECK(value == Approx(expected).epsilon(1e-10));
+    }
+
+    REQUIRE(gradient.size() == theta.size());
+    const double step = 1e-5;
+    for (std::size_t p = 0; p < theta.size(); ++p)
+    {
+        std::vector<double> plus = theta, minus = theta;
+        plus[p] += step;
+        minus[p] -= step;
+        const double difference = (engine.expectation(sim, plus, h) - engine.expectation(sim, minus, h)) / (2. * step);
+        CHECK(gradient[p] == Approx(difference).margin(1e-7));
+    }
+
+    // the initial state stays unchanged
+    CHECK(sim.M(0) == false);
+    CHECK_THROWS(GradientEngine({Operation::measurement(0)}));
+}
+
+TEST_CASE("Counter-based random numbers", "[local_test]")
+{
+    using Microsoft::Quantum::Philox4x32;
+
+    // known answers of Philox4x32-10 from the Random123 distribution
+    CHECK(Philox4x32::block({0, 0}, {0, 0, 0, 0}) == Philox4x32::Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8});
+    CHECK(
+        Philox4x32::block({0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}) ==
+        Philox4x32::Block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd});
+    CHECK(
+        Philox4x32::block({0xa4093822, 0x299f31d0}, {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}) ==
+        Philox4x32::Block{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1});
+
+    // skipping ahead and copying continue the same sequence, other streams differ
+    Philox4x32 rng(42, 7);
+    std::vector<Philox4x32::result_type> sequence(23);
+    for (auto& x : sequence)
+        x = rng();
+    for (unsigned skip = 0; skip < 10; ++skip)
+    {
+        Philox4x32 ahead(42, 7);
+        ahead();
+        ahead.discard(skip);
+        Philox4x32 copy = ahead;
+        for (std::size_t i = skip + 1; i < sequence.size(); ++i)
+        {
+            CHECK(ahead() == sequence[i]);
+            CHECK(copy() == sequence[i]);
+        }
+        CHECK(ahead == copy);
+    }
+    Philox4x32 other(42, 8);
+    CHECK(other() != sequence[0]);
+
+    double sum = 0.;
+    for (int i = 0; i < 10000; ++i)
+    {
+        const double u = rng.uniform();
+        REQUIRE((u >= 0. && u < 1.));
+        sum += u;
+    }
+    CHECK(std::abs(sum / 10000 - 0.5) < 0.02);
+}
+
+TEST_CASE("Trace buffers of exited threads", "[local_test]")
+{
+    TraceRecorder& recorder = TraceRecorder::instance();
+    const std::string path = (std::filesystem::temp_directory_path() / "qdk_sim_trace_test.json").string();
+    recorder.start(path, 16);
+    const std::size_t before = recorder.buffers();
+
+    std::thread([] { TraceScope scope("worker"); }).join();
+    CHECK(recorder.buffers() == before + 1);
+
+    // the worker's events are still written, then its buffer is freed
+    REQUIRE(recorder.stop());
+    std::ifstream in(path);
+    const std::string trace((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    CHECK(trace.find("\"worker\"") != std::string::npos);
+    CHECK(recorder.buffers() == before);
+    in.close();
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// Counters of the work done by a simulator on its state vector, to see where the time of a job goes: how well the
+/// gates fuse, why the gate cache is flushed and how long the kernels take.
+struct PerfCounters
+{
+    enum FlushReason : unsigned
+    {
+        StateAccess,   // an operation needed the up to date state (measurement, probability, dump, ...)
+        GateCacheFull, // the gate cache reached its limit
+        NumFlushReasons
+    };
+
+    enum KernelFamily : unsigned
+    {
+        Fused,       // the fused gate kernels
+        Measurement, // probabilities and collapse of measurements
+        Reduction,   // probabilities and classical checks without a measurement
+        Dump,        // copying the state out
+        Other,       // exponentials, diagonals, QFT, permutations, state injection, release
+        NumKernelFamilies
+    };
+
+    static constexpr unsigned MaxFusedSpan = 7;
+
+    std::uint64_t gates_queued = 0;
+    std::uint64_t clusters = 0;
+    std::uint64_t fused_span[MaxFusedSpan + 1] = {}; // number of fused matrices by the number of qubits they act on
+    std::uint64_t flushes[NumFlushReasons] = {};      // flushes with gates to apply
+    std::uint64_t calls[NumKernelFamilies] = {};
+    double seconds[NumKernelFamilies] = {};
+    double bytes[NumKernelFamilies] = {}; // bytes of the state read or written, counting every sweep
+
+    void reset()
+    {
+        *this = PerfCounters();
+    }
+
+    /// Calls f(name, value) for every counter.
+    template <class F>
+    void visit(F&& f) const
+    {
+        static const char* const reasons[NumFlushReasons] = {"state_access", "gate_cache_full"};
+        static const char* const families[NumKernelFamilies] = {"fused", "measurement", "reduction", "dump", "other"};
+        std::string name;
+        f("gates_queued", static_cast<double>(gates_queued));
+        f("clusters", static_cast<double>(clusters));
+        for (unsigned s = 1; s <= MaxFusedSpan; ++s)
+        {
+            name = "fused_span_" + std::to_string(s);
+            f(name.c_str(), static_cast<double>(fused_span[s]));
+        }
+        for (unsigned r = 0; r < NumFlushReasons; ++r)
+        {
+            name = std::string("flushes_") + reasons[r];
+            f(name.c_str(), static_cast<double>(flushes[r]));
+        }
+        for (unsigned k = 0; k < NumKernelFamilies; ++k)
+        {
+            name = std::string(families[k]) + "_calls";
+            f(name.c_str(), static_cast<double>(calls[k]));
+            name = std::string(families[k]) + "_seconds";
+            f(name.c_str(), seconds[k]);
+            name = std::string(families[k]) + "_bytes";
+            f(name.c_str(), bytes[k]);
+        }
+    }
+};
+
+/// Adds the wall time of its scope, and the given number of bytes, to a kernel family.
+class KernelTimer
+{
+  public:
+    KernelTimer(PerfCounters& counters, PerfCounters::KernelFamily family, double bytes)
+        : counters_(counters)
+        , family_(family)
+        , start_(std::chrono::steady_clock::now())
+    {
+        ++counters_.calls[family_];
+        counters_.bytes[family_] += bytes;
+    }
+
+    KernelTimer(KernelTimer const&) = delete;
+    KernelTimer& operator=(KernelTimer const&) = delete;
+
+    ~KernelTimer()
+    {
+        counters_.seconds[family_] +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+  private:
+    PerfCounters& counters_;
+    PerfCounters::KernelFamily family_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace Quantum
+} // namespace Microsoft
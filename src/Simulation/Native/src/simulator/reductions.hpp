@@ -0,0 +1,232 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "config.hpp"
+#include "util/openmp.hpp"
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+
+#ifdef HAVE_INTRINSICS
+#include <immintrin.h>
+#endif
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace SIMULATOR
+{
+namespace kernels
+{
+/// Building blocks of the reductions over the state (norms, probabilities). The generic versions are plain loops; the
+/// flavours built with intrinsics get AVX and AVX-512 versions for double precision. All sums use Kahan compensation:
+/// the summands are squared magnitudes and thus positive, so the compensation captures the low-order bits that every
+/// addition to a large running sum loses.
+namespace detail
+{
+// Bounds of the share of [0, size) that is processed by the calling thread of a parallel region.
+inline void thread_range(std::size_t size, std::size_t& start, std::size_t& end)
+{
+    const std::size_t nthreads = static_cast<std::size_t>(omp_get_num_threads());
+    const std::size_t thread_id = static_cast<std::size_t>(omp_get_thread_num());
+    const std::size_t chunk = size / nthreads, rest = size % nthreads;
+    start = thread_id * chunk + std::min(thread_id, rest);
+    end = start + chunk + (thread_id < rest ? 1 : 0);
+}
+
+// Calls f(i, len) for the runs of consecutive basis states with qubit q = 0 whose index among all such states falls into
+// [begin, end). The corresponding states with qubit q = 1 are the runs starting at i + 2^q.
+template <class F>
+inline void for_each_run(std::size_t begin, std::size_t end, unsigned q, F&& f)
+{
+    const std::size_t offset = 1ull << q;
+    for (std::size_t l = begin; l < end;)
+    {
+        const std::size_t d = l & (offset - 1);
+        const std::size_t len = std::min(end - l, offset - d);
+        f(((l - d) << 1) + d, len);
+        l += len;
+    }
+}
+
+// sum of the squared magnitudes of a[0], ..., a[n - 1]
+template <class T>
+inline double sum_norm(std::complex<T> const* a, std::size_t n)
+{
+    double s = 0.;
+    double c = 0.;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        double y = std::norm(a[i]) - c;
+        double t = s + y;
+        c = (t - s) - y;
+        s = t;
+    }
+    return s;
+}
+
+// sums of the squared magnitudes of a[0], a[2], ..., a[2 n - 2] and of a[1], a[3], ..., a[2 n - 1]
+template <class T>
+inline void sum_norm_pairs(std::complex<T> const* a, std::size_t n, double& even, double& odd)
+{
+    double s[2] = {0., 0.};
+    double c[2] = {0., 0.};
+    for (std::size_t i = 0; i < 2 * n; ++i)
+    {
+        double y = std::norm(a[i]) - c[i & 1];
+        double t = s[i & 1] + y;
+        c[i & 1] = (t - s[i & 1]) - y;
+        s[i & 1] = t;
+    }
+    even = s[0];
+    odd = s[1];
+}
+
+// sum of conj(a[i]) * b[i] for i < n (not compensated: the summands have both signs)
+template <class T>
+inline std::complex<double> sum_conj_product(std::complex<T> const* a, std::complex<T> const* b, std::size_t n)
+{
+    double re = 0., im = 0.;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        re += static_cast<double>(a[i].real()) * b[i].real() + static_cast<double>(a[i].imag()) * b[i].imag();
+        im += static_cast<double>(a[i].real()) * b[i].imag() - static_cast<double>(a[i].imag()) * b[i].real();
+    }
+    return {re, im};
+}
+
+// largest squared magnitude of a[0], ..., a[n - 1] (0 if n = 0)
+template <class T>
+inline double max_norm(std::complex<T> const* a, std::size_t n)
+{
+    double m = 0.;
+    for (std::size_t i = 0; i < n; ++i)
+        m = std::max(m, static_cast<double>(std::norm(a[i])));
+    return m;
+}
+
+#ifdef HAVE_INTRINSICS
+inline double sum_norm(std::complex<double> const* a, std::size_t n)
+{
+    const double* x = reinterpret_cast<const double*>(a);
+    const std::size_t m = 2 * n;
+    std::size_t i = 0;
+    double sum;
+#ifdef HAVE_AVX512
+    __m512d s = _mm512_setzero_pd();
+    __m512d c = _mm512_setzero_pd();
+    for (; i + 8 <= m; i += 8)
+    {
+        __m512d v = _mm512_loadu_pd(x + i);
+        __m512d y = _mm512_sub_pd(_mm512_mul_pd(v, v), c);
+        __m512d t = _mm512_add_pd(s, y);
+        c = _mm512_sub_pd(_mm512_sub_pd(t, s), y);
+        s = t;
+    }
+    sum = _mm512_reduce_add_pd(_mm512_sub_pd(s, c));
+#else
+    __m256d s = _mm256_setzero_pd();
+    __m256d c = _mm256_setzero_pd();
+    for (; i + 4 <= m; i += 4)
+    {
+        __m256d v = _mm256_loadu_pd(x + i);
+        __m256d y = _mm256_sub_pd(_mm256_mul_pd(v, v), c);
+        __m256d t = _mm256_add_pd(s, y);
+        c = _mm256_sub_pd(_mm256_sub_pd(t, s), y);
+        s = t;
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_sub_pd(s, c));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < m; ++i)
+        sum += x[i] * x[i];
+    return sum;
+}
+
+inline void sum_norm_pairs(std::complex<double> const* a, std::size_t n, double& even, double& odd)
+{
+    // every load holds one even and one odd amplitude: (re even, im even, re odd, im odd)
+    const double* x = reinterpret_cast<const double*>(a);
+    __m256d s = _mm256_setzero_pd();
+    __m256d c = _mm256_setzero_pd();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        __m256d v = _mm256_loadu_pd(x + 4 * i);
+        __m256d y = _mm256_sub_pd(_mm256_mul_pd(v, v), c);
+        __m256d t = _mm256_add_pd(s, y);
+        c = _mm256_sub_pd(_mm256_sub_pd(t, s), y);
+        s = t;
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, _mm256_sub_pd(s, c));
+    even = lanes[0] + lanes[1];
+    odd = lanes[2] + lanes[3];
+}
+
+inline std::complex<double> sum_conj_product(std::complex<double> const* a, std::complex<double> const* b, std::size_t n)
+{
+    // re accumulates (ar br, ai bi), im accumulates (ar bi, ai br) of every amplitude
+    const double* x = reinterpret_cast<const double*>(a);
+    const double* y = reinterpret_cast<const double*>(b);
+    __m256d re = _mm256_setzero_pd();
+    __m256d im = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m256d u = _mm256_loadu_pd(x + 2 * i);
+        __m256d v = _mm256_loadu_pd(y + 2 * i);
+        re = _mm256_add_pd(re, _mm256_mul_pd(u, v));
+        im = _mm256_add_pd(im, _mm256_mul_pd(u, _mm256_permute_pd(v, 0x5)));
+    }
+    alignas(32) double r[4], s[4];
+    _mm256_store_pd(r, re);
+    _mm256_store_pd(s, im);
+    std::complex<double> sum((r[0] + r[1]) + (r[2] + r[3]), (s[0] - s[1]) + (s[2] - s[3]));
+    for (; i < n; ++i)
+        sum += std::conj(a[i]) * b[i];
+    return sum;
+}
+
+inline double max_norm(std::complex<double> const* a, std::size_t n)
+{
+    const double* x = reinterpret_cast<const double*>(a);
+    const std::size_t m = 2 * n;
+    std::size_t i = 0;
+    double result;
+#ifdef HAVE_AVX512
+    __m512d mx = _mm512_setzero_pd();
+    for (; i + 8 <= m; i += 8)
+    {
+        __m512d v = _mm512_loadu_pd(x + i);
+        __m512d sq = _mm512_mul_pd(v, v);
+        // adds the squares of the real and imaginary part of every amplitude
+        mx = _mm512_max_pd(mx, _mm512_add_pd(sq, _mm512_permute_pd(sq, 0x55)));
+    }
+    result = _mm512_reduce_max_pd(mx);
+#else
+    __m256d mx = _mm256_setzero_pd();
+    for (; i + 4 <= m; i += 4)
+    {
+        __m256d v = _mm256_loadu_pd(x + i);
+        __m256d sq = _mm256_mul_pd(v, v);
+        mx = _mm256_max_pd(mx, _mm256_hadd_pd(sq, sq));
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, mx);
+    result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < m; i += 2)
+        result = std::max(result, x[i] * x[i] + x[i + 1] * x[i + 1]);
+    return result;
+}
+#endif
+} // namespace detail
+} // namespace kernels
+} // namespace SIMULATOR
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,723 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "config.hpp"
+#include "gates.hpp"
+#include "simulatorinterface.hpp"
+#include "util/openmp.hpp"
+#include "util/shardgroup.hpp"
+#include "wavefunction.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <utility>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace SIMULATOR
+{
+
+/// A state vector split across the 2^g processes of a ShardGroup by its high-order qubits: each process holds the
+/// amplitudes of the basis states whose g global qubits have the bits of its rank, as a local state of up to `maxlocal`
+/// qubits. New qubits are local while there is room, then take the global slots. Gates on local qubits run locally,
+/// with the gate fusion of the wave function; a global control only decides whether a process applies the gate, and a
+/// diagonal gate on a global qubit is a phase of the whole chunk. Any other gate on a global qubit first swaps it with
+/// the least recently used local qubit, by exchanging half of the chunk with the partner process through the shared
+/// memory, so that runs of gates on the same qubits exchange once. Measurements reduce the probabilities over the
+/// processes, which draw the same outcomes from random number engines seeded alike.
+///
+/// All processes run the same program: every call has to be made by all of them, in the same order and with the same
+/// arguments, and the results are the same on all of them. A global slot without a qubit means the qubit is |0>: the
+/// processes whose rank has that bit set hold zeros.
+template <class WFN>
+class ShardedSimulator : public Microsoft::Quantum::Simulator::SimulatorInterface
+{
+  public:
+    using WaveFunctionType = WFN;
+
+    ShardedSimulator(std::string const& session, unsigned rank, unsigned processes, unsigned maxlocal)
+        : group_(session, rank, processes, window_bytes(processes, maxlocal))
+        , maxlocal_(maxlocal)
+    {
+        while ((1u << slots_.size()) < processes)
+            slots_.push_back(free_slot);
+        start();
+    }
+
+    std::size_t random(std::size_t n, double* d) override
+    {
+        recursive_lock_type l(getmutex());
+        std::vector<double> cdf(d, d + n);
+        std::partial_sum(cdf.begin(), cdf.end(), cdf.begin());
+        if (n == 0 || !(cdf.back() > 0.)) throw std::runtime_error("random_choice needs a positive weight");
+
+        const double x = psi_.rng().uniform() * cdf.back();
+        auto i = std::upper_bound(cdf.begin(), cdf.end(), x) - cdf.begin();
+        // x can round up to the total
+        if (i == static_cast<std::ptrdiff_t>(n))
+            while (d[--i] <= 0.)
+            {
+            }
+        return static_cast<std::size_t>(i);
+    }
+
+    double JointEnsembleProbability(std::vector<Gates::Basis> bs, std::vector<logical_qubit_id> qs) override
+    {
+        removeIdentities(bs, qs);
+        if (bs.empty()) return 0.;
+
+        recursive_lock_type l(getmutex());
+        changebasis(bs, qs, true);
+        double p[2];
+        std::vector<positional_qubit_id> ps;
+        probabilities(qs, p, ps);
+        changebasis(bs, qs, false);
+        return p[1];
+    }
+
+    bool InjectState(const std::vector<logical_qubit_id>&, const std::vector<ComplexType>&) override
+    {
+        throw std::runtime_error("this simulator does not support injecting states");
+    }
+
+    // allocate and release
+
+    void allocateQubit(logical_qubit_id q) override
+    {
+        recursive_lock_type l(getmutex());
+        if (q < qubits_.size() && qubits_[q].allocated)
+            throw std::runtime_error("qubit " + std::to_string(q) + " is already allocated");
+        if (q >= qubits_.size())
+        {
+            qubits_.resize(q + 1);
+            last_use_.resize(q + 1, 0);
+        }
+
+        if (psi_.num_qubits() < maxlocal_)
+            qubits_[q] = Placement{true, false, psi_.allocate_qubit()};
+        else
+        {
+            auto slot = std::find(slots_.begin(), slots_.end(), free_slot);
+            if (slot == slots_.end())
+                throw std::runtime_error(
+                    "the processes of the sharded simulator hold at most " +
+                    std::to_string(maxlocal_ + slots_.size()) + " qubits");
+            *slot = q;
+            qubits_[q] = Placement{true, true, static_cast<unsigned>(slot - slots_.begin())};
+        }
+        touch(q);
+    }
+
+    bool release(logical_qubit_id q) override
+    {
+        recursive_lock_type l(getmutex());
+        check({q});
+
+        // the qubit is measured unless it's classical, like in Simulator::release
+        double p[2];
+        std::vector<positional_qubit_id> ps;
+        probabilities({q}, p, ps);
+        const double eps = 100. * std::numeric_limits<double>::epsilon();
+        bool value = p[0] < eps;
+        const bool allok = !value && p[1] < eps;
+        if (!allok && !value) value = measure({q});
+
+        Placement& placement = qubits_[q];
+        if (placement.global)
+            free_slot_of(placement.index, value);
+        else
+            psi_.release(placement.index, value);
+        placement.allocated = false;
+        return allok;
+    }
+
+    unsigned num_qubits() const override
+    {
+        recursive_lock_type l(getmutex());
+        return static_cast<unsigned>(
+            std::count_if(qubits_.begin(), qubits_.end(), [](Placement const& p) { return p.allocated; }));
+    }
+
+    // the settings and counters are those of the local state of this process
+
+    void GetPerfCounters(void (*callback)(const char*, double)) override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.perf_counters().visit(callback);
+    }
+
+    void ResetPerfCounters() override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.perf_counters().reset();
+    }
+
+    void SetShrinkThreshold(unsigned slack) override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.set_shrink_threshold(slack);
+    }
+
+    void SetMemoryBudget(std::size_t bytes) override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.set_memory_budget(bytes);
+    }
+
+    // the shared memory isn't counted, it is small next to the local state
+    void MemoryFootprint(std::size_t& current, std::size_t& peak) override
+    {
+        recursive_lock_type l(getmutex());
+        current = psi_.footprint();
+        peak = psi_.peak_footprint();
+    }
+
+    void SetAsyncFlush(bool enable) override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.set_async_flush(enable);
+    }
+
+    // single-qubit gates
+
+#define GATE1IMPL(OP)                                                                                                  \
+    void OP(logical_qubit_id q) override                                                                               \
+    {                                                                                                                  \
+        recursive_lock_type l(getmutex());                                                                             \
+        apply_gate({}, q, [](logical_qubit_id id) { return Gates::OP(id); });                                          \
+    }
+#define GATE1MCIMPL(OP)                                                                                                \
+    void C##OP(std::vector<logical_qubit_id> const& c, logical_qubit_id q) override                                    \
+    {                                                                                                                  \
+        recursive_lock_type l(getmutex());                                                                             \
+        apply_gate(c, q, [](logical_qubit_id id) { return Gates::OP(id); });                                           \
+    }
+#define GATE1(OP) GATE1IMPL(OP) GATE1MCIMPL(OP)
+
+    GATE1(X)
+    GATE1(Y)
+    GATE1(Z)
+    GATE1(H)
+    GATE1(T)
+    GATE1(S)
+    GATE1(AdjT)
+    GATE1(AdjS)
+
+#undef GATE1
+#undef GATE1IMPL
+#undef GATE1MCIMPL
+
+    // rotations
+    void R(Gates::Basis b, double phi, logical_qubit_id q) override
+    {
+        recursive_lock_type l(getmutex());
+        apply_gate({}, q, [b, phi](logical_qubit_id id) { return Gates::R(b, phi, id); });
+    }
+
+    void CR(Gates::Basis b, double phi, std::vector<logical_qubit_id> const& c, logical_qubit_id q) override
+    {
+        recursive_lock_type l(getmutex());
+        apply_gate(c, q, [b, phi](logical_qubit_id id) { return Gates::R(b, phi, id); });
+    }
+
+    // Exponential of Pauli operators
+    void CExp(
+        std::vector<Gates::Basis> bs,
+        double phi,
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> qs) override
+    {
+        if (bs.size() == 0) return;
+
+        logical_qubit_id somequbit = qs.front();
+        removeIdentities(bs, qs);
+
+        recursive_lock_type l(getmutex());
+        if (bs.size() == 0)
+            CR(Gates::PauliI, -2. * phi, cs, somequbit);
+        else if (bs.size() == 1)
+            CR(bs.front(), -2. * phi, cs, qs.front());
+        else
+        {
+            std::vector<logical_qubit_id> local_cs;
+            if (prepare(cs, qs, local_cs)) psi_.apply_controlled_exp(bs, phi, local_cs, local_ids(qs));
+        }
+    }
+
+    // dense and diagonal unitaries
+    void ApplyControlledMatrix(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& matrix) override
+    {
+        if (qs.size() > 7) throw std::runtime_error("dense matrices can act on at most 7 qubits");
+        if (matrix.size() != (1ull << (2 * qs.size()))) throw std::runtime_error("the matrix has the wrong size");
+        recursive_lock_type l(getmutex());
+        std::vector<logical_qubit_id> local_cs;
+        if (prepare(cs, qs, local_cs)) psi_.apply_controlled_matrix(local_cs, local_ids(qs), matrix);
+    }
+
+    void ApplyControlledDiagonal(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& diagonal) override
+    {
+        if (diagonal.size() != (1ull << qs.size())) throw std::runtime_error("the diagonal has the wrong size");
+        recursive_lock_type l(getmutex());
+        std::vector<logical_qubit_id> local_cs;
+        if (prepare(cs, qs, local_cs)) psi_.apply_controlled_diagonal(local_cs, local_ids(qs), diagonal);
+    }
+
+    // measurements
+
+    bool M(logical_qubit_id q) override
+    {
+        recursive_lock_type l(getmutex());
+        check({q});
+        return measure({q});
+    }
+
+    bool Measure(std::vector<Gates::Basis> bs, std::vector<logical_qubit_id> qs) override
+    {
+        recursive_lock_type l(getmutex());
+        removeIdentities(bs, qs);
+        check(qs);
+        changebasis(bs, qs, true);
+        bool res = measure(qs);
+        changebasis(bs, qs, false);
+        return res;
+    }
+
+    // The seed of rank 0 is used by all processes.
+    void seed(unsigned s) override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.seed(static_cast<unsigned>(group_.broadcast(s)));
+    }
+
+    void reset() override
+    {
+        recursive_lock_type l(getmutex());
+        psi_.reset();
+        qubits_.clear();
+        last_use_.clear();
+        std::fill(slots_.begin(), slots_.end(), free_slot);
+        start();
+    }
+
+    ComplexType const* data() const override
+    {
+        throw std::runtime_error("this simulator holds its state in several processes, use DumpToBuffer instead");
+    }
+
+    // Bit k of the indices refers to the k-th allocated qubit in the order of the logical ids, see dumpIds. The
+    // amplitudes of all processes are gathered on each of them, keeping the `n` with the lowest indices.
+    std::size_t dump(std::size_t n, double* re, double* im, std::size_t* indices, double threshold) override
+    {
+        recursive_lock_type l(getmutex());
+        struct Entry
+        {
+            std::uint64_t index;
+            double re;
+            double im;
+        };
+
+        // the bits of the index of the local positions and of this rank
+        std::vector<std::size_t> local_bits(psi_.num_qubits(), 0);
+        std::size_t rank_bits = 0;
+        unsigned k = 0;
+        for (Placement const& p : qubits_)
+        {
+            if (!p.allocated) continue;
+            if (!p.global)
+                local_bits[psi_.get_qubit_position(p.index)] = std::size_t(1) << k;
+            else if (bit(p.index))
+                rank_bits |= std::size_t(1) << k;
+            ++k;
+        }
+
+        // a rank that has the bit of a free slot set holds zeros, which are no basis states
+        std::vector<Entry> mine;
+        if (!holds_zeros())
+        {
+            auto const& wfn = psi_.data();
+            for (std::size_t i = 0; i < wfn.size(); ++i)
+            {
+                if (threshold >= 0. && !(std::norm(wfn[i]) > threshold)) continue;
+                std::size_t index = rank_bits;
+                for (std::size_t p = 0; p < local_bits.size(); ++p)
+                    if ((i >> p) & 1) index |= local_bits[p];
+                mine.push_back(Entry{index, static_cast<double>(wfn[i].real()), static_cast<double>(wfn[i].imag())});
+            }
+        }
+
+        const double count = static_cast<double>(mine.size());
+        std::vector<double> counts(group_.processes());
+        group_.gather(&count, 1, counts.data());
+
+        auto by_index = [](Entry const& a, Entry const& b) { return a.index < b.index; };
+        const std::size_t per_round = group_.window_bytes() / sizeof(Entry);
+        std::vector<Entry> kept;
+        std::size_t total = 0;
+        for (unsigned r = 0; r < group_.processes(); ++r)
+        {
+            Entry* window = static_cast<Entry*>(group_.window(r));
+            const std::size_t m = static_cast<std::size_t>(counts[r]);
+            total += m;
+            for (std::size_t begin = 0; begin < m; begin += per_round)
+            {
+                const std::size_t len = std::min(per_round, m - begin);
+                if (r == group_.rank()) std::copy(mine.begin() + begin, mine.begin() + begin + len, window);
+                group_.barrier();
+                kept.insert(kept.end(), window, window + len);
+                group_.barrier();
+                if (kept.size() > 2 * n + per_round)
+                {
+                    std::nth_element(kept.begin(), kept.begin() + n, kept.end(), by_index);
+                    kept.resize(n);
+                }
+            }
+        }
+
+        std::sort(kept.begin(), kept.end(), by_index);
+        for (std::size_t i = 0; i < std::min(n, kept.size()); ++i)
+        {
+            re[i] = kept[i].re;
+            im[i] = kept[i].im;
+            if (indices != nullptr) indices[i] = static_cast<std::size_t>(kept[i].index);
+        }
+        return total;
+    }
+
+    void dump(bool (*)(const char*, double, double)) override
+    {
+        throw std::runtime_error("this simulator only dumps its state to buffers");
+    }
+
+    void dump(TDumpToLocationCallback, TDumpLocation) override
+    {
+        throw std::runtime_error("this simulator only dumps its state to buffers");
+    }
+
+    bool dumpQubits(std::vector<logical_qubit_id> const&, bool (*)(const char*, double, double)) override
+    {
+        throw std::runtime_error("this simulator only dumps its state to buffers");
+    }
+
+    bool dumpQubits(std::vector<logical_qubit_id> const&, TDumpToLocationCallback, TDumpLocation) override
+    {
+        throw std::runtime_error("this simulator only dumps its state to buffers");
+    }
+
+    void dumpIds(void (*callback)(logical_qubit_id)) override
+    {
+        recursive_lock_type l(getmutex());
+        for (logical_qubit_id q = 0; q < qubits_.size(); ++q)
+            if (qubits_[q].allocated) callback(q);
+    }
+
+  private:
+    static constexpr logical_qubit_id free_slot = std::numeric_limits<logical_qubit_id>::max();
+
+    // where a logical qubit is: the id of a qubit of the local state, or a global slot (a bit of the rank)
+    struct Placement
+    {
+        bool allocated = false;
+        bool global = false;
+        unsigned index = 0;
+    };
+
+    // Checks the arguments before the shared memory is set up. The exchange window holds half a local state, but no
+    // more than 2^20 amplitudes; larger exchanges take several rounds.
+    static std::size_t window_bytes(unsigned processes, unsigned maxlocal)
+    {
+        if (processes == 0 || (processes & (processes - 1)) != 0)
+            throw std::runtime_error("the number of processes of a sharded simulator must be a power of two");
+        if (maxlocal == 0 || maxlocal > 40) throw std::runtime_error("a sharded simulator needs 1 to 40 local qubits");
+        return (std::size_t(1) << std::min(maxlocal - 1, 20u)) * sizeof(ComplexType);
+    }
+
+    // Ranks other than 0 start with zeros, all ranks with the seed of rank 0.
+    void start()
+    {
+        if (group_.rank() != 0) psi_.modify_state([](WavefunctionStorage& wfn) { wfn[0] = 0.; });
+        psi_.seed(static_cast<unsigned>(group_.broadcast(psi_.rng()())));
+    }
+
+    bool bit(unsigned slot) const
+    {
+        return ((group_.rank() >> slot) & 1) != 0;
+    }
+
+    bool holds_zeros() const
+    {
+        for (unsigned b = 0; b < slots_.size(); ++b)
+            if (slots_[b] == free_slot && bit(b)) return true;
+        return false;
+    }
+
+    void check(std::vector<logical_qubit_id> const& qs) const
+    {
+        for (logical_qubit_id q : qs)
+            if (q >= qubits_.size() || !qubits_[q].allocated)
+                throw std::runtime_error("qubit " + std::to_string(q) + " is not allocated");
+    }
+
+    void touch(logical_qubit_id q)
+    {
+        last_use_[q] = ++clock_;
+    }
+
+    std::vector<logical_qubit_id> local_ids(std::vector<logical_qubit_id> const& qs) const
+    {
+        std::vector<logical_qubit_id> ids;
+        for (logical_qubit_id q : qs)
+            ids.push_back(qubits_[q].index);
+        return ids;
+    }
+
+    // Makes the targets `qs` local and sets `local_cs` to the local controls. Returns false if a global control is 0 on
+    // this rank, which then leaves its chunk as it is.
+    bool prepare(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<logical_qubit_id>& local_cs)
+    {
+        check(cs);
+        check(qs);
+        localize(qs, cs);
+        for (logical_qubit_id q : qs)
+            touch(q);
+        for (logical_qubit_id c : cs)
+        {
+            touch(c);
+            if (!qubits_[c].global)
+                local_cs.push_back(qubits_[c].index);
+            else if (!bit(qubits_[c].index))
+                return false;
+        }
+        return true;
+    }
+
+    // A diagonal gate on a global qubit multiplies the chunk by one of its entries; any other gate needs the qubit to
+    // be local.
+    template <class MakeGate>
+    void apply_gate(std::vector<logical_qubit_id> const& cs, logical_qubit_id q, MakeGate make)
+    {
+        const TinyMatrix<ComplexType, 2> m = make(q).matrix();
+        const bool diagonal = std::norm(m(0, 1)) == 0 && std::norm(m(1, 0)) == 0;
+        check({q});
+        const bool global = diagonal && qubits_[q].global;
+
+        std::vector<logical_qubit_id> local_cs;
+        if (!prepare(cs, global ? std::vector<logical_qubit_id>{} : std::vector<logical_qubit_id>{q}, local_cs)) return;
+        touch(q);
+        if (global)
+        {
+            const unsigned b = bit(qubits_[q].index) ? 1 : 0;
+            phase(local_cs, m(b, b));
+        }
+        else if (local_cs.empty())
+            psi_.apply(make(qubits_[q].index));
+        else
+            psi_.apply_controlled(local_cs, make(qubits_[q].index));
+    }
+
+    // multiplies the amplitudes of the chunk whose local controls are 1 by `d`
+    void phase(std::vector<logical_qubit_id> local_cs, ComplexType d)
+    {
+        if (d == ComplexType(1.)) return;
+        if (!local_cs.empty())
+        {
+            const logical_qubit_id c = local_cs.back();
+            local_cs.pop_back();
+            psi_.apply_controlled_matrix(local_cs, {c}, {1., 0., 0., d});
+        }
+        else if (psi_.num_qubits() > 0)
+            psi_.apply_controlled_matrix({}, {psi_.get_qubit_ids().front()}, {d, 0., 0., d});
+        else
+            psi_.modify_state([d](WavefunctionStorage& wfn) { wfn[0] *= d; });
+    }
+
+    // Swaps the global ones of the qubits `qs` with the least recently used local qubits, preferring those that are
+    // neither in `qs` nor in `avoid`. If all local qubits are in `qs`, a new local qubit is allocated and swapped out,
+    // after which its slot is free.
+    void localize(std::vector<logical_qubit_id> const& qs, std::vector<logical_qubit_id> const& avoid)
+    {
+        for (logical_qubit_id q : qs)
+        {
+            if (!qubits_[q].global) continue;
+            const unsigned slot = qubits_[q].index;
+
+            logical_qubit_id victim = free_slot;
+            bool avoided = true;
+            for (logical_qubit_id v = 0; v < qubits_.size(); ++v)
+            {
+                Placement const& p = qubits_[v];
+                if (!p.allocated || p.global || std::find(qs.begin(), qs.end(), v) != qs.end()) continue;
+                const bool in_avoid = std::find(avoid.begin(), avoid.end(), v) != avoid.end();
+                if (victim == free_slot || (avoided && !in_avoid) ||
+                    (avoided == in_avoid && last_use_[v] < last_use_[victim]))
+                {
+                    victim = v;
+                    avoided = in_avoid;
+                }
+            }
+
+            logical_qubit_id local;
+            if (victim != free_slot)
+                local = qubits_[victim].index;
+            else if (psi_.num_qubits() < maxlocal_)
+                local = psi_.allocate_qubit();
+            else
+                throw std::runtime_error(
+                    "the operation acts on more qubits than the " + std::to_string(maxlocal_) + " local ones");
+
+            swap_with_slot(slot, psi_.get_qubit_position(local));
+            qubits_[q] = Placement{true, false, local};
+            slots_[slot] = victim;
+            if (victim != free_slot) qubits_[victim] = Placement{true, true, slot};
+        }
+    }
+
+    // Swaps the global qubit in `slot` with the local qubit at position p: the amplitudes in which the local qubit
+    // differs from the bit of the rank are exchanged with the partner rank, at the same local indices.
+    void swap_with_slot(unsigned slot, positional_qubit_id p)
+    {
+        const std::size_t low = (std::size_t(1) << p) - 1;
+        const std::size_t other = bit(slot) ? 0 : 1;
+        const std::size_t half = (std::size_t(1) << psi_.num_qubits()) / 2;
+        exchange(
+            slot, half, [low, other, p](std::size_t k) { return ((k & ~low) << 1) | (other << p) | (k & low); }, true,
+            true);
+    }
+
+    // Releases the global qubit in `slot` with the value `value`: the ranks whose bit differs from it must end up
+    // holding zeros, so with a value of 1 the chunks are moved to the partners.
+    void free_slot_of(unsigned slot, bool value)
+    {
+        if (value)
+            exchange(
+                slot, std::size_t(1) << psi_.num_qubits(), [](std::size_t k) { return k; }, bit(slot), !bit(slot));
+        else if (bit(slot))
+            psi_.modify_state([](WavefunctionStorage& wfn) { std::fill(wfn.begin(), wfn.end(), ComplexType(0.)); });
+        slots_[slot] = free_slot;
+    }
+
+    // Exchanges the `count` amplitudes at the local indices index(0), index(1), ... with the partner rank across
+    // `slot`, in rounds of a window each: the ranks that `send` write them to their window, and the ranks that
+    // `receive` replace them by those of the partner; a rank that only sends zeroes them. All ranks take part.
+    template <class Index>
+    void exchange(unsigned slot, std::size_t count, Index index, bool send, bool receive)
+    {
+        const std::size_t per_round = group_.window_bytes() / sizeof(ComplexType);
+        ComplexType* mine = static_cast<ComplexType*>(group_.window(group_.rank()));
+        ComplexType const* theirs = static_cast<ComplexType*>(group_.window(group_.rank() ^ (1u << slot)));
+        psi_.modify_state([&](WavefunctionStorage& wfn) {
+            for (std::size_t begin = 0; begin < count; begin += per_round)
+            {
+                const std::intptr_t n = static_cast<std::intptr_t>(std::min(per_round, count - begin));
+                if (send)
+                {
+#pragma omp parallel for schedule(static)
+                    for (std::intptr_t i = 0; i < n; ++i)
+                        mine[i] = wfn[index(begin + i)];
+                }
+                group_.barrier();
+                if (receive || send)
+                {
+#pragma omp parallel for schedule(static)
+                    for (std::intptr_t i = 0; i < n; ++i)
+                        wfn[index(begin + i)] = receive ? theirs[i] : ComplexType(0.);
+                }
+                group_.barrier();
+            }
+        });
+    }
+
+    // The probabilities p[0] and p[1] of an even and an odd parity of the qubits `qs`, over all ranks. `ps` is set to
+    // the positions of the local ones; the global ones add the parity of the bits of the rank.
+    bool probabilities(std::vector<logical_qubit_id> const& qs, double* p, std::vector<positional_qubit_id>& ps)
+    {
+        bool parity = false;
+        for (logical_qubit_id q : qs)
+        {
+            if (qubits_[q].global)
+                parity = parity != bit(qubits_[q].index);
+            else
+                ps.push_back(psi_.get_qubit_position(qubits_[q].index));
+        }
+        kernels::jointprobabilities(psi_.data(), ps, p[0], p[1]);
+        if (parity) std::swap(p[0], p[1]);
+        group_.sum(p, 2);
+        return parity;
+    }
+
+    // measures the parity of the qubits `qs`, drawn as in the wave function
+    bool measure(std::vector<logical_qubit_id> const& qs)
+    {
+        double p[2];
+        std::vector<positional_qubit_id> ps;
+        const bool parity = probabilities(qs, p, ps);
+        const bool result = (psi_.rng().uniform() < p[1]);
+        const double scale = 1. / std::sqrt(result ? p[1] : p[0]);
+        psi_.modify_state(
+            [&](WavefunctionStorage& wfn) { kernels::jointcollapse(wfn, ps, result != parity, scale); });
+        return result;
+    }
+
+    void changebasis(std::vector<Gates::Basis> const& bs, std::vector<logical_qubit_id> const& qs, bool back)
+    {
+        for (unsigned i = 0; i < bs.size(); ++i)
+        {
+            if (bs[i] == Gates::PauliX)
+                apply_gate({}, qs[i], [](logical_qubit_id id) { return Gates::H(id); });
+            else if (bs[i] == Gates::PauliY && back)
+                apply_gate({}, qs[i], [](logical_qubit_id id) { return Gates::AdjHY(id); });
+            else if (bs[i] == Gates::PauliY)
+                apply_gate({}, qs[i], [](logical_qubit_id id) { return Gates::HY(id); });
+        }
+    }
+
+    static void removeIdentities(std::vector<Gates::Basis>& b, std::vector<logical_qubit_id>& qs)
+    {
+        unsigned i = 0;
+        while (i != b.size())
+        {
+            if (b[i] == Gates::PauliI)
+            {
+                b.erase(b.begin() + i);
+                qs.erase(qs.begin() + i);
+            }
+            else
+                ++i;
+        }
+    }
+
+    ShardGroup group_;
+    unsigned maxlocal_;
+    WFN psi_;
+    std::vector<Placement> qubits_;                          // by logical id
+    std::vector<logical_qubit_id> slots_;                    // the qubit in each global slot, or free_slot
+    std::vector<std::uint64_t> last_use_;                    // by logical id, for choosing the qubits to swap out
+    std::uint64_t clock_ = 0;
+};
+
+using ShardedSimulatorType = ShardedSimulator<Wavefunction<ComplexType>>;
+
+MICROSOFT_QUANTUM_DECL Microsoft::Quantum::Simulator::SimulatorInterface* createShardedSimulator(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal);
+
+} // namespace SIMULATOR
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,215 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "simulator/capi.hpp"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Every rank of a sharded simulator runs the same circuit as a simulator of its own with the same seed, and checks
+// that both measure the same outcomes and hold the same state. The ranks are forked before any simulator exists.
+
+static std::vector<unsigned> ids;
+
+static void collect_id(unsigned id)
+{
+    ids.push_back(id);
+}
+
+static void check(bool condition, std::string const& what)
+{
+    if (!condition) throw std::runtime_error(what);
+}
+
+// the amplitudes of the state of `sid`, indexed by the values of `qubits`
+static std::vector<std::complex<double>> state(unsigned sid, std::vector<unsigned> const& qubits)
+{
+    ids.clear();
+    DumpIds(sid, collect_id);
+    const std::size_t size = std::size_t(1) << ids.size();
+    std::vector<double> re(size), im(size);
+    std::vector<std::size_t> indices(size);
+    check(DumpToBuffer(sid, size, re.data(), im.data(), indices.data(), -1.) == size, "the number of amplitudes");
+
+    std::vector<std::complex<double>> amplitudes(size);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        std::size_t index = 0;
+        for (std::size_t k = 0; k < ids.size(); ++k)
+        {
+            const std::size_t j = std::find(qubits.begin(), qubits.end(), ids[k]) - qubits.begin();
+            if ((indices[i] >> k) & 1) index |= std::size_t(1) << j;
+        }
+        amplitudes[index] = {re[i], im[i]};
+    }
+    return amplitudes;
+}
+
+static void compare(unsigned sim_id, unsigned ref_id, std::vector<unsigned> const& qubits, std::string const& where)
+{
+    check(num_qubits(sim_id) == num_qubits(ref_id), "the number of qubits " + where);
+    auto a = state(sim_id, qubits);
+    auto b = state(ref_id, qubits);
+    for (std::size_t i = 0; i < a.size(); ++i)
+        check(std::abs(a[i] - b[i]) < 1e-10, "amplitude " + std::to_string(i) + " " + where);
+}
+
+// The first qubits are local, the last log2(processes) are global, and gates on those swap them in and out.
+static void run(std::string const& session, unsigned rank, unsigned processes, unsigned maxlocal)
+{
+    unsigned global = 0;
+    while ((1u << global) < processes)
+        ++global;
+    const unsigned n = maxlocal + global;
+
+    auto sim_id = InitSharded(session.c_str(), rank, processes, maxlocal);
+    auto ref_id = init();
+    SetStabilizerMode(ref_id, false);
+    seed(sim_id, 4242);
+    seed(ref_id, 4242);
+
+    std::vector<unsigned> qubits;
+    for (unsigned q = 0; q < n; ++q)
+    {
+        qubits.push_back(q);
+        allocateQubit(sim_id, q);
+        allocateQubit(ref_id, q);
+    }
+
+    const unsigned last = n - 1;
+    for (unsigned sid : {sim_id, ref_id})
+    {
+        for (unsigned q = 0; q < n; ++q)
+        {
+            H(sid, q);
+            T(sid, q);
+        }
+        for (unsigned q = 1; q < n; ++q)
+        {
+            unsigned c = q - 1;
+            MCX(sid, 1, &c, q);
+        }
+        // controlled by a global qubit, diagonal on a global qubit, and a rotation that needs it locally
+        unsigned c = last;
+        MCY(sid, 1, &c, 0);
+        MCR(sid, 2, 0.3, 1, &c, last - 1);
+        c = 0;
+        MCZ(sid, 1, &c, last);
+        R(sid, 3, 0.7, last);
+        S(sid, last);
+
+        unsigned bs[] = {1, 3};
+        unsigned qs[] = {last, 1};
+        Exp(sid, 2, bs, 0.4, qs);
+        unsigned ps[] = {0, 2};
+        MCExp(sid, 2, ps, 0.5, 1, &c, qs);
+
+        // a two-qubit matrix on the last and the first qubit
+        double re[16] = {}, im[16] = {};
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            re[i * 4 + (i ^ 1)] = std::cos(0.2 * i);
+            im[i * 4 + (i ^ 1)] = std::sin(0.2 * i);
+        }
+        unsigned targets[] = {last, 0};
+        ApplyMatrix(sid, 2, targets, re, im, 0, nullptr);
+    }
+    compare(sim_id, ref_id, qubits, "after the gates");
+
+    int xz[] = {1, 3};
+    unsigned qs[] = {last, 0};
+    check(
+        std::abs(JointEnsembleProbability(sim_id, 2, xz, qs) - JointEnsembleProbability(ref_id, 2, xz, qs)) < 1e-10,
+        "the joint probability");
+
+    check(M(sim_id, last) == M(ref_id, last), "the outcome of M");
+    unsigned xx[] = {1, 1};
+    unsigned pair[] = {last - 1, 1};
+    check(Measure(sim_id, 2, xx, pair) == Measure(ref_id, 2, xx, pair), "the outcome of Measure");
+    compare(sim_id, ref_id, qubits, "after the measurements");
+
+    double weights[] = {0.1, 0., 0.5, 0.4};
+    for (int i = 0; i < 8; ++i)
+        check(random_choice(sim_id, 4, weights) == random_choice(ref_id, 4, weights), "random_choice");
+
+    // release two qubits (measured) and reuse them; the reference keeps the order of the qubits in its dumps, which
+    // follow the positions of the qubits but are labeled in the order of their ids, only for the last ids
+    for (unsigned q : {last, last - 1})
+    {
+        check(release(sim_id, q) == release(ref_id, q), "the result of release");
+        qubits.erase(std::find(qubits.begin(), qubits.end(), q));
+        compare(sim_id, ref_id, qubits, "after release");
+    }
+    for (unsigned q : {last - 1, last})
+    {
+        qubits.push_back(q);
+        allocateQubit(sim_id, q);
+        allocateQubit(ref_id, q);
+    }
+    for (unsigned sid : {sim_id, ref_id})
+    {
+        H(sid, last);
+        unsigned c = last;
+        MCX(sid, 1, &c, 0);
+        MCX(sid, 1, &c, last - 1);
+    }
+    compare(sim_id, ref_id, qubits, "after reallocating");
+
+    for (unsigned q = 0; q < n; ++q)
+        check(M(sim_id, q) == M(ref_id, q), "the outcome of M");
+    compare(sim_id, ref_id, qubits, "at the end");
+
+    destroy(ref_id);
+    destroy(sim_id);
+}
+
+// runs the ranks in child processes and returns the number of those that failed
+static int run_group(unsigned processes, unsigned maxlocal)
+{
+    std::cerr << "Testing " << processes << " processes with " << maxlocal << " local qubits\n";
+    const std::string session = "sharded_test_" + std::to_string(getpid()) + "_" + std::to_string(processes);
+    std::vector<pid_t> children;
+    for (unsigned rank = 0; rank < processes; ++rank)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int status = 0;
+            try
+            {
+                run(session, rank, processes, maxlocal);
+            }
+            catch (std::exception const& e)
+            {
+                std::cerr << "rank " << rank << ": " << e.what() << "\n";
+                status = 1;
+            }
+            _exit(status);
+        }
+        children.push_back(pid);
+    }
+
+    int failed = 0;
+    for (pid_t pid : children)
+    {
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ++failed;
+    }
+    return failed;
+}
+
+int main()
+{
+    int failed = run_group(1, 5);
+    failed += run_group(2, 3);
+    failed += run_group(4, 4);
+    if (failed != 0) std::cerr << failed << " ranks failed\n";
+    return failed == 0 ? 0 : 1;
+}
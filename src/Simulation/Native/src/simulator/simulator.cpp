@@ -1,6 +1,7 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the MIT License.
 
+#include "simulator/sharded.hpp"
 #include "simulator/simulator.hpp"
 
 namespace sim = Microsoft::Quantum::SIMULATOR;
@@ -9,3 +10,12 @@ MICROSOFT_QUANTUM_DECL Microsoft::Quantum::Simulator::SimulatorInterface* sim::c
 {
     return new sim::SimulatorType(maxlocal);
 }
+
+MICROSOFT_QUANTUM_DECL Microsoft::Quantum::Simulator::SimulatorInterface* sim::createShardedSimulator(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal)
+{
+    return new sim::ShardedSimulatorType(session, rank, processes, maxlocal);
+}
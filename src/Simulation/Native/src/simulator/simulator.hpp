@@ -6,11 +6,16 @@
 #include "config.hpp"
 #include "gates.hpp"
 #include "simulatorinterface.hpp"
+#include "stabilizer.hpp"
+#include "util/eigenvalues.hpp"
 #include "util/openmp.hpp"
 #include "wavefunction.hpp"
 
+#include <cstdlib>
+#include <functional>
 #include <map>
 #include <numeric>
+#include <utility>
 
 namespace Microsoft
 {
@@ -27,21 +32,37 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
 
     Simulator(unsigned maxlocal = 0u)
         : psi()
+        , stabilizer_mode_(stabilizer_enabled())
+        , stabilizer_(stabilizer_mode_)
     {
     }
 
     std::size_t random(std::vector<double> const& d)
     {
-        recursive_lock_type l(getmutex());
-        std::discrete_distribution<std::size_t> dist(d.begin(), d.end());
-        return dist(psi.rng());
+        return random(d.size(), const_cast<double*>(d.data()));
     }
 
+    // Draws i with probability d[i] / sum(d). The cumulative weights are kept for the next call, so repeated draws from
+    // the same distribution don't allocate.
     std::size_t random(std::size_t n, double* d)
     {
-        std::discrete_distribution<std::size_t> dist(d, d + n);
         recursive_lock_type l(getmutex());
-        return dist(psi.rng());
+        if (n != choice_weights_.size() || !std::equal(d, d + n, choice_weights_.begin()))
+        {
+            choice_weights_.assign(d, d + n);
+            choice_cdf_.resize(n);
+            std::partial_sum(d, d + n, choice_cdf_.begin());
+        }
+        if (n == 0 || !(choice_cdf_.back() > 0.)) throw std::runtime_error("random_choice needs a positive weight");
+
+        const double x = psi.rng().uniform() * choice_cdf_.back();
+        auto i = std::upper_bound(choice_cdf_.begin(), choice_cdf_.end(), x) - choice_cdf_.begin();
+        // x can round up to the total
+        if (i == static_cast<std::ptrdiff_t>(n))
+            while (d[--i] <= 0.)
+            {
+            }
+        return static_cast<std::size_t>(i);
     }
 
     double JointEnsembleProbability(std::vector<Gates::Basis> bs, std::vector<logical_qubit_id> qs)
@@ -54,7 +75,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
 
         recursive_lock_type l(getmutex());
         changebasis(bs, qs, true);
-        double p = psi.jointprobability(qs);
+        double p = stabilizer_ ? tableau_.jointprobability(qs) : psi.jointprobability(qs);
         changebasis(bs, qs, false);
         return p;
     }
@@ -62,12 +83,29 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     bool InjectState(const std::vector<logical_qubit_id>& qubits, const std::vector<ComplexType>& amplitudes)
     {
         recursive_lock_type l(getmutex());
+        densify();
         return psi.inject_state(qubits, amplitudes);
     }
 
+    bool InjectState(const std::vector<logical_qubit_id>& qubits, std::string const& path)
+    {
+        recursive_lock_type l(getmutex());
+        densify();
+        return psi.inject_state(qubits, path);
+    }
+
+    bool SaveState(std::string const& path)
+    {
+        recursive_lock_type l(getmutex());
+        densify();
+        return psi.save_state(path);
+    }
+
     bool isclassical(logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
+        bool value;
+        if (stabilizer_) return tableau_.deterministic(q, value);
         return psi.isclassical(q);
     }
 
@@ -75,6 +113,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     logical_qubit_id allocate()
     {
         recursive_lock_type l(getmutex());
+        if (stabilizer_) return tableau_.allocate();
         return psi.allocate_qubit();
     }
 
@@ -86,7 +125,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
 
         for (unsigned i = 0; i < n; ++i)
         {
-            qubits.push_back(psi.allocate_qubit());
+            qubits.push_back(stabilizer_ ? tableau_.allocate() : psi.allocate_qubit());
         }
         return qubits;
     }
@@ -94,19 +133,34 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     void allocateQubit(logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
-        psi.allocate_qubit(q);
+        if (stabilizer_)
+            tableau_.allocate(q);
+        else
+            psi.allocate_qubit(q);
     }
 
     void allocateQubit(std::vector<logical_qubit_id> const& qubits)
     {
         recursive_lock_type l(getmutex());
         for (auto q : qubits)
-            psi.allocate_qubit(q);
+            allocateQubit(q);
     }
 
     bool release(logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
+        if (stabilizer_)
+        {
+            bool value;
+            bool allok = tableau_.deterministic(q, value);
+            if (allok)
+                allok = (value == false);
+            else
+                M(q);
+            tableau_.release(q);
+            return allok;
+        }
+
         flush();
         bool allok = isclassical(q);
         if (allok)
@@ -117,33 +171,76 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
         return allok;
     }
 
-    bool release(std::vector<logical_qubit_id> const& qs)
+    bool release(std::vector<logical_qubit_id> const& qs) override
     {
         recursive_lock_type l(getmutex());
         bool allok = true;
+        if (stabilizer_)
+        {
+            for (auto q : qs)
+                allok = release(q) && allok;
+            return allok;
+        }
+
+        // measure the qubits that aren't classical, then remove all of them from the state at once
+        flush();
         for (auto q : qs)
-            allok = release(q) && allok;
+        {
+            if (isclassical(q))
+                allok = (psi.getvalue(q) == false) && allok;
+            else
+            {
+                M(q);
+                allok = false;
+            }
+        }
+        psi.release(qs);
         return allok;
     }
 
+    // memory given back after releasing qubits
+    void SetShrinkThreshold(unsigned slack) override
+    {
+        recursive_lock_type l(getmutex());
+        psi.set_shrink_threshold(slack);
+    }
+
+    void SetMemoryBudget(std::size_t bytes) override
+    {
+        recursive_lock_type l(getmutex());
+        psi.set_memory_budget(bytes);
+    }
+
+    // the stabilizer tableau isn't counted, it is small next to a state vector
+    void MemoryFootprint(std::size_t& current, std::size_t& peak) override
+    {
+        recursive_lock_type l(getmutex());
+        const std::size_t dump = dump_buffer_.capacity() > 0 ? dump_buffer_.capacity() * sizeof(ComplexType) + 64 : 0;
+        current = psi.footprint() + dump;
+        peak = psi.peak_footprint() + dump;
+    }
+
     // single-qubit gates
 
 #define GATE1IMPL(OP)                                                                                                  \
     void OP(logical_qubit_id q)                                                                                        \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        if (clifford(Gates::OP(q))) return;                                                                            \
         psi.apply(Gates::OP(q));                                                                                       \
     }
 #define GATE1CIMPL(OP)                                                                                                 \
     void C##OP(logical_qubit_id c, logical_qubit_id q)                                                                 \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        if (clifford(c, Gates::OP(q))) return;                                                                         \
         psi.apply_controlled(c, Gates::OP(q));                                                                         \
     }
 #define GATE1MCIMPL(OP)                                                                                                \
     void C##OP(std::vector<logical_qubit_id> const& c, logical_qubit_id q)                                             \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        if (clifford(c, Gates::OP(q))) return;                                                                         \
         psi.apply_controlled(c, Gates::OP(q));                                                                         \
     }
 #define GATE1(OP) GATE1IMPL(OP) GATE1CIMPL(OP) GATE1MCIMPL(OP)
@@ -168,18 +265,21 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     void OP(double phi, logical_qubit_id q)                                                                            \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        densify();                                                                                                     \
         psi.apply(Gates::OP(phi, q));                                                                                  \
     }
 #define GATE1CIMPL(OP)                                                                                                 \
     void C##OP(double phi, logical_qubit_id c, logical_qubit_id q)                                                     \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        densify();                                                                                                     \
         psi.apply_controlled(c, Gates::OP(phi, q));                                                                    \
     }
 #define GATE1MCIMPL(OP)                                                                                                \
     void C##OP(double phi, std::vector<logical_qubit_id> const& c, logical_qubit_id q)                                 \
     {                                                                                                                  \
         recursive_lock_type l(getmutex());                                                                                \
+        densify();                                                                                                     \
         psi.apply_controlled(c, Gates::OP(phi, q));                                                                    \
     }
 #define GATE1(OP) GATE1IMPL(OP) GATE1CIMPL(OP) GATE1MCIMPL(OP)
@@ -197,6 +297,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     void R(Gates::Basis b, double phi, logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
+        densify();
         psi.apply(Gates::R(b, phi, q));
     }
 
@@ -204,6 +305,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     void CR(Gates::Basis b, double phi, std::vector<logical_qubit_id> const& c, logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
+        densify();
         psi.apply_controlled(c, Gates::R(b, phi, q));
     }
 
@@ -220,6 +322,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
         removeIdentities(bs, qs);
 
         recursive_lock_type l(getmutex());
+        densify();
         if (bs.size() == 0)
             CR(Gates::PauliI, -2. * phi, cs, somequbit);
         else if (bs.size() == 1)
@@ -234,11 +337,94 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
         CExp(bs, phi, std::vector<logical_qubit_id>(), qs);
     }
 
+    void ApplyPauliSum(
+        std::vector<double> const& c,
+        std::vector<std::vector<Gates::Basis>> const& bs,
+        std::vector<std::vector<logical_qubit_id>> const& qs) override
+    {
+        if (bs.size() != c.size() || qs.size() != c.size())
+            throw std::runtime_error("every term of a Pauli sum needs a coefficient, bases and qubits");
+        for (std::size_t k = 0; k < c.size(); ++k)
+            if (bs[k].size() != qs[k].size())
+                throw std::runtime_error("a term of a Pauli sum needs a basis for every qubit");
+        recursive_lock_type l(getmutex());
+        densify();
+        psi.apply_pauli_sum(c, bs, qs);
+    }
+
+    // dense and diagonal unitaries
+    void ApplyControlledMatrix(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& matrix) override
+    {
+        if (qs.size() > 7) throw std::runtime_error("dense matrices can act on at most 7 qubits");
+        if (matrix.size() != (1ull << (2 * qs.size()))) throw std::runtime_error("the matrix has the wrong size");
+        recursive_lock_type l(getmutex());
+        densify();
+        psi.apply_controlled_matrix(cs, qs, matrix);
+    }
+
+    void ApplyControlledDiagonal(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& diagonal) override
+    {
+        if (diagonal.size() != (1ull << qs.size())) throw std::runtime_error("the diagonal has the wrong size");
+        recursive_lock_type l(getmutex());
+        densify();
+        psi.apply_controlled_diagonal(cs, qs, diagonal);
+    }
+
+    // performance counters
+    void GetPerfCounters(void (*callback)(const char*, double)) override
+    {
+        recursive_lock_type l(getmutex());
+        psi.perf_counters().visit(callback);
+    }
+
+    void ResetPerfCounters() override
+    {
+        recursive_lock_type l(getmutex());
+        psi.perf_counters().reset();
+    }
+
+    // asynchronous flushing of the gate cache
+    // Turning the stabilizer mode on takes effect while the simulator holds no qubits: right away if it holds none,
+    // otherwise at the next reset. Turning it off builds the state vector.
+    void SetStabilizerMode(bool enable) override
+    {
+        recursive_lock_type l(getmutex());
+        stabilizer_mode_ = enable;
+        if (!enable)
+            densify();
+        else if (!stabilizer_ && psi.num_qubits() == 0)
+        {
+            tableau_ = StabilizerTableau();
+            stabilizer_ = true;
+        }
+    }
+
+    void SetAsyncFlush(bool enable) override
+    {
+        recursive_lock_type l(getmutex());
+        psi.set_async_flush(enable);
+    }
+
+    // quantum Fourier transform
+    void QFT(std::vector<logical_qubit_id> const& qs, bool adjoint = false) override
+    {
+        recursive_lock_type l(getmutex());
+        densify();
+        psi.qft(qs, adjoint);
+    }
+
     // measurements
 
     bool M(logical_qubit_id q)
     {
         recursive_lock_type l(getmutex());
+        if (stabilizer_) return tableau_.measure(q, uniform());
         return psi.measure(q);
     }
 
@@ -248,7 +434,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
         recursive_lock_type l(getmutex());
         std::vector<bool> res;
         for (auto q : qs)
-            res.push_back(psi.measure(q));
+            res.push_back(M(q));
         return res;
     }
 
@@ -258,7 +444,7 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
         removeIdentities(bs, qs);
         // ***TODO*** optimized kernels
         changebasis(bs, qs, true);
-        bool res = psi.jointmeasure(qs);
+        bool res = stabilizer_ ? tableau_.jointmeasure(qs, uniform()) : psi.jointmeasure(qs);
         changebasis(bs, qs, false);
         return res;
     }
@@ -272,12 +458,14 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     {
         recursive_lock_type l(getmutex());
         psi.reset();
+        tableau_ = StabilizerTableau();
+        stabilizer_ = stabilizer_mode_;
     }
 
     unsigned num_qubits() const
     {
         recursive_lock_type l(getmutex());
-        return psi.num_qubits();
+        return stabilizer_ ? tableau_.num_qubits() : psi.num_qubits();
     }
     void flush()
     {
@@ -287,42 +475,55 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     ComplexType const* data() const
     {
         recursive_lock_type l(getmutex());
+        const_cast<Simulator*>(this)->densify();
         return psi.data().data();
     }
 
     void dump(bool (*callback)(const char*, double, double))
     {
         recursive_lock_type l(getmutex());
+        densify();
         flush();
+        auto timer = dump_timer();
 
-        auto wfn = psi.data();
+        auto const& wfn = psi.data();
         auto nq = num_qubits();
         std::string label_str(nq, '0');
-        for (std::size_t i = 0; i < wfn.size(); i++)
+        for (std::size_t i = 0; i < wfn.size(); i++, increment_label(label_str))
         {
-            for (std::size_t j = 0; j < nq; ++j)
-                label_str[j] = ((i >> j)&1) ? '1' : '0';
             if (!callback(label_str.c_str(), wfn[i].real(), wfn[i].imag())) return;
         }
     }
 
     void dump(TDumpToLocationCallback callback, TDumpLocation location) override
     {
+        recursive_lock_type l(getmutex());
+        densify();
         flush();
+        auto timer = dump_timer();
 
-        auto wfn = psi.data();
+        auto const& wfn = psi.data();
         for (std::size_t i = 0; i < wfn.size(); i++)
         {
             if (!callback(i, wfn[i].real(), wfn[i].imag(), location)) return;
         }
     }
 
+    std::size_t dump(std::size_t n, double* re, double* im, std::size_t* indices, double threshold) override
+    {
+        recursive_lock_type l(getmutex());
+        densify();
+        flush();
+        auto timer = dump_timer();
+        return kernels::copy_amplitudes(psi.data(), threshold, n, re, im, indices);
+    }
+
     void dumpIds(void (*callback)(logical_qubit_id))
     {
         recursive_lock_type l(getmutex());
         flush();
 
-        std::vector<logical_qubit_id> qubits = psi.get_qubit_ids();
+        std::vector<logical_qubit_id> qubits = stabilizer_ ? tableau_.ids() : psi.get_qubit_ids();
         for (logical_qubit_id q : qubits)
         {
             callback(q);
@@ -333,7 +534,12 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     {
         assert(qs.size() <= num_qubits());
 
-        WavefunctionStorage wfn(1ull << qs.size());
+        recursive_lock_type l(getmutex());
+        densify();
+        flush();
+        auto timer = dump_timer();
+        WavefunctionStorage& wfn = dump_buffer_;
+        wfn.resize(1ull << qs.size());
 
         if (subsytemwavefunction(qs, wfn, 1e-10))
         {
@@ -353,15 +559,18 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     {
         assert(qs.size() <= num_qubits());
 
-        WavefunctionStorage wfn(1ull << qs.size());
+        recursive_lock_type l(getmutex());
+        densify();
+        flush();
+        auto timer = dump_timer();
+        WavefunctionStorage& wfn = dump_buffer_;
+        wfn.resize(1ull << qs.size());
         auto nq = num_qubits();
         std::string label_str(nq, '0');
         if (subsytemwavefunction(qs, wfn, 1e-10))
         {
-            for (std::size_t i = 0; i < wfn.size(); i++)
+            for (std::size_t i = 0; i < wfn.size(); i++, increment_label(label_str))
             {
-                for (std::size_t j = 0; j < nq; ++j)
-                    label_str[j] = ((i >> j)&1) ? '1' : '0';
                 if (!callback(label_str.c_str(), wfn[i].real(), wfn[i].imag())) break;
             }
             return true;
@@ -389,17 +598,190 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
 #endif
 
         recursive_lock_type l(getmutex());
+        densify();
         psi.permute_basis(qs, table_size, permutation_table, adjoint);
     }
 
+    void permuteBasis(
+        std::vector<logical_qubit_id> const& qs,
+        TPermutationFunction permutation,
+        void* context,
+        bool adjoint = false) override
+    {
+        recursive_lock_type l(getmutex());
+        densify();
+        psi.permute_basis_by_function(
+            qs, [permutation, context](std::size_t qstate) { return permutation(qstate, context); }, adjoint);
+    }
+
     bool subsytemwavefunction(std::vector<logical_qubit_id> const& qs, WavefunctionStorage& qubitswfn, double tolerance)
     {
         recursive_lock_type l(getmutex());
+        densify();
         flush();
         return psi.subsytemwavefunction(qs, qubitswfn, tolerance);
     }
 
+    // state snapshots
+    Microsoft::Quantum::Simulator::SimulatorInterface* clone() const override
+    {
+        recursive_lock_type l(getmutex());
+        return new Simulator(*this);
+    }
+
+    void restore(Microsoft::Quantum::Simulator::SimulatorInterface const& snapshot) override
+    {
+        Simulator const* other = dynamic_cast<Simulator const*>(&snapshot);
+        if (other == nullptr)
+        {
+            throw std::runtime_error("cannot restore the state from a different kind of simulator");
+        }
+        if (other == this) return;
+
+        auto mutexes = lock_order(*other);
+        recursive_lock_type l(*mutexes.first);
+        recursive_lock_type lo(*mutexes.second);
+        psi = other->psi;
+        tableau_ = other->tableau_;
+        stabilizer_ = other->stabilizer_;
+    }
+
+    // The states built from a stabilizer tableau are only defined up to a global phase, so is the overlap then.
+    std::complex<double> Overlap(Microsoft::Quantum::Simulator::SimulatorInterface& other) override
+    {
+        Simulator& sim = same_kind(other);
+        auto mutexes = lock_order(sim);
+        recursive_lock_type l(*mutexes.first);
+        recursive_lock_type lo(*mutexes.second);
+        densify();
+        sim.densify();
+        return psi.overlap(sim.psi);
+    }
+
+    // half the trace norm of the difference of the reduced density matrices, from their eigenvalues
+    double TraceDistance(
+        Microsoft::Quantum::Simulator::SimulatorInterface& other,
+        std::vector<logical_qubit_id> const& qs) override
+    {
+        if (qs.size() > 8) throw std::runtime_error("the trace distance is limited to 8 qubits");
+        Simulator& sim = same_kind(other);
+        auto mutexes = lock_order(sim);
+        recursive_lock_type l(*mutexes.first);
+        recursive_lock_type lo(*mutexes.second);
+        densify();
+        sim.densify();
+        std::vector<std::complex<double>> difference = psi.reduced_density_matrix(qs);
+        const std::vector<std::complex<double>> rho = sim.psi.reduced_density_matrix(qs);
+        for (std::size_t i = 0; i < difference.size(); ++i)
+            difference[i] -= rho[i];
+        double norm = 0.;
+        for (double e : hermitian_eigenvalues(difference, std::size_t(1) << qs.size()))
+            norm += std::abs(e);
+        return 0.5 * norm;
+    }
+
+    std::vector<std::complex<double>> ReducedDensityMatrix(std::vector<logical_qubit_id> const& qs) override
+    {
+        if (qs.size() > 12) throw std::runtime_error("the reduced density matrix is limited to 12 qubits");
+        recursive_lock_type l(getmutex());
+        densify();
+        return psi.reduced_density_matrix(qs);
+    }
+
   private:
+    // The mutexes of this simulator and of `other` in the order of their addresses. Operations on two simulators lock
+    // them in this order, so that two threads working on the same pair from either side can't deadlock.
+    std::pair<recursive_mutex_type*, recursive_mutex_type*> lock_order(
+        Microsoft::Quantum::Simulator::SimulatorInterface const& other) const
+    {
+        recursive_mutex_type* a = &getmutex();
+        recursive_mutex_type* b = &other.getmutex();
+        if (std::less<recursive_mutex_type*>()(b, a)) std::swap(a, b);
+        return {a, b};
+    }
+
+    Simulator& same_kind(Microsoft::Quantum::Simulator::SimulatorInterface& other) const
+    {
+        Simulator* sim = dynamic_cast<Simulator*>(&other);
+        if (sim == nullptr) throw std::runtime_error("cannot compare the state with a different kind of simulator");
+        return *sim;
+    }
+
+    // adds the time until the end of the scope to the dumps
+    KernelTimer dump_timer()
+    {
+        return KernelTimer(psi.perf_counters(), PerfCounters::Dump, double(psi.data().size() * sizeof(ComplexType)));
+    }
+
+    // Stabilizer mode: while only Clifford gates and measurements arrive the state is kept in `tableau_`, and `psi`
+    // holds no qubits. The first operation the tableau can't do builds the state vector, but only up to a global phase,
+    // which is why the mode is opt-in: SetStabilizerMode, or the environment variable QDK_SIM_STABILIZER set to 1 for
+    // all new simulators.
+    static bool stabilizer_enabled()
+    {
+        bool enabled = false;
+#ifdef _MSC_VER
+        char* env = nullptr;
+        size_t len;
+        if (_dupenv_s(&env, &len, "QDK_SIM_STABILIZER") == 0 && env != nullptr)
+        {
+            enabled = (env[0] == '1');
+            free(env);
+        }
+#else
+        const char* env = getenv("QDK_SIM_STABILIZER");
+        if (env != nullptr) enabled = (env[0] == '1');
+#endif
+        return enabled;
+    }
+
+    // leaves the stabilizer mode
+    void densify()
+    {
+        if (!stabilizer_) return;
+        // stays in stabilizer mode if the state vector doesn't fit into the memory budget
+        psi.assign_state(tableau_.positions(), tableau_.num_qubits(), [this](ComplexType* amplitudes) {
+            tableau_.write_state(amplitudes);
+        });
+        stabilizer_ = false;
+        tableau_ = StabilizerTableau();
+    }
+
+    // Applies the gate to the tableau if the simulator is in stabilizer mode and the gate is a Clifford gate with at
+    // most one control. Leaves the stabilizer mode and returns false if it isn't.
+    template <class Gate>
+    bool clifford(Gate const& g)
+    {
+        if (!stabilizer_) return false;
+        if (tableau_.apply(g)) return true;
+        densify();
+        return false;
+    }
+
+    template <class Gate>
+    bool clifford(logical_qubit_id c, Gate const& g)
+    {
+        if (!stabilizer_) return false;
+        if (tableau_.apply_controlled(c, g)) return true;
+        densify();
+        return false;
+    }
+
+    template <class Gate>
+    bool clifford(std::vector<logical_qubit_id> const& cs, Gate const& g)
+    {
+        if (cs.size() == 0) return clifford(g);
+        if (cs.size() == 1) return clifford(cs[0], g);
+        densify();
+        return false;
+    }
+
+    // the random number that decides a measurement, drawn as in the wave function
+    double uniform()
+    {
+        return psi.rng().uniform();
+    }
+
     void changebasis(Gates::Basis b, logical_qubit_id q, bool back)
     {
         if (b == Gates::PauliX)
@@ -420,6 +802,20 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
             changebasis(bs[i], qs[i], back);
     }
 
+    // advances the little-endian binary label of a basis state to the next index (amortized O(1))
+    inline static void increment_label(std::string& label)
+    {
+        for (char& c : label)
+        {
+            if (c == '0')
+            {
+                c = '1';
+                return;
+            }
+            c = '0';
+        }
+    }
+
     inline static void removeIdentities(std::vector<Gates::Basis>& b, std::vector<logical_qubit_id>& qs)
     {
         unsigned i = 0;
@@ -436,6 +832,14 @@ class Simulator : public Microsoft::Quantum::Simulator::SimulatorInterface
     }
 
     WaveFunctionType psi;
+    StabilizerTableau tableau_;
+    bool stabilizer_mode_; // start in stabilizer mode after a reset
+    bool stabilizer_;
+    // the register dumps reuse this buffer, so that dumping small registers repeatedly doesn't allocate
+    WavefunctionStorage dump_buffer_;
+    // the last distribution of random_choice
+    std::vector<double> choice_weights_;
+    std::vector<double> choice_cdf_;
 };
 
 using WavefunctionType = Wavefunction<ComplexType>;
@@ -3,6 +3,7 @@
 
 #define HAVE_INTRINSICS
 
+#include "simulator/sharded.hpp"
 #include "simulator/simulator.hpp"
 
 namespace sim = Microsoft::Quantum::SimulatorAVX;
@@ -11,3 +12,12 @@ MICROSOFT_QUANTUM_DECL Microsoft::Quantum::Simulator::SimulatorInterface* sim::c
 {
     return new sim::SimulatorType(maxlocal);
 }
+
+MICROSOFT_QUANTUM_DECL Microsoft::Quantum::Simulator::SimulatorInterface* sim::createShardedSimulator(
+    std::string const& session,
+    unsigned rank,
+    unsigned processes,
+    unsigned maxlocal)
+{
+    return new sim::ShardedSimulatorType(session, rank, processes, maxlocal);
+}
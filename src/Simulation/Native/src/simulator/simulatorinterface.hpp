@@ -7,6 +7,7 @@
 #include "gates.hpp"
 #include "types.hpp"
 #include "util/openmp.hpp"
+#include <string>
 #include <vector>
 
 namespace Microsoft
@@ -25,6 +26,13 @@ class SimulatorInterface
     {
     }
 
+    // copies get a mutex of their own
+    SimulatorInterface(SimulatorInterface const&)
+        : mutex_ptr(new recursive_mutex_type())
+    {
+    }
+    SimulatorInterface& operator=(SimulatorInterface const&) = delete;
+
     virtual ~SimulatorInterface() {}
 
     virtual std::size_t random(std::size_t n, double* d) = 0;
@@ -35,9 +43,66 @@ class SimulatorInterface
         const std::vector<logical_qubit_id>& qubits,
         const std::vector<ComplexType>& amplitudes) = 0;
 
+    // binary state files
+    virtual bool InjectState(const std::vector<logical_qubit_id>& qubits, std::string const& path)
+    {
+        throw std::runtime_error("this simulator does not support state files");
+    }
+    virtual bool SaveState(std::string const& path)
+    {
+        throw std::runtime_error("this simulator does not support state files");
+    }
+
     // allocate and release
     virtual void allocateQubit(unsigned q) = 0;
     virtual bool release(unsigned q) = 0;
+    virtual bool release(std::vector<unsigned> const& qs)
+    {
+        bool allok = true;
+        for (auto q : qs)
+            allok = release(q) && allok;
+        return allok;
+    }
+    virtual void GetPerfCounters(void (*callback)(const char*, double))
+    {
+        throw std::runtime_error("this simulator does not support performance counters");
+    }
+    virtual void ResetPerfCounters()
+    {
+        throw std::runtime_error("this simulator does not support performance counters");
+    }
+    virtual void SetShrinkThreshold(unsigned slack)
+    {
+        throw std::runtime_error("this simulator does not support a shrink policy");
+    }
+    virtual std::complex<double> Overlap(SimulatorInterface& other)
+    {
+        throw std::runtime_error("this simulator does not support overlaps");
+    }
+    virtual double TraceDistance(SimulatorInterface& other, std::vector<unsigned> const& qs)
+    {
+        throw std::runtime_error("this simulator does not support overlaps");
+    }
+    virtual std::vector<std::complex<double>> ReducedDensityMatrix(std::vector<unsigned> const& qs)
+    {
+        throw std::runtime_error("this simulator does not support reduced density matrices");
+    }
+    // replaces the state by sum_k c[k] P_k |psi>, which isn't normalized, for adjoint differentiation
+    virtual void ApplyPauliSum(
+        std::vector<double> const& c,
+        std::vector<std::vector<Gates::Basis>> const& bs,
+        std::vector<std::vector<unsigned>> const& qs)
+    {
+        throw std::runtime_error("this simulator does not support Pauli sums");
+    }
+    virtual void SetMemoryBudget(std::size_t bytes)
+    {
+        throw std::runtime_error("this simulator does not support a memory budget");
+    }
+    virtual void MemoryFootprint(std::size_t& current, std::size_t& peak)
+    {
+        throw std::runtime_error("this simulator does not support a memory budget");
+    }
     virtual unsigned num_qubits() const = 0;
 
     // single-qubit gates
@@ -76,6 +141,40 @@ class SimulatorInterface
         CExp(bs, phi, std::vector<unsigned>(), qs);
     }
 
+    // dense and diagonal unitaries (bit i of the matrix indices refers to qs[i])
+    virtual void ApplyControlledMatrix(
+        std::vector<unsigned> const& cs,
+        std::vector<unsigned> const& qs,
+        std::vector<ComplexType> const& matrix)
+    {
+        throw std::runtime_error("this simulator does not support arbitrary unitaries");
+    }
+    virtual void ApplyControlledDiagonal(
+        std::vector<unsigned> const& cs,
+        std::vector<unsigned> const& qs,
+        std::vector<ComplexType> const& diagonal)
+    {
+        throw std::runtime_error("this simulator does not support arbitrary unitaries");
+    }
+
+    // Clifford circuits on a stabilizer tableau, see Simulator::SetStabilizerMode
+    virtual void SetStabilizerMode(bool enable)
+    {
+        throw std::runtime_error("this simulator does not support a stabilizer mode");
+    }
+
+    // when enabled, full gate caches are applied in the background while the caller keeps queueing gates
+    virtual void SetAsyncFlush(bool enable)
+    {
+        throw std::runtime_error("this simulator does not support asynchronous flushing");
+    }
+
+    // quantum Fourier transform on a little-endian register
+    virtual void QFT(std::vector<unsigned> const& qs, bool adjoint = false)
+    {
+        throw std::runtime_error("this simulator does not support the quantum Fourier transform");
+    }
+
     // measurements
 
     virtual bool M(unsigned q) = 0;
@@ -99,6 +198,11 @@ class SimulatorInterface
     {
         assert(false);
     }
+    virtual std::size_t dump(std::size_t n, double* re, double* im, std::size_t* indices, double threshold)
+    {
+        assert(false);
+        return 0;
+    }
     virtual bool dumpQubits(std::vector<logical_qubit_id> const& qs, bool (*callback)(const char*, double, double))
     {
         assert(false);
@@ -123,6 +227,25 @@ class SimulatorInterface
     {
         throw std::runtime_error("this simulator does not support permutation oracle emulation");
     };
+    virtual void permuteBasis(
+        std::vector<unsigned> const& qs,
+        TPermutationFunction permutation,
+        void* context,
+        bool adjoint = false)
+    {
+        throw std::runtime_error("this simulator does not support permutation oracle emulation");
+    }
+
+    // state snapshots: `clone` creates an independent simulator with a copy of the current state, `restore` overwrites
+    // the state of this simulator with the state of a simulator created by `clone`
+    virtual SimulatorInterface* clone() const
+    {
+        throw std::runtime_error("this simulator does not support state snapshots");
+    }
+    virtual void restore(SimulatorInterface const& snapshot)
+    {
+        throw std::runtime_error("this simulator does not support state snapshots");
+    }
 
     recursive_mutex_type& getmutex() const
     {
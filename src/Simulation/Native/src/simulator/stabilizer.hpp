@@ -0,0 +1,591 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "gates.hpp"
+#include "types.hpp"
+#include "util/bitops.hpp"
+#include "util/openmp.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace SIMULATOR
+{
+
+/// Stabilizer tableau (Aaronson and Gottesman, CHP) of a state reachable from |0...0> by Clifford gates and Pauli
+/// measurements. Gates and deterministic measurements cost O(n) and random measurements O(n^2) bit operations on
+/// rows of 64-bit words, instead of the O(2^n) of the state vector. The global phase isn't tracked.
+///
+/// Every row is a Pauli operator i^r X^x Z^z (r mod 4, x and z bit vectors over the columns). Rows 0..ncap-1 are the
+/// destabilizers and rows ncap..2 ncap-1 the stabilizers; column a owns destabilizer a and stabilizer ncap + a.
+/// Columns of released qubits are reset to |0> and reused, so the tableau only grows with the peak number of qubits.
+class StabilizerTableau
+{
+  public:
+    /// the number of allocated qubits
+    unsigned num_qubits() const
+    {
+        return static_cast<unsigned>(order_.size());
+    }
+
+    /// Allocates a qubit with the lowest unused logical id (the same id the wave function would pick).
+    logical_qubit_id allocate()
+    {
+        auto it = std::find(column_.begin(), column_.end(), invalid());
+        logical_qubit_id q = static_cast<logical_qubit_id>(it - column_.begin());
+        allocate(q);
+        return q;
+    }
+
+    void allocate(logical_qubit_id q)
+    {
+        if (q >= column_.size()) column_.resize(q + 1, invalid());
+        assert(column_[q] == invalid());
+
+        unsigned a;
+        if (!free_.empty())
+        {
+            a = free_.back();
+            free_.pop_back();
+        }
+        else
+        {
+            if (ncols_ == ncap_) grow();
+            a = ncols_++;
+            set_bit(xrow(a), a);
+            set_bit(zrow(ncap_ + a), a);
+        }
+        column_[q] = a;
+        order_.push_back(q);
+    }
+
+    /// \pre the qubit is in a computational basis state
+    void release(logical_qubit_id q)
+    {
+        bool value = false;
+        bool classical = deterministic(q, value);
+        assert(classical);
+        (void)classical;
+        if (value) x(q);
+
+        free_.push_back(column_[q]);
+        column_[q] = invalid();
+        order_.erase(std::find(order_.begin(), order_.end(), q));
+        while (!column_.empty() && column_.back() == invalid())
+            column_.pop_back();
+    }
+
+    /// the logical ids of the allocated qubits in increasing order
+    std::vector<logical_qubit_id> ids() const
+    {
+        std::vector<logical_qubit_id> qs(order_);
+        std::sort(qs.begin(), qs.end());
+        return qs;
+    }
+
+    /// Positions of the qubits in a state vector, indexed by logical id: qubits are ordered by allocation, as in the
+    /// wave function. Unallocated ids get an invalid position.
+    std::vector<positional_qubit_id> positions() const
+    {
+        std::vector<positional_qubit_id> ps(column_.size(), invalid());
+        for (unsigned i = 0; i < order_.size(); ++i)
+            ps[order_[i]] = i;
+        return ps;
+    }
+
+    // gates (conjugation of every row)
+
+    void h(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t& x, std::uint64_t& z, std::uint8_t& r, std::uint64_t m) {
+            bool bx = (x & m) != 0, bz = (z & m) != 0;
+            r = (r + 2 * (bx && bz)) & 3;
+            if (bx != bz)
+            {
+                x ^= m;
+                z ^= m;
+            }
+        });
+    }
+
+    void s(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t& x, std::uint64_t& z, std::uint8_t& r, std::uint64_t m) {
+            if (x & m)
+            {
+                r = (r + 1) & 3;
+                z ^= m;
+            }
+        });
+    }
+
+    void adjs(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t& x, std::uint64_t& z, std::uint8_t& r, std::uint64_t m) {
+            if (x & m)
+            {
+                r = (r + 3) & 3;
+                z ^= m;
+            }
+        });
+    }
+
+    void x(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t&, std::uint64_t& z, std::uint8_t& r, std::uint64_t m) {
+            if (z & m) r ^= 2;
+        });
+    }
+
+    void y(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t& x, std::uint64_t& z, std::uint8_t& r, std::uint64_t m) {
+            if (((x ^ z) & m) != 0) r ^= 2;
+        });
+    }
+
+    void z(logical_qubit_id q)
+    {
+        for_each_row(q, [](std::uint64_t& x, std::uint64_t&, std::uint8_t& r, std::uint64_t m) {
+            if (x & m) r ^= 2;
+        });
+    }
+
+    void cx(logical_qubit_id c, logical_qubit_id t)
+    {
+        const unsigned a = column_[c], b = column_[t];
+        const unsigned wa = a / 64, wb = b / 64;
+        const std::uint64_t ma = 1ull << (a % 64), mb = 1ull << (b % 64);
+        for (unsigned i = 0; i < ncols_; ++i)
+        {
+            for (std::size_t row : {std::size_t(i), std::size_t(ncap_ + i)})
+            {
+                std::uint64_t* x = xrow(row);
+                std::uint64_t* z = zrow(row);
+                if (x[wa] & ma) x[wb] ^= mb;
+                if (z[wb] & mb) z[wa] ^= ma;
+            }
+        }
+    }
+
+    // Clifford gates of the simulator interface; the templates reject everything else
+
+    template <class Gate>
+    bool apply(Gate const&)
+    {
+        return false;
+    }
+    bool apply(Gates::X const& g)
+    {
+        x(g.qubit());
+        return true;
+    }
+    bool apply(Gates::Y const& g)
+    {
+        y(g.qubit());
+        return true;
+    }
+    bool apply(Gates::Z const& g)
+    {
+        z(g.qubit());
+        return true;
+    }
+    bool apply(Gates::H const& g)
+    {
+        h(g.qubit());
+        return true;
+    }
+    bool apply(Gates::S const& g)
+    {
+        s(g.qubit());
+        return true;
+    }
+    bool apply(Gates::AdjS const& g)
+    {
+        adjs(g.qubit());
+        return true;
+    }
+    bool apply(Gates::HY const& g)
+    {
+        h(g.qubit());
+        s(g.qubit());
+        return true;
+    }
+    bool apply(Gates::AdjHY const& g)
+    {
+        adjs(g.qubit());
+        h(g.qubit());
+        return true;
+    }
+
+    template <class Gate>
+    bool apply_controlled(logical_qubit_id, Gate const&)
+    {
+        return false;
+    }
+    bool apply_controlled(logical_qubit_id c, Gates::X const& g)
+    {
+        cx(c, g.qubit());
+        return true;
+    }
+    bool apply_controlled(logical_qubit_id c, Gates::Y const& g)
+    {
+        adjs(g.qubit());
+        cx(c, g.qubit());
+        s(g.qubit());
+        return true;
+    }
+    bool apply_controlled(logical_qubit_id c, Gates::Z const& g)
+    {
+        h(g.qubit());
+        cx(c, g.qubit());
+        h(g.qubit());
+        return true;
+    }
+
+    // measurements
+
+    /// Returns true and the outcome in `value` if measuring the qubit in the computational basis is deterministic.
+    bool deterministic(logical_qubit_id q, bool& value) const
+    {
+        const unsigned a = column_[q];
+        for (unsigned i = 0; i < ncols_; ++i)
+            if (get_bit(xrow(ncap_ + i), a)) return false;
+
+        // Z_a is in the stabilizer group: it is the product of the stabilizers whose destabilizers anticommute with it
+        std::vector<std::uint64_t> x(words_, 0), z(words_, 0);
+        std::uint8_t r = 0;
+        for (unsigned i = 0; i < ncols_; ++i)
+            if (get_bit(xrow(i), a)) multiply(x.data(), z.data(), r, ncap_ + i);
+        assert(r == 0 || r == 2);
+        value = (r == 2);
+        return true;
+    }
+
+    /// the probability of measuring 1, which is 0, 1/2 or 1
+    double probability(logical_qubit_id q) const
+    {
+        bool value;
+        if (deterministic(q, value)) return value ? 1. : 0.;
+        return 0.5;
+    }
+
+    /// Measures the qubit; a random outcome is 1 if `uniform` < 1/2.
+    bool measure(logical_qubit_id q, double uniform)
+    {
+        bool value;
+        if (deterministic(q, value)) return value;
+
+        const unsigned a = column_[q];
+        std::size_t p = 0;
+        for (unsigned i = 0; i < ncols_; ++i)
+            if (get_bit(xrow(ncap_ + i), a))
+            {
+                p = ncap_ + i;
+                break;
+            }
+
+        // make every other row commute with Z_a, then replace the destabilizer of p by p and p by +-Z_a
+        for (unsigned i = 0; i < ncols_; ++i)
+            for (std::size_t row : {std::size_t(i), std::size_t(ncap_ + i)})
+                if (row != p && get_bit(xrow(row), a)) multiply(xrow(row), zrow(row), r_[row], p);
+
+        const std::size_t d = p - ncap_;
+        std::copy(xrow(p), xrow(p) + words_, xrow(d));
+        std::copy(zrow(p), zrow(p) + words_, zrow(d));
+        r_[d] = r_[p];
+
+        value = uniform < 0.5;
+        std::fill(xrow(p), xrow(p) + words_, 0);
+        std::fill(zrow(p), zrow(p) + words_, 0);
+        set_bit(zrow(p), a);
+        r_[p] = value ? 2 : 0;
+        return value;
+    }
+
+    /// the probability that the parity of the qubits is odd
+    double jointprobability(std::vector<logical_qubit_id> const& qs)
+    {
+        if (qs.empty()) return 0.;
+        parity(qs);
+        double p = probability(qs[0]);
+        parity(qs);
+        return p;
+    }
+
+    /// measures the parity of the qubits
+    bool jointmeasure(std::vector<logical_qubit_id> const& qs, double uniform)
+    {
+        if (qs.empty()) return false;
+        parity(qs);
+        bool value = measure(qs[0], uniform);
+        parity(qs);
+        return value;
+    }
+
+    /// Writes the 2^num_qubits() amplitudes of the state, with the qubits at the positions(), into `psi`. The global
+    /// phase is chosen such that the amplitude of |b> below is real and positive.
+    ///
+    /// After a Gaussian elimination the stabilizers split into k generators with an X part and n - k generators of
+    /// Z operators only. The latter fix a basis state |b> in the support, and the state is the uniform superposition
+    /// of the 2^k states g |b> for the products g of the former. The products are enumerated in Gray code order, with
+    /// one block of the enumeration per thread.
+    template <class T>
+    void write_state(std::complex<T>* psi) const
+    {
+        const std::size_t size = std::size_t(1) << num_qubits();
+        const std::vector<positional_qubit_id> ps = positions();
+        std::vector<positional_qubit_id> pos_of_column(ncols_, invalid());
+        for (logical_qubit_id q = 0; q < column_.size(); ++q)
+            if (column_[q] != invalid()) pos_of_column[column_[q]] = ps[q];
+
+        // copy of the stabilizers
+        const std::size_t n = ncols_, W = words_;
+        std::vector<std::uint64_t> x(n * W), z(n * W);
+        std::vector<std::uint8_t> r(n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            std::copy(xrow(ncap_ + i), xrow(ncap_ + i) + W, &x[i * W]);
+            std::copy(zrow(ncap_ + i), zrow(ncap_ + i) + W, &z[i * W]);
+            r[i] = r_[ncap_ + i];
+        }
+        auto mul = [&](std::size_t i, std::size_t j) { // row i := row i * row j
+            unsigned c = 0;
+            for (std::size_t w = 0; w < W; ++w)
+            {
+                c += popcnt(z[i * W + w] & x[j * W + w]);
+                x[i * W + w] ^= x[j * W + w];
+                z[i * W + w] ^= z[j * W + w];
+            }
+            r[i] = static_cast<std::uint8_t>((r[i] + r[j] + 2 * c) & 3);
+        };
+        auto swap_rows = [&](std::size_t i, std::size_t j) {
+            std::swap_ranges(&x[i * W], &x[i * W] + W, &x[j * W]);
+            std::swap_ranges(&z[i * W], &z[i * W] + W, &z[j * W]);
+            std::swap(r[i], r[j]);
+        };
+        auto bit = [W](std::vector<std::uint64_t> const& v, std::size_t i, std::size_t a) {
+            return ((v[i * W + a / 64] >> (a % 64)) & 1) != 0;
+        };
+
+        // reduced row echelon form, first on the X parts, then on the Z parts of the remaining rows
+        std::size_t k = 0;
+        for (std::size_t a = 0; a < n && k < n; ++a)
+        {
+            std::size_t i = k;
+            while (i < n && !bit(x, i, a))
+                ++i;
+            if (i == n) continue;
+            swap_rows(i, k);
+            for (std::size_t j = 0; j < n; ++j)
+                if (j != k && bit(x, j, a)) mul(j, k);
+            ++k;
+        }
+        std::vector<std::size_t> pivot(n, 0);
+        for (std::size_t a = 0, l = k; a < n && l < n; ++a)
+        {
+            std::size_t i = l;
+            while (i < n && !bit(z, i, a))
+                ++i;
+            if (i == n) continue;
+            swap_rows(i, l);
+            for (std::size_t j = k; j < n; ++j)
+                if (j != l && bit(z, j, a)) mul(j, l);
+            pivot[l++] = a;
+        }
+        // the Z generators are +1 on |b> if b has the sign bit of every generator at its pivot (read once the reduction
+        // is complete, as reducing by later pivots changes the signs)
+        std::size_t seed = 0;
+        for (std::size_t l = k; l < n; ++l)
+            if (r[l] == 2)
+            {
+                assert(pos_of_column[pivot[l]] != invalid());
+                seed |= std::size_t(1) << pos_of_column[pivot[l]];
+            }
+
+        // the basis states |b> (as bit vector over the columns) and the index flips of the X generators
+        std::vector<std::uint64_t> b(W, 0);
+        for (std::size_t a = 0; a < n; ++a)
+            if (pos_of_column[a] != invalid() && ((seed >> pos_of_column[a]) & 1)) b[a / 64] |= 1ull << (a % 64);
+        std::vector<std::size_t> flips(k, 0);
+        for (std::size_t i = 0; i < k; ++i)
+            for (std::size_t a = 0; a < n; ++a)
+                if (bit(x, i, a))
+                {
+                    assert(pos_of_column[a] != invalid()); // released qubits are in |0>
+                    flips[i] |= std::size_t(1) << pos_of_column[a];
+                }
+
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(size); ++i)
+            psi[i] = 0.;
+
+        const T norm = static_cast<T>(std::pow(0.5, 0.5 * k));
+        const std::complex<T> phases[4] = {{norm, 0}, {0, norm}, {-norm, 0}, {0, -norm}};
+        const std::size_t terms = std::size_t(1) << k;
+        const std::size_t block = std::min<std::size_t>(terms, 4096);
+#pragma omp parallel for schedule(static)
+        for (std::intptr_t blk = 0; blk < static_cast<std::intptr_t>(terms / block); ++blk)
+        {
+            // product g of the generators selected by the Gray code of the first term in this block
+            std::vector<std::uint64_t> gx(W, 0), gz(W, 0);
+            unsigned gr = 0;
+            std::size_t index = seed;
+            auto times = [&](std::size_t j) {
+                unsigned c = 0;
+                for (std::size_t w = 0; w < W; ++w)
+                {
+                    c += popcnt(gz[w] & x[j * W + w]);
+                    gx[w] ^= x[j * W + w];
+                    gz[w] ^= z[j * W + w];
+                }
+                gr = (gr + r[j] + 2 * c) & 3;
+                index ^= flips[j];
+            };
+            const std::size_t first = static_cast<std::size_t>(blk) * block;
+            const std::size_t gray = first ^ (first >> 1);
+            for (std::size_t j = 0; j < k; ++j)
+                if ((gray >> j) & 1) times(j);
+
+            for (std::size_t t = first;; )
+            {
+                // g |b> = i^gr (-1)^(z.b) |b xor x>
+                unsigned sign = 0;
+                for (std::size_t w = 0; w < W; ++w)
+                    sign += popcnt(gz[w] & b[w]);
+                psi[index] = phases[(gr + 2 * sign) & 3];
+                if (++t == first + block) break;
+                times(static_cast<std::size_t>(ctz(t)));
+            }
+        }
+    }
+
+  private:
+    static constexpr unsigned invalid()
+    {
+        return std::numeric_limits<unsigned>::max();
+    }
+
+    static unsigned ctz(std::size_t v)
+    {
+        unsigned c = 0;
+        while (!(v & 1))
+        {
+            v >>= 1;
+            ++c;
+        }
+        return c;
+    }
+
+    template <class F>
+    void for_each_row(logical_qubit_id q, F&& f)
+    {
+        const unsigned a = column_[q];
+        const unsigned w = a / 64;
+        const std::uint64_t m = 1ull << (a % 64);
+        for (unsigned i = 0; i < ncols_; ++i)
+        {
+            f(xrow(i)[w], zrow(i)[w], r_[i], m);
+            f(xrow(ncap_ + i)[w], zrow(ncap_ + i)[w], r_[ncap_ + i], m);
+        }
+    }
+
+    std::uint64_t* xrow(std::size_t row)
+    {
+        return &x_[row * words_];
+    }
+    std::uint64_t const* xrow(std::size_t row) const
+    {
+        return &x_[row * words_];
+    }
+    std::uint64_t* zrow(std::size_t row)
+    {
+        return &z_[row * words_];
+    }
+    std::uint64_t const* zrow(std::size_t row) const
+    {
+        return &z_[row * words_];
+    }
+
+    static bool get_bit(std::uint64_t const* v, unsigned a)
+    {
+        return ((v[a / 64] >> (a % 64)) & 1) != 0;
+    }
+    static void set_bit(std::uint64_t* v, unsigned a)
+    {
+        v[a / 64] |= 1ull << (a % 64);
+    }
+
+    // (x, z, r) := (x, z, r) * row
+    void multiply(std::uint64_t* x, std::uint64_t* z, std::uint8_t& r, std::size_t row) const
+    {
+        std::uint64_t const* xr = xrow(row);
+        std::uint64_t const* zr = zrow(row);
+        unsigned c = 0;
+        for (std::size_t w = 0; w < words_; ++w)
+        {
+            c += popcnt(z[w] & xr[w]);
+            x[w] ^= xr[w];
+            z[w] ^= zr[w];
+        }
+        r = static_cast<std::uint8_t>((r + r_[row] + 2 * c) & 3);
+    }
+
+    // CNOTs that move the parity of the qubits into the first one (an involution)
+    void parity(std::vector<logical_qubit_id> const& qs)
+    {
+        for (std::size_t i = 1; i < qs.size(); ++i)
+            cx(qs[i], qs[0]);
+    }
+
+    // doubles the number of columns, in multiples of 64
+    void grow()
+    {
+        const unsigned ncap = std::max(64u, 2 * ncap_);
+        const std::size_t words = ncap / 64;
+        std::vector<std::uint64_t> x(2 * ncap * words, 0), z(2 * ncap * words, 0);
+        std::vector<std::uint8_t> r(2 * ncap, 0);
+        for (unsigned i = 0; i < ncols_; ++i)
+        {
+            for (std::size_t from : {std::size_t(i), std::size_t(ncap_ + i)})
+            {
+                std::size_t to = from < ncap_ ? from : from - ncap_ + ncap;
+                std::copy(xrow(from), xrow(from) + words_, &x[to * words]);
+                std::copy(zrow(from), zrow(from) + words_, &z[to * words]);
+                r[to] = r_[from];
+            }
+        }
+        x_.swap(x);
+        z_.swap(z);
+        r_.swap(r);
+        ncap_ = ncap;
+        words_ = words;
+    }
+
+    unsigned ncols_ = 0;     // columns in use (allocated or free)
+    unsigned ncap_ = 0;      // columns with storage
+    std::size_t words_ = 0;  // 64-bit words per row
+    std::vector<std::uint64_t> x_, z_;
+    std::vector<std::uint8_t> r_;
+
+    std::vector<unsigned> column_;          // column of each logical qubit, invalid if not allocated
+    std::vector<unsigned> free_;            // columns of released qubits, in |0>
+    std::vector<logical_qubit_id> order_;   // allocated qubits in the order of allocation
+};
+
+} // namespace SIMULATOR
+} // namespace Quantum
+} // namespace Microsoft
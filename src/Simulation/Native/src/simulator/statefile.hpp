@@ -0,0 +1,178 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include "types.hpp"
+#include "util/openmp.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace SIMULATOR
+{
+/// Binary state files.
+///
+/// A state file starts with a fixed header, followed by the logical ids of the qubits in the order of their positions in
+/// the state vector (one uint32 per qubit, that is, the inverse of the wave function's qubit map), followed by the
+/// 2^num_qubits amplitudes as raw (re, im) pairs of `real_size` bytes each, in the order of the basis state index. All
+/// numbers are stored in the native (little-endian) byte order. The amplitudes are written and read in large chunks
+/// which, on POSIX systems, are transferred by several threads at once.
+namespace statefile
+{
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t real_size;
+    uint32_t num_qubits;
+    uint32_t reserved;
+};
+
+constexpr char magic[8] = {'Q', 'S', 'I', 'M', 'S', 'T', 'A', 'T'};
+constexpr uint32_t version = 1;
+constexpr std::size_t chunk_bytes = 1ull << 24;
+
+inline std::size_t amplitudes_offset(std::size_t num_qubits)
+{
+    return sizeof(Header) + num_qubits * sizeof(uint32_t);
+}
+
+namespace detail
+{
+// Transfers `bytes` bytes between `buffer` and the file at `offset`, chunk by chunk. `write` selects the direction.
+inline bool transfer(std::FILE* file, std::size_t offset, char* buffer, std::size_t bytes, bool write)
+{
+    const std::intptr_t nchunks = static_cast<std::intptr_t>((bytes + chunk_bytes - 1) / chunk_bytes);
+    bool ok = true;
+#ifndef _WIN32
+    const int fd = fileno(file);
+#pragma omp parallel for schedule(static, 1) reduction(&& : ok)
+    for (std::intptr_t c = 0; c < nchunks; ++c)
+    {
+        std::size_t done = c * chunk_bytes;
+        const std::size_t end = std::min(bytes, done + chunk_bytes);
+        while (ok && done < end)
+        {
+            ssize_t n = write ? pwrite(fd, buffer + done, end - done, static_cast<off_t>(offset + done))
+                              : pread(fd, buffer + done, end - done, static_cast<off_t>(offset + done));
+            if (n <= 0)
+                ok = false;
+            else
+                done += static_cast<std::size_t>(n);
+        }
+    }
+#else
+    if (_fseeki64(file, static_cast<long long>(offset), SEEK_SET) != 0) return false;
+    for (std::intptr_t c = 0; c < nchunks && ok; ++c)
+    {
+        const std::size_t start = c * chunk_bytes;
+        const std::size_t n = std::min(bytes, start + chunk_bytes) - start;
+        ok = (write ? fwrite(buffer + start, 1, n, file) : fread(buffer + start, 1, n, file)) == n;
+    }
+#endif
+    return ok;
+}
+} // namespace detail
+
+/// Writes a state file with the amplitudes of `ids.size()` qubits. Returns false if the file couldn't be written.
+inline bool write(std::string const& path, std::vector<uint32_t> const& ids, ComplexType const* amplitudes)
+{
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.real_size = sizeof(RealType);
+    header.num_qubits = static_cast<uint32_t>(ids.size());
+    header.reserved = 0;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && (ids.empty() || std::fwrite(ids.data(), sizeof(uint32_t), ids.size(), file) == ids.size());
+    ok = ok && std::fflush(file) == 0;
+    ok = ok && detail::transfer(
+                   file,
+                   amplitudes_offset(ids.size()),
+                   reinterpret_cast<char*>(const_cast<ComplexType*>(amplitudes)),
+                   (1ull << ids.size()) * sizeof(ComplexType),
+                   true);
+    return (std::fclose(file) == 0) && ok;
+}
+
+/// Reads a state file. The file is opened by the constructor, `ok` reports whether it has a valid header with the same
+/// precision as this build.
+class Reader
+{
+  public:
+    explicit Reader(std::string const& path)
+        : file_(std::fopen(path.c_str(), "rb"))
+    {
+        Header header;
+        ok_ = file_ != nullptr && std::fread(&header, sizeof(header), 1, file_) == 1 &&
+              std::memcmp(header.magic, magic, sizeof(magic)) == 0 && header.version == version &&
+              header.real_size == sizeof(RealType) && header.num_qubits < 8 * sizeof(std::size_t);
+        if (ok_)
+        {
+            ids_.resize(header.num_qubits);
+            ok_ = ids_.empty() || std::fread(ids_.data(), sizeof(uint32_t), ids_.size(), file_) == ids_.size();
+        }
+    }
+
+    ~Reader()
+    {
+        if (file_ != nullptr) std::fclose(file_);
+    }
+
+    Reader(Reader const&) = delete;
+    Reader& operator=(Reader const&) = delete;
+
+    bool ok() const
+    {
+        return ok_;
+    }
+
+    /// logical ids of the qubits, in the order of their positions
+    std::vector<uint32_t> const& ids() const
+    {
+        return ids_;
+    }
+
+    std::size_t size() const
+    {
+        return 1ull << ids_.size();
+    }
+
+    /// reads the `size()` amplitudes into `amplitudes`
+    bool read(ComplexType* amplitudes)
+    {
+        return ok_ && detail::transfer(
+                          file_,
+                          amplitudes_offset(ids_.size()),
+                          reinterpret_cast<char*>(amplitudes),
+                          size() * sizeof(ComplexType),
+                          false);
+    }
+
+  private:
+    std::FILE* file_;
+    bool ok_;
+    std::vector<uint32_t> ids_;
+};
+} // namespace statefile
+} // namespace SIMULATOR
+} // namespace Quantum
+} // namespace Microsoft
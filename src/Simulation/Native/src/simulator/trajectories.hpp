@@ -0,0 +1,360 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "circuit.hpp"
+#include "simulatorinterface.hpp"
+#include "util/openmp.hpp"
+#include "util/philox.hpp"
+#include "util/worker.hpp"
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace Simulator
+{
+
+/// A single-qubit noise channel. Pauli channels are sampled before a trajectory starts; other channels are given by
+/// Kraus operators, which are sampled with the probabilities of the current state when the trajectory reaches them.
+class NoiseChannel
+{
+  public:
+    using Matrix = std::array<ComplexType, 4>; // row major
+
+    /// applies X, Y and Z with the given probabilities
+    static NoiseChannel pauli(double px, double py, double pz)
+    {
+        if (px < 0. || py < 0. || pz < 0. || px + py + pz > 1.)
+            throw std::runtime_error("the Pauli error probabilities must be nonnegative and sum to at most 1");
+        NoiseChannel channel;
+        channel.pauli_ = {1. - px - py - pz, px, py, pz};
+        return channel;
+    }
+
+    /// decay of |1> to |0> with probability gamma
+    static NoiseChannel amplitude_damping(double gamma)
+    {
+        if (gamma < 0. || gamma > 1.) throw std::runtime_error("the damping probability must be in [0, 1]");
+        const RealType g = static_cast<RealType>(gamma);
+        return kraus({Matrix{1., 0., 0., std::sqrt(1 - g)}, Matrix{0., std::sqrt(g), 0., 0.}});
+    }
+
+    /// a general channel, the operators must satisfy sum_i K_i^dagger K_i = 1
+    static NoiseChannel kraus(std::vector<Matrix> operators)
+    {
+        Matrix sum = {0., 0., 0., 0.};
+        for (auto const& k : operators)
+            for (unsigned i = 0; i < 2; ++i)
+                for (unsigned j = 0; j < 2; ++j)
+                    for (unsigned l = 0; l < 2; ++l)
+                        sum[2 * i + j] += std::conj(k[2 * l + i]) * k[2 * l + j];
+        if (std::abs(sum[0] - ComplexType(1.)) > 1e-6 || std::abs(sum[3] - ComplexType(1.)) > 1e-6 ||
+            std::abs(sum[1]) > 1e-6)
+            throw std::runtime_error("the Kraus operators are not trace preserving");
+
+        NoiseChannel channel;
+        channel.kraus_ = std::move(operators);
+        return channel;
+    }
+
+    bool is_pauli() const
+    {
+        return kraus_.empty();
+    }
+
+    /// the probabilities of I, X, Y and Z
+    std::array<double, 4> const& pauli_probabilities() const
+    {
+        return pauli_;
+    }
+
+    std::vector<Matrix> const& kraus_operators() const
+    {
+        return kraus_;
+    }
+
+  private:
+    NoiseChannel() = default;
+
+    std::array<double, 4> pauli_ = {1., 0., 0., 0.};
+    std::vector<Matrix> kraus_;
+};
+
+/// The noise of a device: a channel per kind of operation, applied to every qubit of the operation after gates and
+/// before measurements.
+class NoiseModel
+{
+  public:
+    void set(Operation::Kind kind, NoiseChannel const& channel)
+    {
+        channels_.erase(kind);
+        channels_.emplace(kind, channel);
+    }
+
+    NoiseChannel const* channel(Operation::Kind kind) const
+    {
+        auto it = channels_.find(kind);
+        return it == channels_.end() ? nullptr : &it->second;
+    }
+
+  private:
+    std::map<unsigned, NoiseChannel> channels_;
+};
+
+/// Runs noisy trajectories of a circuit. Every trajectory follows the noiseless run up to its first error (or
+/// measurement, or non-Pauli channel), so the trajectories are ordered by that point and forked from a single noiseless
+/// simulator as it passes there: the prefix is simulated once rather than once per trajectory. The forks run
+/// concurrently, each on its own worker thread with a share of the cores.
+///
+/// Trajectory t draws all its random numbers (the Pauli errors, the Kraus operators and the measurement outcomes) from
+/// stream t of a Philox generator keyed by the seed, so the results don't depend on the scheduling.
+class TrajectoryEngine
+{
+  public:
+    /// Called on a worker thread with the final state and the measurement outcomes of a trajectory.
+    using Callback = std::function<void(unsigned trajectory, SimulatorInterface& state, std::vector<bool> const&)>;
+
+    TrajectoryEngine(Circuit circuit, NoiseModel noise)
+        : circuit_(std::move(circuit))
+        , noise_(std::move(noise))
+    {
+    }
+
+    /// Number of trajectories that run at the same time, 0 to pick it from the number of qubits and cores.
+    void set_concurrency(unsigned groups)
+    {
+        groups_ = groups;
+    }
+
+    /// Runs the trajectories from the state of `initial`, which stays unchanged, and returns the measurement outcomes
+    /// of every trajectory in the order of the measurements in the circuit.
+    std::vector<std::vector<bool>> run(
+        SimulatorInterface const& initial,
+        unsigned trajectories,
+        unsigned seed,
+        Callback callback = nullptr)
+    {
+        std::vector<Trajectory> ts(trajectories);
+        for (unsigned t = 0; t < trajectories; ++t)
+            sample(t, seed, ts[t]);
+        std::vector<unsigned> order(trajectories);
+        for (unsigned t = 0; t < trajectories; ++t)
+            order[t] = t;
+        std::stable_sort(order.begin(), order.end(), [&ts](unsigned a, unsigned b) { return ts[a].shared < ts[b].shared; });
+
+        const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        unsigned groups = groups_;
+        if (groups == 0)
+        {
+            const unsigned n = initial.num_qubits();
+            const unsigned per_group = n < 14 ? 1u : n < 20 ? 4u : cores;
+            groups = std::max(1u, cores / per_group);
+        }
+        groups = std::max(1u, std::min(groups, trajectories));
+        const unsigned per_group = std::max(1u, cores / groups);
+
+        std::vector<std::vector<bool>> results(trajectories);
+        std::vector<std::unique_ptr<BackgroundWorker>> workers(groups);
+        std::vector<std::future<void>> pending(groups);
+        for (auto& w : workers)
+            w.reset(new BackgroundWorker());
+
+        // the noiseless run, on the calling thread
+        const unsigned budget = openmp::thread_budget();
+        openmp::thread_budget() = per_group;
+        std::unique_ptr<SimulatorInterface> base(initial.clone());
+        std::size_t step = 0;
+
+        try
+        {
+            for (std::size_t k = 0; k < order.size(); ++k)
+            {
+                Trajectory& tr = ts[order[k]];
+                for (; step < tr.shared; ++step)
+                    if (step % 3 == 1) apply(*base, circuit_[step / 3]);
+                std::shared_ptr<SimulatorInterface> fork(base->clone());
+
+                // at most one trajectory per worker is waiting or running, which bounds the number of states
+                const unsigned w = static_cast<unsigned>(k % groups);
+                if (pending[w].valid()) pending[w].get();
+                pending[w] = workers[w]->submit([this, &tr, &results, &callback, fork, per_group]() {
+#ifdef _OPENMP
+                    omp_set_num_threads(static_cast<int>(per_group));
+#endif
+                    openmp::thread_budget() = per_group;
+                    results[tr.id] = finish(*fork, tr);
+                    if (callback) callback(tr.id, *fork, results[tr.id]);
+                });
+            }
+            for (auto& p : pending)
+                if (p.valid()) p.get();
+        }
+        catch (...)
+        {
+            for (auto& p : pending)
+                if (p.valid()) p.wait();
+            openmp::thread_budget() = budget;
+            throw;
+        }
+        openmp::thread_budget() = budget;
+        return results;
+    }
+
+  private:
+    // Operation j is split into three steps: 3 j applies the noise before a measurement, 3 j + 1 the operation and
+    // 3 j + 2 the noise after a gate.
+    struct PauliError
+    {
+        std::size_t step;
+        logical_qubit_id qubit;
+        Operation::Kind pauli;
+    };
+
+    struct Trajectory
+    {
+        unsigned id = 0;
+        std::size_t shared = 0; // number of steps shared with the noiseless run
+        std::vector<PauliError> errors;
+        Philox4x32 rng; // the stream of the trajectory
+    };
+
+    // Draws the Pauli errors of trajectory t and finds the first step where it leaves the noiseless run.
+    void sample(unsigned t, unsigned seed, Trajectory& tr) const
+    {
+        tr.id = t;
+        tr.rng.seed(seed, t);
+        tr.shared = 3 * circuit_.size();
+        for (std::size_t j = 0; j < circuit_.size(); ++j)
+        {
+            Operation const& op = circuit_[j];
+            const bool measurement = (op.kind == Operation::M);
+            const std::size_t step = measurement ? 3 * j : 3 * j + 2;
+            if (measurement) tr.shared = std::min(tr.shared, 3 * j + 1);
+
+            NoiseChannel const* channel = noise_.channel(op.kind);
+            if (channel == nullptr) continue;
+            if (!channel->is_pauli())
+            {
+                tr.shared = std::min(tr.shared, step);
+                continue;
+            }
+            auto const& p = channel->pauli_probabilities();
+            for (logical_qubit_id q : op.qubits())
+            {
+                double u = tr.rng.uniform();
+                if (u < p[0]) continue;
+                const Operation::Kind pauli = u < p[0] + p[1] ? Operation::X : u < p[0] + p[1] + p[2] ? Operation::Y : Operation::Z;
+                tr.errors.push_back(PauliError{step, q, pauli});
+                tr.shared = std::min(tr.shared, step);
+            }
+        }
+    }
+
+    // runs the steps of the trajectory after the shared prefix
+    std::vector<bool> finish(SimulatorInterface& sim, Trajectory& tr) const
+    {
+        sim.seed(static_cast<unsigned>(tr.rng()));
+        std::vector<bool> outcomes;
+        auto error = tr.errors.begin();
+        for (std::size_t step = 0; step < 3 * circuit_.size(); ++step)
+        {
+            Operation const& op = circuit_[step / 3];
+            const bool measurement = (op.kind == Operation::M);
+            if (step % 3 == 1)
+            {
+                if (measurement)
+                    outcomes.push_back(apply(sim, op));
+                else if (step >= tr.shared)
+                    apply(sim, op);
+                continue;
+            }
+            if ((step % 3 == 0) != measurement) continue;
+
+            NoiseChannel const* channel = noise_.channel(op.kind);
+            if (channel == nullptr) continue;
+            if (channel->is_pauli())
+            {
+                for (; error != tr.errors.end() && error->step == step; ++error)
+                    apply(sim, Operation::gate(error->pauli, error->qubit));
+            }
+            else
+            {
+                for (logical_qubit_id q : op.qubits())
+                    apply_kraus(sim, *channel, q, tr.rng);
+            }
+        }
+        return outcomes;
+    }
+
+    // Picks K_i with probability p_i = <K_i^dagger K_i> and applies K_i / sqrt(p_i). The expectations of the Hermitian
+    // matrices K_i^dagger K_i are combined from the expectations of X, Y and Z, which are only computed if needed.
+    static void apply_kraus(SimulatorInterface& sim, NoiseChannel const& channel, logical_qubit_id q, Philox4x32& rng)
+    {
+        double expectation[4] = {1., 0., 0., 0.}; // I, X, Y, Z
+        bool known[4] = {true, false, false, false};
+        auto pauli_expectation = [&](unsigned b, Gates::Basis basis) {
+            if (!known[b])
+            {
+                expectation[b] = 1. - 2. * sim.JointEnsembleProbability({basis}, {q});
+                known[b] = true;
+            }
+            return expectation[b];
+        };
+
+        auto const& ks = channel.kraus_operators();
+        std::vector<double> p(ks.size());
+        for (std::size_t i = 0; i < ks.size(); ++i)
+        {
+            auto const& k = ks[i];
+            ComplexType m[4] = {0., 0., 0., 0.};
+            for (unsigned r = 0; r < 2; ++r)
+                for (unsigned c = 0; c < 2; ++c)
+                    for (unsigned l = 0; l < 2; ++l)
+                        m[2 * r + c] += std::conj(k[2 * l + r]) * k[2 * l + c];
+            double value = 0.5 * (m[0].real() + m[3].real()) + 0.5 * (m[0].real() - m[3].real()) * pauli_expectation(3, Gates::PauliZ);
+            if (m[1].real() != 0.) value += m[1].real() * pauli_expectation(1, Gates::PauliX);
+            if (m[1].imag() != 0.) value -= m[1].imag() * pauli_expectation(2, Gates::PauliY);
+            p[i] = std::max(0., value);
+        }
+
+        double x = rng.uniform() * std::accumulate(p.begin(), p.end(), 0.);
+        std::size_t i = 0, last = 0;
+        for (; i < p.size(); ++i)
+        {
+            if (p[i] <= 0.) continue;
+            last = i;
+            if (x < p[i]) break;
+            x -= p[i];
+        }
+        if (i == p.size()) i = last; // x rounded up to the total
+        const RealType scale = static_cast<RealType>(1. / std::sqrt(p[i]));
+        std::vector<ComplexType> matrix(ks[i].begin(), ks[i].end());
+        for (auto& x : matrix)
+            x *= scale;
+        sim.ApplyControlledMatrix({}, {q}, matrix);
+    }
+
+    Circuit circuit_;
+    NoiseModel noise_;
+    unsigned groups_ = 0;
+};
+
+} // namespace Simulator
+} // namespace Quantum
+} // namespace Microsoft
@@ -3,22 +3,34 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <complex>
 #include <ctime>
+#include <exception>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <list>
+#include <memory>
 #include <random>
+#include <stdexcept>
 #include <string.h>
 #include <vector>
 #include <chrono>
 
 #include "gates.hpp"
+#include "perfcounters.hpp"
+#include "statefile.hpp"
 #include "types.hpp"
 
 #include "external/fused.hpp"
+#include "util/memorybudget.hpp"
+#include "util/philox.hpp"
+#include "util/tracing.hpp"
+#include "util/worker.hpp"
 
 namespace Microsoft
 {
@@ -367,14 +379,124 @@ class Wavefunction
     /// TODO: add comment
     Fused fused_;
 
-    /// TODO: add comment
-    using RngEngine = std::mt19937;
+    /// In asynchronous mode, flushes triggered by a full gate cache run on a background worker and `pending_flush_`
+    /// completes when the state is up to date. Everything that touches the state waits for it first.
+    bool async_flush_ = false;
+    mutable std::unique_ptr<BackgroundWorker> worker_;
+    mutable std::future<void> pending_flush_;
+
+    /// Gates of a flush that failed before they were applied, see apply_clusters.
+    mutable std::vector<DeferredGate> unapplied_gates_;
+
+    /// see set_shrink_threshold
+    unsigned shrink_slack_ = 2;
+
+    /// see set_memory_budget and footprint
+    std::size_t memory_budget_ = 0;
+    mutable std::size_t peak_footprint_ = 0;
+
+    /// What is known about the qubits without looking at the state, indexed by logical id: 0 or 1 if the qubit is in
+    /// that basis state, -1 if nothing is known. It is updated as the gates arrive (X and CNOT flip a known value,
+    /// diagonal gates and measurements keep or set it, all other gates clear it), so it describes the state after the
+    /// pending gates, and lets `isclassical` and `getvalue` skip the scan of the state for uncomputed ancillas.
+    mutable std::vector<signed char> classical_;
+
+    /// Work done on this state, see PerfCounters. The fused kernels of an asynchronous flush update it from the worker.
+    mutable PerfCounters counters_;
+
+    /// Counter-based, so that a copy continues with the same sequence and the draws don't depend on the threads.
+    using RngEngine = Philox4x32;
     RngEngine rng_;
 
 #ifndef NDEBUG
     QubitAllocationPattern usage_ = QubitAllocationPattern::any;
 #endif
 
+    signed char known_value(logical_qubit_id q) const
+    {
+        return q < classical_.size() ? classical_[q] : -1;
+    }
+
+    void set_known_value(logical_qubit_id q, signed char value) const
+    {
+        if (q >= classical_.size()) classical_.resize(q + 1, -1);
+        classical_[q] = value;
+    }
+
+    void forget_values(std::vector<logical_qubit_id> const& qs) const
+    {
+        for (logical_qubit_id q : qs)
+            set_known_value(q, -1);
+    }
+
+    // queues the single-qubit gate `m` on q, controlled on cs
+    void queue_gate(std::vector<logical_qubit_id> const& cs, logical_qubit_id q, TinyMatrix<ComplexType, 2> const& m)
+    {
+        pending_gates_.emplace_back(cs, q, m);
+        ++counters_.gates_queued;
+        track_gate(cs, q, m);
+        if (pending_gates_.size() > MAX_PENDING_GATES)
+        {
+            flush_async();
+        }
+
+        fused_.shouldFlush(wfn_, cs, q);
+    }
+
+    // the controls keep their values; a gate with a control known to be 0 does nothing
+    void track_gate(std::vector<logical_qubit_id> const& cs, logical_qubit_id q, TinyMatrix<ComplexType, 2> const& m)
+    {
+        if (std::norm(m(0, 1)) == 0 && std::norm(m(1, 0)) == 0) return;
+        bool active = true;
+        for (logical_qubit_id c : cs)
+        {
+            const signed char v = known_value(c);
+            if (v == 0) return;
+            active = active && (v == 1);
+        }
+        const bool flip = std::norm(m(0, 0)) == 0 && std::norm(m(1, 1)) == 0;
+        const signed char v = known_value(q);
+        set_known_value(q, active && flip && v >= 0 ? 1 - v : -1);
+    }
+
+    // bytes of `sweeps` passes over the state
+    double sweep_bytes(unsigned sweeps = 1) const
+    {
+        return static_cast<double>(sweeps) * wfn_.size() * sizeof(T);
+    }
+
+    // bytes of a state buffer of `size` amplitudes, with its alignment slack
+    static std::size_t state_bytes(std::size_t size)
+    {
+        return size * sizeof(T) + 64;
+    }
+
+    // Checks that a new state buffer of `size` amplitudes fits into the memory budgets next to the current footprint
+    // (the old buffer lives until the amplitudes are copied), before anything is allocated or copied.
+    void admit(std::size_t size, const char* operation) const
+    {
+        const std::size_t bytes = state_bytes(size), used = footprint();
+        if (memory_budget_ > 0 && used + bytes > memory_budget_)
+            throw MemoryBudgetExceeded("simulator", operation, bytes, used, memory_budget_);
+        MemoryBudget::instance().admit(bytes, operation);
+        peak_footprint_ = std::max(peak_footprint_, used + bytes);
+    }
+
+    void grow(std::size_t size, const char* operation)
+    {
+        if (size > wfn_.capacity()) admit(size, operation);
+        wfn_.resize(size);
+    }
+
+    void shrink()
+    {
+        if (shrink_slack_ == 0 || shrink_slack_ >= 64 || (wfn_.capacity() >> shrink_slack_) < wfn_.size()) return;
+        WavefunctionStorage smaller;
+        smaller.reserve(wfn_.size() << (shrink_slack_ - 1));
+        kernels::parallel_copy(wfn_, smaller);
+        smaller.swap(wfn_);
+    }
+
   public:
     using value_type = T;
 
@@ -383,24 +505,54 @@ class Wavefunction
         : num_qubits_(0)
         , wfn_(1, 1.)
     {
-        rng_.seed((unsigned)std::chrono::system_clock::now().time_since_epoch().count());
+        rng_.seed(static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()));
+    }
+
+    /// Copy the state of `other`, including the positions of its qubits and the state of its random number engine, so
+    /// that the copy continues with the same sequence of measurement outcomes. Pending gates of `other` are flushed
+    /// before copying. The copy keeps the memory budget and the shrink policy of `other`; an assignment keeps those of
+    /// the target.
+    Wavefunction(Wavefunction const& other)
+        : num_qubits_(0)
+        , shrink_slack_(other.shrink_slack_)
+        , memory_budget_(other.memory_budget_)
+    {
+        assign(other);
+    }
+
+    Wavefunction& operator=(Wavefunction const& other)
+    {
+        if (this != &other) assign(other);
+        return *this;
     }
 
     void reset()
     {
+        wait_for_flush();
         fused_.reset();
-        rng_.seed((unsigned)std::chrono::system_clock::now().time_since_epoch().count());
+        rng_.seed(static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()));
         num_qubits_ = 0;
         wfn_.resize(1);
         wfn_[0] = 1.;
         qubitmap_.resize(0);
+        classical_.clear();
+        shrink();
 
         // what about pending_gates_?
     }
 
     ~Wavefunction()
     {
-        flush();
+        // the background worker may still be applying gates to the state; an exception of it can't leave the
+        // destructor and doesn't matter anymore, and gates that are still pending needn't be applied to a state that
+        // is discarded
+        try
+        {
+            wait_for_flush();
+        }
+        catch (...)
+        {
+        }
     }
 
     constexpr positional_qubit_id invalid_qubit_position() const
@@ -442,37 +594,116 @@ class Wavefunction
         return qs;
     }
 
-    void flush() const
+    void flush(PerfCounters::FlushReason reason = PerfCounters::StateAccess) const
     {
-        std::list<Cluster> clusters = Cluster::make_clusters(fused_.maxSpan(), fused_.maxDepth(), pending_gates_);
+        wait_for_flush();
+        if (pending_gates_.empty())
+        {
+            apply_clusters({});
+            return;
+        }
 
-        if (clusters.empty())
+        ++counters_.flushes[reason];
+        TraceScope trace("flush");
+        std::list<Cluster> clusters = Cluster::make_clusters(fused_.maxSpan(), fused_.maxDepth(), pending_gates_);
+        pending_gates_.clear();
+        try
         {
-            fused_.flush(wfn_);
+            apply_clusters(clusters);
         }
-        else
+        catch (...)
         {
-            // logic to flush gates in each cluster
-            for (const Cluster& cl : clusters)
-            {
-                for (const DeferredGate& gate : cl.get_gates())
-                {
-                    const std::vector<logical_qubit_id>& cs = gate.get_controls();
-                    if (cs.size() == 0)
-                    {
-                        fused_.apply(wfn_, gate.get_mat(), get_qubit_position(gate.get_target()));
-                    }
-                    else
-                    {
-                        fused_.apply_controlled(
-                            wfn_, gate.get_mat(), get_qubit_positions(cs), get_qubit_position(gate.get_target()));
-                    }
-                }
+            requeue_unapplied_gates();
+            throw;
+        }
+    }
 
-                fused_.flush(wfn_);
-            }
+    /// Like `flush`, but in asynchronous mode the fused gates are applied by the background worker while the caller
+    /// keeps queueing gates. The clustering is still done by the caller, so the gate cache can be reused right away.
+    void flush_async() const
+    {
+        if (!async_flush_)
+        {
+            flush(PerfCounters::GateCacheFull);
+            return;
         }
+
+        wait_for_flush();
+        ++counters_.flushes[PerfCounters::GateCacheFull];
+        TraceScope trace("flush");
+        auto clusters = std::make_shared<std::list<Cluster>>(
+            Cluster::make_clusters(fused_.maxSpan(), fused_.maxDepth(), pending_gates_));
         pending_gates_.clear();
+
+        // the number of threads is a setting of the calling thread, the worker has to adopt it
+        int nthreads = omp_get_max_threads();
+        if (!worker_) worker_.reset(new BackgroundWorker());
+        pending_flush_ = worker_->submit([this, clusters, nthreads]() {
+#ifdef _OPENMP
+            omp_set_num_threads(nthreads);
+#endif
+            apply_clusters(*clusters);
+        });
+    }
+
+    /// Blocks until the state reflects all flushed gates. Rethrows exceptions of an asynchronous flush, whose gates
+    /// that weren't applied are pending again.
+    void wait_for_flush() const
+    {
+        if (!pending_flush_.valid()) return;
+        try
+        {
+            pending_flush_.get();
+        }
+        catch (...)
+        {
+            requeue_unapplied_gates();
+            throw;
+        }
+    }
+
+    // puts the gates of a failed flush back in front of the gates that were queued since
+    void requeue_unapplied_gates() const
+    {
+        pending_gates_.insert(pending_gates_.begin(), unapplied_gates_.begin(), unapplied_gates_.end());
+        unapplied_gates_.clear();
+    }
+
+    /// Turns asynchronous flushing on or off. Turning it off applies all pending gates.
+    void set_async_flush(bool enable)
+    {
+        if (!enable) flush();
+        async_flush_ = enable;
+    }
+
+    /// The counters of the work done on the state since construction or the last reset of the counters.
+    PerfCounters& perf_counters() const
+    {
+        wait_for_flush();
+        return counters_;
+    }
+
+    /// Replace the state by a state of `num_qubits` qubits, whose positions are given by `qubitmap` (indexed by logical
+    /// id, with invalid positions for the ids that aren't allocated). `fill` writes the 2^num_qubits amplitudes.
+    template <class F>
+    void assign_state(std::vector<positional_qubit_id> const& qubitmap, unsigned num_qubits, F&& fill)
+    {
+        flush();
+        grow(std::size_t(1) << num_qubits, "assigning the state");
+        num_qubits_ = num_qubits;
+        qubitmap_ = qubitmap;
+        classical_.clear();
+        fill(wfn_.data());
+    }
+
+    /// Lets `modify` change the amplitudes in place, e.g. to exchange them with the other parts of a sharded state. The
+    /// pending gates are applied first, and what is known about the values of the qubits is forgotten.
+    template <class F>
+    void modify_state(F&& modify)
+    {
+        flush();
+        modify(wfn_);
+        classical_.clear();
     }
 
     /// Allocate a qubit with implicitly assigned logical qubit id.
@@ -484,7 +715,8 @@ class Wavefunction
 #endif
 
         flush();
-        wfn_.resize(2 * wfn_.size());
+        TraceScope trace("allocate");
+        grow(2 * wfn_.size(), "allocating a qubit");
 
         // Reuse a logical qubit id, if any is available.
         auto it = std::find(qubitmap_.begin(), qubitmap_.end(), invalid_qubit_position());
@@ -492,11 +724,13 @@ class Wavefunction
         {
             logical_qubit_id num = static_cast<unsigned>(it - qubitmap_.begin());
             qubitmap_[num] = num_qubits_++;
+            set_known_value(num, 0);
             return num;
         }
         else
         {
             qubitmap_.push_back(num_qubits_++);
+            set_known_value(static_cast<unsigned>(qubitmap_.size() - 1), 0);
             return static_cast<unsigned>(qubitmap_.size() - 1);
         }
     }
@@ -511,7 +745,8 @@ class Wavefunction
 #endif
 
         flush();
-        wfn_.resize(2 * wfn_.size());
+        TraceScope trace("allocate");
+        grow(2 * wfn_.size(), "allocating a qubit");
 
         if (id < qubitmap_.size())
         {
@@ -523,6 +758,7 @@ class Wavefunction
             assert(id == qubitmap_.size()); // we want qubitmap_ to be as small as possible
             qubitmap_.push_back(num_qubits_++);
         }
+        set_known_value(id, 0);
         assert((wfn_.size() >> num_qubits_) == 1);
     }
 
@@ -530,13 +766,80 @@ class Wavefunction
     /// \pre the qubit has to be in a classical state in the computational basis
     void release(logical_qubit_id q)
     {
-        positional_qubit_id p = get_qubit_position(q);
+        release(std::vector<logical_qubit_id>{q});
+    }
+
+    /// release the specified qubits, removing all of them from the state in one pass
+    /// \pre the qubits have to be in a classical state in the computational basis
+    void release(std::vector<logical_qubit_id> const& qs)
+    {
         flush();
-        kernels::collapse(wfn_, p, getvalue(q), true);
-        for (int i = 0; i < qubitmap_.size(); ++i)
-            if (qubitmap_[i] > p && qubitmap_[i] != invalid_qubit_position()) qubitmap_[i]--;
-        qubitmap_[q] = invalid_qubit_position();
-        --num_qubits_;
+        std::vector<std::pair<positional_qubit_id, logical_qubit_id>> released;
+        released.reserve(qs.size());
+        for (logical_qubit_id q : qs)
+            released.emplace_back(get_qubit_position(q), q);
+        std::sort(released.begin(), released.end());
+
+        std::vector<unsigned> ps;
+        std::size_t values = 0;
+        for (std::size_t i = 0; i < released.size(); ++i)
+        {
+            ps.push_back(released[i].first);
+            if (getvalue(released[i].second)) values |= 1ull << i;
+        }
+        {
+            TraceScope trace("release", ps);
+            KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes(2));
+            kernels::compact(wfn_, ps, values);
+        }
+
+        for (auto& p : qubitmap_)
+            if (p != invalid_qubit_position())
+                p -= static_cast<positional_qubit_id>(std::lower_bound(ps.begin(), ps.end(), p) - ps.begin());
+        for (logical_qubit_id q : qs)
+            qubitmap_[q] = invalid_qubit_position();
+        forget_values(qs);
+        num_qubits_ -= static_cast<unsigned>(qs.size());
+        shrink();
+    }
+
+    /// Same as `release(q)`, for a qubit whose value the caller knows. A state that is one part of a larger state
+    /// might not show the value in its own amplitudes, which can all be 0.
+    void release(logical_qubit_id q, bool value)
+    {
+        set_known_value(q, value ? 1 : 0);
+        release(q);
+    }
+
+    /// After releasing qubits, the memory of the state is given back once the buffer could hold a state of `slack` more
+    /// qubits, and the smaller buffer keeps `slack` - 1 qubits of headroom. 0 never shrinks the buffer, which is best for
+    /// programs that allocate again soon; the default of 2 keeps one qubit of headroom, so a qubit that is released and
+    /// allocated again doesn't reallocate.
+    void set_shrink_threshold(unsigned slack)
+    {
+        shrink_slack_ = slack;
+        shrink();
+    }
+
+    /// Limits the memory of this state to `bytes` (0: no limit). Allocations of qubits and other operations that would
+    /// need more fail with MemoryBudgetExceeded before anything is changed. The process-wide limit of MemoryBudget is
+    /// checked as well.
+    void set_memory_budget(std::size_t bytes)
+    {
+        memory_budget_ = bytes;
+    }
+
+    /// Bytes held by the state buffer, the fused matrix and the gate cache, including the alignment slack.
+    std::size_t footprint() const
+    {
+        wait_for_flush();
+        return state_bytes(wfn_.capacity()) + fused_.matrixBytes() + pending_gates_.capacity() * sizeof(DeferredGate);
+    }
+
+    /// The largest footprint so far, including the transient peaks when the state buffer is reallocated.
+    std::size_t peak_footprint() const
+    {
+        return peak_footprint_ = std::max(peak_footprint_, footprint());
     }
 
     /// the number of used qubits
@@ -549,6 +852,7 @@ class Wavefunction
     double probability(logical_qubit_id q) const
     {
         flush();
+        KernelTimer timer(counters_, PerfCounters::Reduction, sweep_bytes());
         return kernels::probability(wfn_, get_qubit_position(q));
     }
 
@@ -556,6 +860,7 @@ class Wavefunction
     double jointprobability(std::vector<logical_qubit_id> const& qs) const
     {
         flush();
+        KernelTimer timer(counters_, PerfCounters::Reduction, sweep_bytes());
         return kernels::jointprobability(wfn_, get_qubit_positions(qs));
     }
 
@@ -563,6 +868,7 @@ class Wavefunction
     double jointprobability(std::vector<Gates::Basis> const& bs, std::vector<logical_qubit_id> const& qs) const
     {
         flush();
+        KernelTimer timer(counters_, PerfCounters::Reduction, sweep_bytes());
         return kernels::jointprobability(wfn_, bs, get_qubit_positions(qs));
     }
 
@@ -576,6 +882,7 @@ class Wavefunction
         assert((static_cast<size_t>(1) << qubits.size()) == amplitudes.size());
 
         flush();
+        forget_values(qubits);
 
         if (qubits.size() == num_qubits_)
         {
@@ -614,6 +921,7 @@ class Wavefunction
             // the state might not be injected on adjacently positioned qubits, but get/set_register takes care of that.
             const int64_t num_states = static_cast<int64_t>(wfn_.size());
             const size_t mask = kernels::make_mask(positions);
+            admit(wfn_.size(), "injecting a state");
             WavefunctionStorage wfn_new(num_states);
 
             // For systems with more qubits (>16) the pragma yields x2-x4 performance boost in the micro benchmarks run
@@ -634,25 +942,79 @@ class Wavefunction
         return true;
     }
 
+    /// Writes the state into a binary state file (see statefile.hpp). Returns false if the file couldn't be written.
+    bool save_state(std::string const& path) const
+    {
+        flush();
+        std::vector<uint32_t> ids(num_qubits_);
+        for (logical_qubit_id q = 0; q < qubitmap_.size(); ++q)
+        {
+            if (qubitmap_[q] != invalid_qubit_position()) ids[qubitmap_[q]] = q;
+        }
+        return statefile::write(path, ids, wfn_.data());
+    }
+
+    /// Same as `inject_state` above, but the amplitudes are read from a binary state file, which must describe a state
+    /// of as many qubits as listed in `qubits`. The ids stored in the file are ignored: the qubits are taken in the
+    /// order they are listed. Returns false (and leaves the state unchanged) if the prerequisites aren't satisfied or the
+    /// file isn't a valid state file. When the state of all qubits is injected, the amplitudes are read directly into
+    /// the wave function's storage; should reading fail in the middle, all qubits are reset to |0>.
+    bool inject_state(const std::vector<logical_qubit_id>& qubits, std::string const& path)
+    {
+        statefile::Reader reader(path);
+        if (!reader.ok() || reader.ids().size() != qubits.size()) return false;
+
+        flush();
+        forget_values(qubits);
+        if (qubits.size() != num_qubits_)
+        {
+            std::vector<ComplexType> amplitudes(reader.size());
+            return reader.read(amplitudes.data()) && inject_state(qubits, amplitudes);
+        }
+
+        double eps = 100. * std::numeric_limits<double>::epsilon();
+        if (std::norm(wfn_[0]) < 1.0 - eps)
+        {
+            return false;
+        }
+        if (!reader.read(wfn_.data()))
+        {
+            std::fill(wfn_.begin(), wfn_.end(), T(0.));
+            wfn_[0] = 1.;
+            return false;
+        }
+        for (unsigned i = 0; i < qubits.size(); i++)
+        {
+            qubitmap_[qubits[i]] = i;
+        }
+        return true;
+    }
+
     /// measure a qubit
     bool measure(logical_qubit_id q)
     {
         flush();
-        std::uniform_real_distribution<double> uniform(0., 1.);
-        bool result = (uniform(rng_) < probability(q));
-        kernels::collapse(wfn_, get_qubit_position(q), result);
-        kernels::normalize(wfn_);
+        KernelTimer timer(counters_, PerfCounters::Measurement, sweep_bytes(2));
+        positional_qubit_id p = get_qubit_position(q);
+        TraceScope trace("measure", std::array<positional_qubit_id, 1>{p});
+        double prob0, prob1;
+        kernels::probabilities(wfn_, p, prob0, prob1);
+        bool result = (rng_.uniform() < prob1);
+        kernels::collapse(wfn_, p, result, false, 1. / std::sqrt(result ? prob1 : prob0));
+        set_known_value(q, result ? 1 : 0);
         return result;
     }
 
     bool jointmeasure(std::vector<logical_qubit_id> const& qs)
     {
         flush();
+        KernelTimer timer(counters_, PerfCounters::Measurement, sweep_bytes(2));
         std::vector<positional_qubit_id> ps = get_qubit_positions(qs);
-        std::uniform_real_distribution<double> uniform(0., 1.);
-        bool result = (uniform(rng_) < jointprobability(qs));
-        kernels::jointcollapse(wfn_, ps, result);
-        kernels::normalize(wfn_);
+        TraceScope trace("measure", ps);
+        double prob0, prob1;
+        kernels::jointprobabilities(wfn_, ps, prob0, prob1);
+        bool result = (rng_.uniform() < prob1);
+        kernels::jointcollapse(wfn_, ps, result, 1. / std::sqrt(result ? prob1 : prob0));
         return result;
     }
 
@@ -663,20 +1025,123 @@ class Wavefunction
         std::vector<logical_qubit_id> const& qs)
     {
         flush();
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes());
         kernels::apply_controlled_exp(wfn_, bs, phi, get_qubit_positions(cs), get_qubit_positions(qs));
+        // qubits acted on by I or Z keep their values
+        for (std::size_t i = 0; i < qs.size(); ++i)
+            if (bs[i] == Gates::PauliX || bs[i] == Gates::PauliY) set_known_value(qs[i], -1);
+    }
+
+    /// Applies the 2^k x 2^k matrix `matrix` (row-major, k = qs.size() <= 7) to the qubits qs, controlled on cs. Bit i
+    /// of the row and column indices refers to qs[i]. A single-qubit matrix is queued like a gate and fused with the
+    /// gates around it; a larger one is applied by one sweep of the fused gate kernels.
+    void apply_controlled_matrix(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& matrix)
+    {
+        const std::size_t dim = 1ull << qs.size();
+        assert(qs.size() <= 7 && matrix.size() == dim * dim);
+        if (qs.empty()) return;
+        if (qs.size() == 1)
+        {
+            TinyMatrix<ComplexType, 2> m;
+            for (unsigned i = 0; i < 2; ++i)
+                for (unsigned j = 0; j < 2; ++j)
+                    m(i, j) = matrix[2 * i + j];
+            queue_gate(cs, qs[0], m);
+            return;
+        }
+
+        flush();
+        Fusion::Matrix m(dim, Fusion::Matrix::value_type(dim));
+        for (std::size_t i = 0; i < dim; ++i)
+            for (std::size_t j = 0; j < dim; ++j)
+                m[i][j] = static_cast<Fusion::Complex>(matrix[i * dim + j]);
+        fused_.apply_matrix(std::move(m), get_qubit_positions(qs), get_qubit_positions(cs));
+        {
+            KernelTimer timer(counters_, PerfCounters::Fused, sweep_bytes());
+            fused_.flush(wfn_);
+        }
+        ++counters_.clusters;
+        ++counters_.fused_span[fused_.fusedSpan()];
+        forget_values(qs);
+    }
+
+    /// Multiplies the state by the 2^k diagonal `diagonal` on the qubits qs, controlled on cs. Bit i of the index into
+    /// the diagonal refers to qs[i].
+    void apply_controlled_diagonal(
+        std::vector<logical_qubit_id> const& cs,
+        std::vector<logical_qubit_id> const& qs,
+        std::vector<ComplexType> const& diagonal)
+    {
+        assert(diagonal.size() == 1ull << qs.size());
+        flush();
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes());
+        kernels::apply_controlled_diagonal(
+            wfn_, diagonal, get_qubit_positions(qs), kernels::make_mask(get_qubit_positions(cs)));
+    }
+
+    /// Replaces the state by sum_k coefficients[k] P_k |psi>, where P_k is the product of the Pauli operators bs[k] on
+    /// the qubits qs[k]. The result is not normalized: it is meant for the backward pass of adjoint differentiation,
+    /// which only applies gates and takes overlaps.
+    void apply_pauli_sum(
+        std::vector<double> const& coefficients,
+        std::vector<std::vector<Gates::Basis>> const& bs,
+        std::vector<std::vector<logical_qubit_id>> const& qs)
+    {
+        assert(bs.size() == coefficients.size() && qs.size() == coefficients.size());
+        std::vector<ComplexType> c(coefficients.size());
+        std::vector<std::size_t> xmasks(c.size(), 0), zmasks(c.size(), 0);
+        for (std::size_t k = 0; k < c.size(); ++k)
+        {
+            assert(bs[k].size() == qs[k].size());
+            int y_count = 0;
+            for (std::size_t i = 0; i < bs[k].size(); ++i)
+            {
+                const std::size_t bit = 1ull << get_qubit_position(qs[k][i]);
+                if (bs[k][i] == Gates::PauliX || bs[k][i] == Gates::PauliY) xmasks[k] |= bit;
+                if (bs[k][i] == Gates::PauliZ || bs[k][i] == Gates::PauliY) zmasks[k] |= bit;
+                if (bs[k][i] == Gates::PauliY) ++y_count;
+            }
+            c[k] = static_cast<RealType>(coefficients[k]) * kernels::iExp(y_count);
+        }
+
+        flush();
+        admit(wfn_.size(), "a Pauli sum");
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes(1 + static_cast<unsigned>(c.size())));
+        kernels::apply_pauli_sum(wfn_, c, xmasks, zmasks);
+        for (std::size_t k = 0; k < c.size(); ++k)
+            for (std::size_t i = 0; i < bs[k].size(); ++i)
+                if (bs[k][i] == Gates::PauliX || bs[k][i] == Gates::PauliY) set_known_value(qs[k][i], -1);
+    }
+
+    /// Applies the quantum Fourier transform (or its adjoint) to the register qs, where qs[0] is the least significant
+    /// qubit. See kernels::qft.
+    void qft(std::vector<logical_qubit_id> const& qs, bool adjoint = false)
+    {
+        flush();
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes(2 * qs.size()));
+        kernels::qft(wfn_, get_qubit_positions(qs), adjoint);
+        forget_values(qs);
     }
 
     /// checks if the qubit is in classical state
     bool isclassical(logical_qubit_id q) const
     {
+        if (known_value(q) >= 0) return true;
         flush();
-        return kernels::isclassical(wfn_, get_qubit_position(q));
+        KernelTimer timer(counters_, PerfCounters::Reduction, sweep_bytes());
+        if (!kernels::isclassical(wfn_, get_qubit_position(q))) return false;
+        set_known_value(q, kernels::getvalue(wfn_, get_qubit_position(q)) == 1 ? 1 : 0);
+        return true;
     }
 
     /// returns the classical value of a qubit (if classical)
     /// \pre the qubit has to be in a classical state in the computational basis
     bool getvalue(logical_qubit_id q) const
     {
+        if (known_value(q) >= 0) return known_value(q) == 1;
         flush();
         assert(isclassical(q));
         int res = kernels::getvalue(wfn_, get_qubit_position(q));
@@ -703,27 +1168,14 @@ class Wavefunction
     template <class Gate>
     void apply(Gate const& g)
     {
-        std::vector<logical_qubit_id> cs;
-        pending_gates_.emplace_back(cs, g.qubit(), g.matrix());
-        if (pending_gates_.size() > MAX_PENDING_GATES)
-        {
-            flush();
-        }
-
-        fused_.shouldFlush(wfn_, cs, g.qubit());
+        queue_gate({}, g.qubit(), g.matrix());
     }
 
     /// generic application of a multiply controlled gate
     template <class Gate>
     void apply_controlled(std::vector<logical_qubit_id> cs, Gate const& g)
     {
-        pending_gates_.emplace_back(cs, g.qubit(), g.matrix());
-        if (pending_gates_.size() > MAX_PENDING_GATES)
-        {
-            flush();
-        }
-
-        fused_.shouldFlush(wfn_, cs, g.qubit());
+        queue_gate(cs, g.qubit(), g.matrix());
     }
 
     /// generic application of a controlled gate
@@ -747,6 +1199,42 @@ class Wavefunction
         return kernels::subsytemwavefunction(wfn_, get_qubit_positions(qs), qubitswfn, tolerance);
     }
 
+    /// <this|other>. Both states must have the same logical qubits; the amplitudes are matched by logical ids, whatever
+    /// the positions of the qubits in the two states.
+    std::complex<double> overlap(Wavefunction const& other) const
+    {
+        flush();
+        other.flush();
+        if (num_qubits_ != other.num_qubits_)
+            throw std::runtime_error("the states of an overlap must have the same qubits");
+        std::vector<unsigned> perm(num_qubits_);
+        bool same_order = true;
+        const std::size_t ids = std::max(qubitmap_.size(), other.qubitmap_.size());
+        for (logical_qubit_id q = 0; q < ids; ++q)
+        {
+            const positional_qubit_id p = q < qubitmap_.size() ? qubitmap_[q] : invalid_qubit_position();
+            const positional_qubit_id po = q < other.qubitmap_.size() ? other.qubitmap_[q] : invalid_qubit_position();
+            if ((p == invalid_qubit_position()) != (po == invalid_qubit_position()))
+                throw std::runtime_error("the states of an overlap must have the same qubits");
+            if (p == invalid_qubit_position()) continue;
+            perm[p] = po;
+            same_order = same_order && (p == po);
+        }
+        if (same_order) perm.clear();
+        KernelTimer timer(counters_, PerfCounters::Reduction, 2 * sweep_bytes());
+        return kernels::inner_product(wfn_, other.wfn_, perm);
+    }
+
+    /// The reduced density matrix of the qubits qs, as a row-major 2^k x 2^k matrix whose index has qs[i] as bit i.
+    std::vector<std::complex<double>> reduced_density_matrix(std::vector<logical_qubit_id> const& qs) const
+    {
+        flush();
+        std::vector<std::complex<double>> rho;
+        KernelTimer timer(counters_, PerfCounters::Reduction, sweep_bytes());
+        kernels::reduced_density_matrix(wfn_, get_qubit_positions(qs), rho);
+        return rho;
+    }
+
     /// Apply the unitary operator that permutes the standard computational basis of the subsystem, defined by the
     /// provided qubits. `qs` lists the qubits of the subsystem in little-endian order (the front qubit in the list
     /// corresponds to the last position of the standard computational basis). `table_size` must be equal 2^n, where n
@@ -760,7 +1248,7 @@ class Wavefunction
     /// Note, that the positions of the qubits in the end remain unchanged.
     void permute_basis(
         std::vector<logical_qubit_id> const& qs,
-        size_t table_size,
+        [[maybe_unused]] size_t table_size,
         size_t const* permutation_table,
         bool adjoint = false)
     {
@@ -776,51 +1264,243 @@ class Wavefunction
 #endif
 
         flush();
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes(2));
+        permute_in_place(
+            get_qubit_positions(qs), [permutation_table](size_t qstate) { return permutation_table[qstate]; }, adjoint);
+        forget_values(qs);
+    }
 
-        std::vector<positional_qubit_id> positions = get_qubit_positions(qs);
+    /// Same as `permute_basis`, but the permutation of the basis states of the qubits `qs` is given by a function,
+    /// which is evaluated on the fly (and concurrently) instead of being looked up in a table. Throws (leaving the state
+    /// unchanged) if the function isn't a bijection on {0, ..., 2^qs.size() - 1}.
+    template <class F>
+    void permute_basis_by_function(std::vector<logical_qubit_id> const& qs, F const& permutation, bool adjoint = false)
+    {
+        if (qs.empty()) return;
+        flush();
+        KernelTimer timer(counters_, PerfCounters::Other, sweep_bytes(2));
+        permute_in_place(get_qubit_positions(qs), permutation, adjoint);
+        forget_values(qs);
+    }
+
+    RngEngine& rng()
+    {
+        return rng_;
+    }
+
+  private:
+    // Permutes the amplitudes in place by following the cycles of the permutation. The cycles are found in the space of
+    // the register (see `cycle_leaders`), then every cycle is rotated independently for all values of the remaining
+    // qubits, in parallel. The permutation is evaluated about once per amplitude.
+    template <class F>
+    void permute_in_place(std::vector<positional_qubit_id> const& positions, F const& permutation, bool adjoint)
+    {
+        const std::vector<std::uint64_t> leaders = cycle_leaders(1ull << positions.size(), permutation);
 
-        const size_t num_states = wfn_.size();
-        WavefunctionStorage psi_new(num_states);
         const size_t qmask = kernels::make_mask(positions);
+#pragma omp parallel for schedule(dynamic, 256)
+        for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(wfn_.size()); ++i)
+        {
+            const size_t r0 = detail::get_register(positions, i);
+            if (((leaders[r0 / 64] >> (r0 % 64)) & 1) == 0) continue;
+
+            if (!adjoint)
+            {
+                // the amplitude of r moves to permutation(r)
+                T carry = wfn_[i];
+                for (size_t r = permutation(r0); r != r0; r = permutation(r))
+                {
+                    std::swap(carry, wfn_[detail::set_register(positions, qmask, r, i)]);
+                }
+                wfn_[i] = carry;
+            }
+            else
+            {
+                // the amplitude of permutation(r) moves to r
+                T first = wfn_[i];
+                size_t current = i;
+                for (size_t r = permutation(r0); r != r0; r = permutation(r))
+                {
+                    const size_t next = detail::set_register(positions, qmask, r, i);
+                    wfn_[current] = wfn_[next];
+                    current = next;
+                }
+                wfn_[current] = first;
+            }
+        }
+    }
 
-        auto permute = [&positions, qmask, table_size, permutation_table](size_t basis_vector) {
-            size_t qstate = detail::get_register(positions, basis_vector);
-            return detail::set_register(positions, qmask, permutation_table[qstate], basis_vector);
+    // Returns a bitset with one element (the leader) of every cycle of `permutation` that isn't a fixed point,
+    // throws if `permutation` isn't a bijection on {0, ..., table_size - 1}. Each thread follows the cycles through the
+    // starting points of its own block of the table and claims their elements in a shared bitset; a walk that runs into
+    // an element claimed by another walk ends there. In a bijection that element is the first one of the other walk,
+    // so the pieces of the cycles shared by several walks are chained afterwards, serially but only once per piece.
+    // The permutation is evaluated once per element.
+    template <class F>
+    static std::vector<std::uint64_t> cycle_leaders(size_t table_size, F const& permutation)
+    {
+        const size_t words = (table_size + 63) / 64;
+        std::unique_ptr<std::atomic<std::uint64_t>[]> visited(new std::atomic<std::uint64_t>[words]());
+        std::unique_ptr<std::atomic<std::uint64_t>[]> leaders(new std::atomic<std::uint64_t>[words]());
+        auto claim = [&visited](size_t s) { // true if `s` hasn't been claimed before
+            const std::uint64_t bit = 1ull << (s % 64);
+            return (visited[s / 64].fetch_or(bit, std::memory_order_relaxed) & bit) == 0;
         };
+        auto lead = [&leaders](size_t r) { leaders[r / 64].fetch_or(1ull << (r % 64), std::memory_order_relaxed); };
 
-#ifndef NDEBUG
-        std::set<size_t> permuted;
-#endif
-        if (!adjoint)
+        std::vector<std::pair<size_t, size_t>> pieces; // first element and the element the walk ran into
+        std::atomic<bool> in_range{true};
+#pragma omp parallel if (table_size >= 4096)
         {
-            for (size_t i = 0; i < num_states; ++i)
+            std::vector<std::pair<size_t, size_t>> local;
+#pragma omp for schedule(static)
+            for (std::intptr_t i = 0; i < static_cast<std::intptr_t>(table_size); ++i)
             {
-                const size_t target = permute(i);
-                assert(permuted.insert(target).second); // should see no duplicates
-                psi_new[target] = wfn_[i];
+                const size_t r = static_cast<size_t>(i);
+                if (!claim(r)) continue;
+                const size_t first = permutation(r);
+                size_t s = first;
+                while (s != r && s < table_size && claim(s))
+                    s = permutation(s);
+
+                if (s >= table_size) in_range.store(false, std::memory_order_relaxed);
+                else if (s != r) local.emplace_back(r, s);
+                else if (first != r) lead(r);
             }
+#pragma omp critical
+            pieces.insert(pieces.end(), local.begin(), local.end());
         }
-        else
+        if (!in_range) throw std::runtime_error("the mapping of the basis states is not a permutation");
+
+        std::sort(pieces.begin(), pieces.end());
+        std::vector<bool> chained(pieces.size(), false);
+        for (size_t i = 0; i < pieces.size(); ++i)
         {
-            for (size_t i = 0; i < num_states; ++i)
+            if (chained[i]) continue;
+            lead(pieces[i].first);
+            size_t j = i;
+            do
             {
-                const size_t source = permute(i);
-                assert(permuted.insert(source).second); // should see no duplicates
-                psi_new[i] = wfn_[source];
+                chained[j] = true;
+                const size_t s = pieces[j].second;
+                auto next = std::lower_bound(pieces.begin(), pieces.end(), std::make_pair(s, size_t{0}));
+                j = static_cast<size_t>(next - pieces.begin());
+                if (next == pieces.end() || next->first != s || (chained[j] && j != i))
+                {
+                    throw std::runtime_error("the mapping of the basis states is not a permutation");
+                }
+            } while (j != i);
+        }
+
+        std::vector<std::uint64_t> result(words);
+        for (size_t w = 0; w < words; ++w)
+            result[w] = leaders[w].load(std::memory_order_relaxed);
+        return result;
+    }
+
+    // Applies the gates of `clusters`, one fused matrix per cluster. If fusing a cluster fails (the fused matrices
+    // count against the process memory budget), the clusters before it stay applied, the gates of it and of the
+    // following clusters are left in `unapplied_gates_` and the exception is rethrown.
+    void apply_clusters(std::list<Cluster> const& clusters) const
+    {
+        if (clusters.empty())
+        {
+            fused_.flush(wfn_);
+            if (fused_.fusedSpan() > 0)
+            {
+                ++counters_.clusters;
+                ++counters_.fused_span[fused_.fusedSpan()];
             }
         }
+        else
+        {
+            KernelTimer timer(counters_, PerfCounters::Fused, sweep_bytes(clusters.size()));
+            // One parallel region for all clusters: a single thread fuses the gates of a cluster while the others wait
+            // at the end of the `single`, then the whole team applies the fused matrix in the work-sharing loop of the
+            // kernel. This replaces a fork and join per cluster with a barrier.
+            //
+            // Nothing may throw out of the region: an exception that leaves an OpenMP region calls std::terminate, so
+            // code added to it, in the `single` or in the kernels, must catch what it throws. The `single` catches what
+            // fusing throws (allocations of the fused matrices), and after its barrier the whole team stops at the
+            // failed cluster; the kernels don't allocate.
+            std::exception_ptr failure;
+            std::list<Cluster>::const_iterator failed = clusters.end();
+#ifndef _MSC_VER
+#pragma omp parallel proc_bind(spread)
+#else
+#pragma omp parallel
+#endif
+            for (auto cl = clusters.begin(); cl != clusters.end(); ++cl)
+            {
+#pragma omp single
+                {
+                    try
+                    {
+                        TraceScope trace("cluster", cl->get_qids()); // logical ids, the kernel reports positions
+                        for (const DeferredGate& gate : cl->get_gates())
+                        {
+                            const std::vector<logical_qubit_id>& cs = gate.get_controls();
+                            if (cs.size() == 0)
+                            {
+                                fused_.apply(wfn_, gate.get_mat(), get_qubit_position(gate.get_target()));
+                            }
+                            else
+                            {
+                                fused_.apply_controlled(
+                                    wfn_,
+                                    gate.get_mat(),
+                                    get_qubit_positions(cs),
+                                    get_qubit_position(gate.get_target()));
+                            }
+                        }
+                        fused_.fuse();
+                        ++counters_.clusters;
+                        ++counters_.fused_span[fused_.fusedSpan()];
+                    }
+                    catch (...)
+                    {
+                        fused_.set_fusedgates(Fusion());
+                        failure = std::current_exception();
+                        failed = cl;
+                    }
+                }
+                if (failure) break;
 
-        // check that this was, indeed, a permutation of the basis
-        assert(permuted.size() == num_states);         // would follow if no duplicates encountered above
-        assert(*permuted.begin() == 0);                // min element in ordered set
-        assert(*(--permuted.end()) == num_states - 1); // max element in ordered set
+                TraceScope trace("kernel", fused_.fusedPositions(), omp_get_num_threads());
+                fused_.apply_fused(wfn_);
+            }
 
-        std::swap(wfn_, psi_new);
+            if (failure)
+            {
+                for (; failed != clusters.end(); ++failed)
+                {
+                    const std::vector<DeferredGate>& gates = failed->get_gates();
+                    unapplied_gates_.insert(unapplied_gates_.end(), gates.begin(), gates.end());
+                }
+                std::rethrow_exception(failure);
+            }
+        }
     }
 
-    RngEngine& rng()
+    void assign(Wavefunction const& other)
     {
-        return rng_;
+        other.flush();
+        wait_for_flush();
+        if (other.wfn_.size() > wfn_.capacity()) admit(other.wfn_.size(), "copying a state");
+
+        // The gates pending on this wave function are moot as its state is being overwritten.
+        pending_gates_.clear();
+        fused_ = other.fused_;
+
+        num_qubits_ = other.num_qubits_;
+        qubitmap_ = other.qubitmap_;
+        classical_ = other.classical_;
+        rng_ = other.rng_;
+#ifndef NDEBUG
+        usage_ = other.usage_;
+#endif
+        // When restoring a snapshot of the same size no reallocation happens and the copy is fully parallel.
+        kernels::parallel_copy(other.wfn_, wfn_);
     }
 };
 
@@ -14,6 +14,8 @@
 #endif
 
 #include "SafeInt.hpp"
+#include "util/mappedstorage.hpp"
+#include "util/memorybudget.hpp"
 
 namespace Microsoft
 {
@@ -56,17 +58,39 @@ class AlignedAlloc
         pointer ptr;
         SafeInt<size_type> sz(n);
         sz *= sizeof(T);
+
+        // counted with the alignment slack; refused if it exceeds the process-wide memory budget
+        MemoryBudget::instance().allocate(sz + Align);
+
+        // large state vectors might be configured to live in memory-mapped files (page aligned)
+        try
+        {
+            ptr = reinterpret_cast<pointer>(MappedStorage::instance().allocate(sz));
+            if (ptr != nullptr) return ptr;
+        }
+        catch (...)
+        {
+            MemoryBudget::instance().deallocate(sz + Align);
+            throw;
+        }
+
 #ifdef _WIN32
         ptr = reinterpret_cast<pointer>(_aligned_malloc(sz, Align));
-        if (ptr == 0) throw std::bad_alloc();
+        if (ptr == 0)
 #else
-        if (posix_memalign(reinterpret_cast<void**>(&ptr), Align, sz)) throw std::bad_alloc();
+        if (posix_memalign(reinterpret_cast<void**>(&ptr), Align, sz))
 #endif
+        {
+            MemoryBudget::instance().deallocate(sz + Align);
+            throw std::bad_alloc();
+        }
         return ptr;
     }
 
-    void deallocate(pointer ptr, size_type) noexcept
+    void deallocate(pointer ptr, size_type n) noexcept
     {
+        MemoryBudget::instance().deallocate(n * sizeof(T) + Align);
+        if (MappedStorage::instance().deallocate(ptr)) return;
 #ifdef _WIN32
         _aligned_free(ptr);
 #else
@@ -0,0 +1,82 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+namespace SIMULATOR
+{
+
+/// The eigenvalues, in ascending order, of the Hermitian n x n matrix h (row-major). H = A + iB is embedded into the
+/// real symmetric matrix [[A, -B], [B, A]], which has every eigenvalue of H twice, and that is diagonalized by cyclic
+/// Jacobi rotations. Meant for the small matrices of reduced states: the cost is O(n^3) per sweep.
+inline std::vector<double> hermitian_eigenvalues(std::vector<std::complex<double>> const& h, std::size_t n)
+{
+    const std::size_t m = 2 * n;
+    std::vector<double> a(m * m);
+    for (std::size_t r = 0; r < n; ++r)
+        for (std::size_t c = 0; c < n; ++c)
+        {
+            const std::complex<double> x = h[r * n + c];
+            a[r * m + c] = a[(n + r) * m + n + c] = x.real();
+            a[r * m + n + c] = -x.imag();
+            a[(n + r) * m + c] = x.imag();
+        }
+
+    double total = 0.;
+    for (double x : a)
+        total += x * x;
+    for (int sweep = 0; sweep < 100; ++sweep)
+    {
+        double off = 0.;
+        for (std::size_t p = 0; p < m; ++p)
+            for (std::size_t q = p + 1; q < m; ++q)
+                off += a[p * m + q] * a[p * m + q];
+        if (off <= 1e-30 * total) break;
+
+        for (std::size_t p = 0; p < m; ++p)
+            for (std::size_t q = p + 1; q < m; ++q)
+            {
+                const double apq = a[p * m + q];
+                if (apq == 0.) continue;
+                // the rotation that zeroes a(p, q), with the smaller of the two possible angles
+                const double theta = (a[q * m + q] - a[p * m + p]) / (2. * apq);
+                const double t = (theta >= 0. ? 1. : -1.) / (std::abs(theta) + std::sqrt(theta * theta + 1.));
+                const double c = 1. / std::sqrt(t * t + 1.), s = t * c;
+                for (std::size_t k = 0; k < m; ++k)
+                {
+                    const double akp = a[k * m + p], akq = a[k * m + q];
+                    a[k * m + p] = c * akp - s * akq;
+                    a[k * m + q] = s * akp + c * akq;
+                }
+                for (std::size_t k = 0; k < m; ++k)
+                {
+                    const double apk = a[p * m + k], aqk = a[q * m + k];
+                    a[p * m + k] = c * apk - s * aqk;
+                    a[q * m + k] = s * apk + c * aqk;
+                }
+            }
+    }
+
+    std::vector<double> diagonal(m);
+    for (std::size_t i = 0; i < m; ++i)
+        diagonal[i] = a[i * m + i];
+    std::sort(diagonal.begin(), diagonal.end());
+    std::vector<double> eigenvalues(n);
+    for (std::size_t i = 0; i < n; ++i)
+        eigenvalues[i] = 0.5 * (diagonal[2 * i] + diagonal[2 * i + 1]);
+    return eigenvalues;
+}
+
+} // namespace SIMULATOR
+} // namespace Quantum
+} // namespace Microsoft
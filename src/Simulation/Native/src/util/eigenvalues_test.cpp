@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+#include "eigenvalues.hpp"
+
+using Microsoft::Quantum::SIMULATOR::hermitian_eigenvalues;
+using Complex = std::complex<double>;
+
+int main()
+{
+    // Pauli Y
+    auto e = hermitian_eigenvalues({0., Complex(0., -1.), Complex(0., 1.), 0.}, 2);
+    assert(std::abs(e[0] + 1.) < 1e-12 && std::abs(e[1] - 1.) < 1e-12);
+
+    // [[a, b - ic], [b + ic, d]] has the eigenvalues (a + d)/2 -+ sqrt(((a - d)/2)^2 + b^2 + c^2)
+    const double a = 0.3, b = -0.7, c = 0.2, d = 1.1;
+    e = hermitian_eigenvalues({a, Complex(b, -c), Complex(b, c), d}, 2);
+    const double radius = std::sqrt((a - d) * (a - d) / 4 + b * b + c * c);
+    assert(std::abs(e[0] - ((a + d) / 2 - radius)) < 1e-12);
+    assert(std::abs(e[1] - ((a + d) / 2 + radius)) < 1e-12);
+
+    // the eigenvalues of a larger matrix have its trace and Frobenius norm
+    const std::size_t n = 16;
+    std::vector<Complex> h(n * n);
+    double trace = 0., frobenius = 0.;
+    for (std::size_t r = 0; r < n; ++r)
+        for (std::size_t s = r; s < n; ++s)
+        {
+            const Complex x(std::sin(1. + r * 7 + s), r == s ? 0. : std::cos(3. * r + s * s));
+            h[r * n + s] = x;
+            h[s * n + r] = std::conj(x);
+            if (r == s) trace += x.real();
+            frobenius += (r == s ? 1. : 2.) * std::norm(x);
+        }
+    e = hermitian_eigenvalues(h, n);
+    double sum = 0., squares = 0.;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if (i > 0) assert(e[i - 1] <= e[i]);
+        sum += e[i];
+        squares += e[i] * e[i];
+    }
+    assert(std::abs(sum - trace) < 1e-10);
+    assert(std::abs(squares - frobenius) < 1e-10);
+
+    return 0;
+}
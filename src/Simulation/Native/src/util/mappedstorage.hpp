@@ -0,0 +1,121 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// Places large allocations into memory-mapped files instead of anonymous memory, so that state vectors which don't fit
+/// into DRAM can page against fast local storage. The files are unlinked as soon as they are mapped and disappear with
+/// the mapping. The settings are process-wide (and shared by all simulator flavours) because the allocators using this
+/// storage are stateless. Memory mapping is only supported on POSIX systems, elsewhere all allocations come from the
+/// heap.
+class MappedStorage
+{
+  public:
+    static MappedStorage& instance()
+    {
+        static MappedStorage storage;
+        return storage;
+    }
+
+    /// Allocations of at least `min_bytes` will be backed by files in `directory`. An empty directory disables the
+    /// file-backed storage for new allocations.
+    void configure(std::string const& directory, std::size_t min_bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory_ = directory;
+        min_bytes_ = directory.empty() ? std::numeric_limits<std::size_t>::max() : min_bytes;
+    }
+
+    /// Returns nullptr if the allocation should come from the heap.
+    void* allocate(std::size_t bytes)
+    {
+        if (bytes < min_bytes_) return nullptr;
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (directory_.empty()) return nullptr;
+
+        std::string path = directory_ + "/qsim-state-XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) throw std::bad_alloc();
+        unlink(path.c_str());
+
+        // reserve the blocks up front, so running out of disk space fails here rather than with SIGBUS in a kernel
+#ifdef __linux__
+        bool reserved = (posix_fallocate(fd, 0, static_cast<off_t>(bytes)) == 0);
+#else
+        bool reserved = (ftruncate(fd, static_cast<off_t>(bytes)) == 0);
+#endif
+        void* ptr = reserved ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (ptr == MAP_FAILED) throw std::bad_alloc();
+
+        // the kernels sweep the state from low to high addresses
+        madvise(ptr, bytes, MADV_SEQUENTIAL);
+
+        mappings_.emplace(ptr, bytes);
+        ++num_mappings_;
+        return ptr;
+#else
+        return nullptr;
+#endif
+    }
+
+    /// Returns false if `ptr` wasn't allocated by this storage.
+    bool deallocate(void* ptr) noexcept
+    {
+        if (num_mappings_ == 0) return false;
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = mappings_.find(ptr);
+        if (it == mappings_.end()) return false;
+        munmap(it->first, it->second);
+        mappings_.erase(it);
+        --num_mappings_;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool is_mapped(void const* ptr)
+    {
+        if (num_mappings_ == 0) return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        return mappings_.find(const_cast<void*>(ptr)) != mappings_.end();
+    }
+
+  private:
+    MappedStorage()
+        : min_bytes_(std::numeric_limits<std::size_t>::max())
+        , num_mappings_(0)
+    {
+    }
+
+    std::mutex mutex_;
+    std::string directory_;
+    std::atomic<std::size_t> min_bytes_;
+    std::atomic<std::size_t> num_mappings_;
+    std::map<void*, std::size_t> mappings_;
+};
+
+} // namespace Quantum
+} // namespace Microsoft
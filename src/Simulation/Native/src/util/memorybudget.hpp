@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <string>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// Thrown when an allocation would exceed a memory budget. Growing a state is checked before anything is allocated or
+/// copied, so the simulator is left unchanged. A flush whose fused matrices don't fit keeps the gates it couldn't apply
+/// pending, so the state still describes the same gates.
+class MemoryBudgetExceeded : public std::bad_alloc
+{
+  public:
+    MemoryBudgetExceeded(std::string const& scope, char const* operation, std::size_t bytes, std::size_t used,
+                         std::size_t budget)
+        : message_(
+              "the " + scope + " memory budget of " + std::to_string(budget) + " bytes is exceeded: " + operation +
+              " needs " + std::to_string(bytes) + " more bytes and " + std::to_string(used) + " are in use")
+    {
+    }
+
+    const char* what() const noexcept override
+    {
+        return message_.c_str();
+    }
+
+  private:
+    std::string message_;
+};
+
+/// Process-wide accounting of the memory that comes from AlignedAlloc: state vectors, fused matrices and dump buffers
+/// of all simulators, including the alignment slack of every allocation. A limit of 0 means no limit.
+class MemoryBudget
+{
+  public:
+    static MemoryBudget& instance()
+    {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    void set_limit(std::size_t bytes)
+    {
+        limit_ = bytes;
+    }
+
+    std::size_t limit() const
+    {
+        return limit_;
+    }
+
+    std::size_t current() const
+    {
+        return current_;
+    }
+
+    std::size_t peak() const
+    {
+        return peak_;
+    }
+
+    /// Throws if `bytes` more wouldn't fit into the limit.
+    void admit(std::size_t bytes, char const* operation) const
+    {
+        const std::size_t limit = limit_, used = current_;
+        if (limit > 0 && used + bytes > limit) throw MemoryBudgetExceeded("process", operation, bytes, used, limit);
+    }
+
+    /// Accounts for an allocation of `bytes`, which is refused (with nothing accounted) if it would exceed the limit.
+    void allocate(std::size_t bytes)
+    {
+        const std::size_t used = current_.fetch_add(bytes) + bytes;
+        const std::size_t limit = limit_;
+        if (limit > 0 && used > limit)
+        {
+            current_ -= bytes;
+            throw MemoryBudgetExceeded("process", "an allocation", bytes, used - bytes, limit);
+        }
+        std::size_t peak = peak_;
+        while (used > peak && !peak_.compare_exchange_weak(peak, used))
+        {
+        }
+    }
+
+    void deallocate(std::size_t bytes) noexcept
+    {
+        current_ -= bytes;
+    }
+
+    void reset_peak()
+    {
+        peak_ = current_.load();
+    }
+
+  private:
+    MemoryBudget() = default;
+
+    std::atomic<std::size_t> limit_{0};
+    std::atomic<std::size_t> current_{0};
+    std::atomic<std::size_t> peak_{0};
+};
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -35,6 +35,15 @@ namespace openmp
 {
 
 MICROSOFT_QUANTUM_DECL void init(unsigned numthreads = 0);
+
+/// Upper bound for the number of threads the simulator picks for itself on the calling thread, 0 for no bound. Engines
+/// that run several simulators concurrently use it to confine each of them to its own group of cores.
+inline unsigned& thread_budget()
+{
+    static thread_local unsigned budget = 0;
+    return budget;
+}
+
 #ifdef _OPENMP
 
 class omp_mutex
@@ -0,0 +1,123 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"), a counter-based random number engine.
+/// The n-th block of four 32-bit numbers is a pure function of the key (the seed), the stream and n, so independent
+/// streams need no shared state, `discard` is O(1), and a copy of the engine continues with the same sequence. It
+/// meets the requirements of a uniform random bit generator. `uniform` turns the output into doubles in the same way on
+/// every platform, which the standard distributions don't guarantee.
+class Philox4x32
+{
+  public:
+    using result_type = std::uint32_t;
+    using Block = std::array<std::uint32_t, 4>;
+
+    explicit Philox4x32(std::uint64_t seed = 0, std::uint64_t stream = 0)
+    {
+        this->seed(seed, stream);
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+
+    static constexpr result_type max()
+    {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    /// Starts the sequence of `stream` for `seed` from the beginning.
+    void seed(std::uint64_t seed, std::uint64_t stream = 0)
+    {
+        key_ = {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)};
+        stream_ = stream;
+        index_ = 0;
+        used_ = 4;
+    }
+
+    result_type operator()()
+    {
+        if (used_ == 4)
+        {
+            block_ = block(key_, counter(index_++, stream_));
+            used_ = 0;
+        }
+        return block_[used_++];
+    }
+
+    /// Skips `n` numbers.
+    void discard(std::uint64_t n)
+    {
+        const std::uint64_t position = (index_ - (used_ < 4 ? 1 : 0)) * 4 + (used_ % 4) + n;
+        index_ = position / 4;
+        used_ = 4;
+        if (position % 4 != 0)
+        {
+            block_ = block(key_, counter(index_++, stream_));
+            used_ = static_cast<unsigned>(position % 4);
+        }
+    }
+
+    /// A double in [0, 1) with 53 random bits, made of the next two numbers.
+    double uniform()
+    {
+        const std::uint64_t hi = (*this)(), lo = (*this)();
+        return static_cast<double>(((hi << 32) | lo) >> 11) * (1. / 9007199254740992.);
+    }
+
+    bool operator==(Philox4x32 const& other) const
+    {
+        return key_ == other.key_ && stream_ == other.stream_ && index_ == other.index_ && used_ == other.used_;
+    }
+
+    bool operator!=(Philox4x32 const& other) const
+    {
+        return !(*this == other);
+    }
+
+    /// The ten rounds of Philox applied to `ctr` with `key`.
+    static Block block(std::array<std::uint32_t, 2> key, Block ctr)
+    {
+        for (int round = 0; round < 10; ++round)
+        {
+            if (round > 0)
+            {
+                key[0] += 0x9E3779B9u;
+                key[1] += 0xBB67AE85u;
+            }
+            const std::uint64_t p0 = static_cast<std::uint64_t>(0xD2511F53u) * ctr[0];
+            const std::uint64_t p1 = static_cast<std::uint64_t>(0xCD9E8D57u) * ctr[2];
+            ctr = {static_cast<std::uint32_t>(p1 >> 32) ^ ctr[1] ^ key[0], static_cast<std::uint32_t>(p1),
+                   static_cast<std::uint32_t>(p0 >> 32) ^ ctr[3] ^ key[1], static_cast<std::uint32_t>(p0)};
+        }
+        return ctr;
+    }
+
+  private:
+    static Block counter(std::uint64_t index, std::uint64_t stream)
+    {
+        return {static_cast<std::uint32_t>(index), static_cast<std::uint32_t>(index >> 32),
+                static_cast<std::uint32_t>(stream), static_cast<std::uint32_t>(stream >> 32)};
+    }
+
+    std::array<std::uint32_t, 2> key_;
+    std::uint64_t stream_;
+    std::uint64_t index_; // next block
+    unsigned used_;       // numbers of the current block handed out
+    Block block_ = {};
+};
+
+} // namespace Quantum
+} // namespace Microsoft
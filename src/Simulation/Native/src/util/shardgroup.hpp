@@ -0,0 +1,272 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// A group of processes on one node that share a segment of POSIX shared memory, named after a session, to exchange
+/// data: every process (rank) has a window for bulk data and a small slot for reductions, and the group synchronizes
+/// with barriers that spin on atomics in the segment. Rank 0 creates the segment; the other ranks wait for it, for up
+/// to 30 seconds, and the name is unlinked as soon as all of them are attached, so the segment disappears with the
+/// processes. Every rank has to make the same calls in the same order. Only supported on POSIX systems.
+class ShardGroup
+{
+  public:
+    /// Values in the reduction slot of a rank.
+    static constexpr unsigned slot_values = 64;
+
+    ShardGroup(std::string const& session, unsigned rank, unsigned processes, std::size_t window_bytes)
+        : rank_(rank)
+        , processes_(processes)
+        , window_bytes_((window_bytes + 63) / 64 * 64)
+    {
+        if (processes == 0 || rank >= processes)
+            throw std::runtime_error("the rank of a shard group must be less than its number of processes");
+        if (session.empty() || session.find('/') != std::string::npos)
+            throw std::runtime_error("the session of a shard group must be a non-empty name without '/'");
+#ifndef _WIN32
+        name_ = "/qdk-sim-" + session;
+        size_ = layout_bytes();
+        if (rank == 0)
+            create();
+        else
+            attach();
+        header()->pids_[rank_].store(static_cast<std::int64_t>(getpid()));
+        barrier();
+        if (rank == 0) shm_unlink(name_.c_str());
+#else
+        throw std::runtime_error("shard groups need POSIX shared memory");
+#endif
+    }
+
+    ShardGroup(ShardGroup const&) = delete;
+    ShardGroup& operator=(ShardGroup const&) = delete;
+
+    ~ShardGroup()
+    {
+#ifndef _WIN32
+        if (base_ != nullptr) munmap(base_, size_);
+#endif
+    }
+
+    unsigned rank() const
+    {
+        return rank_;
+    }
+
+    unsigned processes() const
+    {
+        return processes_;
+    }
+
+    std::size_t window_bytes() const
+    {
+        return window_bytes_;
+    }
+
+    /// The window of rank `r`. A rank writes its own window and reads the others' after a barrier.
+    void* window(unsigned r) const
+    {
+        return base_ + windows_offset() + r * window_bytes_;
+    }
+
+    /// Waits until all ranks have arrived. Throws if another rank has exited in the meantime.
+    void barrier()
+    {
+        Header* h = header();
+        const std::uint32_t generation = h->generation_.load(std::memory_order_acquire);
+        if (h->arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == processes_)
+        {
+            h->arrived_.store(0, std::memory_order_relaxed);
+            h->generation_.store(generation + 1, std::memory_order_release);
+            return;
+        }
+        auto checked = std::chrono::steady_clock::now();
+        for (unsigned spins = 0; h->generation_.load(std::memory_order_acquire) == generation; ++spins)
+        {
+            std::this_thread::yield();
+            if (spins % 1024 != 0 || std::chrono::steady_clock::now() - checked < std::chrono::seconds(1)) continue;
+            checked = std::chrono::steady_clock::now();
+#ifndef _WIN32
+            check_peers();
+#endif
+        }
+    }
+
+    /// Sets `all[r * n + i]` to `values[i]` of rank r, for n <= slot_values.
+    void gather(double const* values, unsigned n, double* all)
+    {
+        if (n > slot_values) throw std::runtime_error("too many values for the slots of a shard group");
+        std::copy(values, values + n, slot(rank_));
+        barrier();
+        for (unsigned r = 0; r < processes_; ++r)
+            std::copy(slot(r), slot(r) + n, all + r * n);
+        barrier();
+    }
+
+    /// Replaces `values` by their sums over all ranks, for n <= slot_values. The sums are taken in the order of the
+    /// ranks, so all ranks get exactly the same result.
+    void sum(double* values, unsigned n)
+    {
+        if (n > slot_values) throw std::runtime_error("too many values for the slots of a shard group");
+        std::copy(values, values + n, slot(rank_));
+        barrier();
+        std::fill(values, values + n, 0.);
+        for (unsigned r = 0; r < processes_; ++r)
+            for (unsigned i = 0; i < n; ++i)
+                values[i] += slot(r)[i];
+        barrier();
+    }
+
+    /// Returns the `value` of rank 0 on all ranks.
+    std::uint64_t broadcast(std::uint64_t value)
+    {
+        if (rank_ == 0) header()->broadcast_ = value;
+        barrier();
+        value = header()->broadcast_;
+        barrier();
+        return value;
+    }
+
+  private:
+    static constexpr std::uint64_t ready_magic = 0x71646b2d73686172; // "qdk-shar"
+
+    struct alignas(64) Header
+    {
+        std::atomic<std::uint64_t> ready_;
+        std::uint32_t processes_;
+        std::uint64_t size_;
+        std::uint64_t broadcast_;
+        alignas(64) std::atomic<std::uint32_t> arrived_;
+        alignas(64) std::atomic<std::uint32_t> generation_;
+        alignas(64) std::atomic<std::int64_t> pids_[64];
+    };
+    static_assert(
+        std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free &&
+            std::atomic<std::int64_t>::is_always_lock_free,
+        "the atomics in shared memory must be lock-free");
+
+    Header* header() const
+    {
+        return reinterpret_cast<Header*>(base_);
+    }
+
+    double* slot(unsigned r) const
+    {
+        return reinterpret_cast<double*>(base_ + sizeof(Header)) + r * slot_values;
+    }
+
+    std::size_t windows_offset() const
+    {
+        return sizeof(Header) + processes_ * slot_values * sizeof(double);
+    }
+
+    std::size_t layout_bytes() const
+    {
+        if (processes_ > 64) throw std::runtime_error("a shard group has at most 64 processes");
+        return windows_offset() + processes_ * window_bytes_;
+    }
+
+#ifndef _WIN32
+    // removes a segment left behind by an earlier session of the same name, then creates and initializes a new one
+    void create()
+    {
+        shm_unlink(name_.c_str());
+        int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) throw std::runtime_error("cannot create the shared memory of shard group " + name_);
+        const bool sized = (ftruncate(fd, static_cast<off_t>(size_)) == 0);
+        void* ptr = sized ? mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (ptr == MAP_FAILED)
+        {
+            shm_unlink(name_.c_str());
+            throw std::bad_alloc();
+        }
+        base_ = static_cast<char*>(ptr);
+
+        Header* h = new (base_) Header();
+        h->processes_ = processes_;
+        h->size_ = size_;
+        h->broadcast_ = 0;
+        h->arrived_.store(0);
+        h->generation_.store(0);
+        for (auto& pid : h->pids_)
+            pid.store(0);
+        h->ready_.store(ready_magic, std::memory_order_release);
+    }
+
+    // waits for rank 0 to create the segment; a segment that is not ready yet or left behind is retried
+    void attach()
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (base_ == nullptr)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                throw std::runtime_error("timed out waiting for rank 0 of shard group " + name_);
+
+            int fd = shm_open(name_.c_str(), O_RDWR, 0600);
+            struct stat st;
+            if (fd >= 0 && fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == size_)
+            {
+                void* ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (ptr != MAP_FAILED)
+                {
+                    Header* h = static_cast<Header*>(ptr);
+                    const std::int64_t creator = h->pids_[0].load();
+                    const bool alive = creator == 0 || kill(static_cast<pid_t>(creator), 0) == 0 || errno != ESRCH;
+                    if (h->ready_.load(std::memory_order_acquire) == ready_magic && h->processes_ == processes_ &&
+                        h->size_ == size_ && alive)
+                        base_ = static_cast<char*>(ptr);
+                    else
+                        munmap(ptr, size_);
+                }
+            }
+            if (fd >= 0) close(fd);
+            if (base_ == nullptr) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void check_peers() const
+    {
+        for (unsigned r = 0; r < processes_; ++r)
+        {
+            const std::int64_t pid = header()->pids_[r].load();
+            if (pid != 0 && kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH)
+                throw std::runtime_error("rank " + std::to_string(r) + " of shard group " + name_ + " has exited");
+        }
+    }
+#endif
+
+    unsigned rank_;
+    unsigned processes_;
+    std::size_t window_bytes_;
+    std::string name_;
+    std::size_t size_ = 0;
+    char* base_ = nullptr;
+};
+
+} // namespace Quantum
+} // namespace Microsoft
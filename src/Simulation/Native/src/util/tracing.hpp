@@ -0,0 +1,234 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// Records a timeline of the simulator's work (flushes, clusters, fused kernels, measurements, allocations) and writes
+/// it as a Chrome trace-event file, which chrome://tracing and Perfetto display. Every thread records into its own ring
+/// buffer without locks or allocations, keeping the last `capacity` events; when recording is off, a trace point costs
+/// one relaxed atomic load. Recording is process-wide, like the storage settings, and should be started and stopped
+/// while no simulator is running.
+class TraceRecorder
+{
+  public:
+    struct Event
+    {
+        const char* name; // a string literal
+        std::uint64_t begin; // ns since the start of the recording
+        std::uint64_t end;
+        std::uint64_t qubits; // up to 8 positions, one per byte
+        int span;             // number of positions in `qubits`, -1 if the event has none
+        int threads;          // size of the OpenMP team, 0 if not applicable
+    };
+
+    static TraceRecorder& instance()
+    {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    bool enabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    /// Discards the events recorded so far and starts recording. The trace is written to `path` by `stop`.
+    void start(std::string const& path, std::size_t capacity = 1u << 16)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enabled_.store(false);
+        path_ = path;
+        capacity_ = capacity;
+        release_orphans();
+        for (auto& b : buffers_)
+            b->head.store(0);
+        origin_ = std::chrono::steady_clock::now();
+        enabled_.store(!path.empty());
+    }
+
+    /// Stops recording and writes the events. Returns false if nothing was being recorded or the file couldn't be
+    /// written.
+    bool stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!enabled_.exchange(false)) return false;
+
+        std::ofstream out(path_);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (auto const& b : buffers_)
+        {
+            const std::size_t head = b->head.load(std::memory_order_acquire);
+            const std::size_t count = std::min(head, b->events.size());
+            for (std::size_t i = head - count; i < head; ++i)
+            {
+                Event const& e = b->events[i % b->events.size()];
+                // complete events ("X"): a begin timestamp and a duration, in microseconds
+                out << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"simulator\",\"ph\":\"X\"";
+                out << ",\"pid\":1,\"tid\":" << b->tid << ",\"ts\":" << e.begin / 1000.
+                    << ",\"dur\":" << (e.end - e.begin) / 1000. << ",\"args\":{";
+                const char* separator = "";
+                if (e.span >= 0)
+                {
+                    out << "\"span\":" << e.span << ",\"qubits\":[";
+                    for (int k = 0; k < e.span; ++k)
+                        out << (k > 0 ? "," : "") << ((e.qubits >> (8 * k)) & 0xff);
+                    out << "]";
+                    separator = ",";
+                }
+                if (e.threads > 0) out << separator << "\"threads\":" << e.threads;
+                out << "}}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        release_orphans();
+        return static_cast<bool>(out);
+    }
+
+    /// Number of per-thread buffers held, including those of exited threads whose events haven't been written yet.
+    std::size_t buffers()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return buffers_.size();
+    }
+
+    std::uint64_t now() const
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count());
+    }
+
+    /// Appends an event to the ring buffer of the calling thread.
+    void record(Event const& e)
+    {
+        Buffer* b = local_buffer();
+        const std::size_t head = b->head.load(std::memory_order_relaxed);
+        b->events[head % b->events.size()] = e;
+        b->head.store(head + 1, std::memory_order_release);
+    }
+
+  private:
+    struct Buffer
+    {
+        std::vector<Event> events;
+        std::atomic<std::size_t> head{0};
+        std::atomic<bool> orphaned{false}; // its thread has exited
+        unsigned tid = 0;
+    };
+
+    // marks the buffer of a thread as orphaned when the thread exits
+    struct Owner
+    {
+        Buffer* buffer = nullptr;
+
+        ~Owner()
+        {
+            if (buffer != nullptr) buffer->orphaned.store(true, std::memory_order_release);
+        }
+    };
+
+    TraceRecorder() = default;
+
+    // The buffer of a thread is created by its first event and reused by later recordings (unless the capacity
+    // changed). The buffers are owned by the recorder, so the events of threads that have exited (background flush
+    // workers, trajectory workers) are still written by `stop`; their buffers are freed by the next `stop` or `start`.
+    Buffer* local_buffer()
+    {
+        static thread_local Owner owner;
+        Buffer*& buffer = owner.buffer;
+        if (buffer == nullptr || buffer->events.size() != capacity_)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (buffer == nullptr)
+            {
+                buffers_.emplace_back(new Buffer());
+                buffer = buffers_.back().get();
+                buffer->tid = ++threads_;
+            }
+            buffer->events.assign(capacity_, Event{});
+            buffer->head.store(0);
+        }
+        return buffer;
+    }
+
+    // frees the buffers of the threads that have exited, with mutex_ held
+    void release_orphans()
+    {
+        buffers_.erase(
+            std::remove_if(
+                buffers_.begin(),
+                buffers_.end(),
+                [](std::unique_ptr<Buffer> const& b) { return b->orphaned.load(std::memory_order_acquire); }),
+            buffers_.end());
+    }
+
+    std::mutex mutex_;
+    std::atomic<bool> enabled_{false};
+    std::string path_;
+    std::size_t capacity_ = 1u << 16;
+    std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+    unsigned threads_ = 0; // threads that have recorded, numbers the buffers
+};
+
+/// Records an event spanning its scope if tracing is on.
+class TraceScope
+{
+  public:
+    explicit TraceScope(const char* name, int threads = 0)
+        : active_(TraceRecorder::instance().enabled())
+    {
+        if (!active_) return;
+        event_.name = name;
+        event_.begin = TraceRecorder::instance().now();
+        event_.qubits = 0;
+        event_.span = -1;
+        event_.threads = threads;
+    }
+
+    template <class Qubits>
+    TraceScope(const char* name, Qubits const& qubits, int threads = 0)
+        : TraceScope(name, threads)
+    {
+        if (!active_) return;
+        event_.span = 0;
+        for (auto q : qubits)
+        {
+            if (event_.span == 8) break;
+            event_.qubits |= static_cast<std::uint64_t>(q & 0xff) << (8 * event_.span++);
+        }
+    }
+
+    TraceScope(TraceScope const&) = delete;
+    TraceScope& operator=(TraceScope const&) = delete;
+
+    ~TraceScope()
+    {
+        if (!active_) return;
+        event_.end = TraceRecorder::instance().now();
+        TraceRecorder::instance().record(event_);
+    }
+
+  private:
+    bool active_;
+    TraceRecorder::Event event_;
+};
+
+} // namespace Quantum
+} // namespace Microsoft
@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+namespace Microsoft
+{
+namespace Quantum
+{
+
+/// A single background thread that runs the submitted tasks one after the other, in the order of submission. The thread
+/// is started with the first task and lives as long as the worker, so that the OpenMP team it forks for the kernels is
+/// kept around between tasks. Exceptions thrown by a task are rethrown by `get` on the future returned by `submit`.
+class BackgroundWorker
+{
+  public:
+    BackgroundWorker() = default;
+    BackgroundWorker(BackgroundWorker const&) = delete;
+    BackgroundWorker& operator=(BackgroundWorker const&) = delete;
+
+    /// Waits for all submitted tasks to finish.
+    ~BackgroundWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    std::future<void> submit(std::function<void()> task)
+    {
+        std::packaged_task<void()> pt(std::move(task));
+        std::future<void> result = pt.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+            tasks_.push_back(std::move(pt));
+        }
+        cv_.notify_one();
+        return result;
+    }
+
+  private:
+    void run()
+    {
+        for (;;)
+        {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::packaged_task<void()>> tasks_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace Quantum
+} // namespace Microsoft